@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zelda64/crc32.h>
+#include <zelda64/dma.h>
+#include <zelda64/rom.h>
+#include <zelda64/yaz0.h>
+
+#include "synthetic_rom.h"
+#include "../src/stats.h"
+
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_DEFAULT_FILE_COUNT 1532
+#define BENCH_DEFAULT_MIN_TIME 0.5
+// The Yaz0 benchmarks run on a slice of the ROM, so the slow levels finish in reasonable time.
+#define BENCH_SAMPLE_SIZE (1024 * 1024)
+// Increment whenever fields of the results change meaning.
+#define BENCH_FORMAT_VERSION 1
+
+typedef struct bench_options {
+    uint64_t seed;
+    uint32_t file_count;
+    double min_time;
+    const char *out_filename;
+    bool skip_rom;
+} bench_options_t;
+
+typedef struct bench_result {
+    const char *name;
+    int level;
+    size_t bytes;
+    size_t iterations;
+    double best;
+    double total;
+} bench_result_t;
+
+typedef struct bench_state {
+    const synthetic_rom_t *rom;
+    zelda64_rom_t handle;
+    const uint8_t *sample;
+    size_t sample_size;
+    // Buffers shared between the benchmarks, sized for the largest user.
+    uint8_t *compressed;
+    size_t compressed_size;
+    size_t compressed_capacity;
+    uint8_t *scratch;
+    size_t scratch_size;
+    zelda64_yaz0_compressor_t compressor;
+    int level;
+    bool failed;
+} bench_state_t;
+
+typedef void (bench_func_t)(bench_state_t *state);
+
+// Runs a benchmark until it took at least min_time in total, and at least once.
+static bench_result_t run(const char *name, int level, size_t bytes, bench_func_t *func, bench_state_t *state,
+                          double min_time) {
+    bench_result_t result = {
+            .name = name,
+            .level = level,
+            .bytes = bytes,
+    };
+    state->level = level;
+    while (result.iterations == 0 || result.total < min_time) {
+        double start = zelda64_stats_now();
+        func(state);
+        double elapsed = zelda64_stats_now() - start;
+        result.best = result.iterations == 0 || elapsed < result.best ? elapsed : result.best;
+        result.total += elapsed;
+        ++result.iterations;
+    }
+    double mb_per_s = (double) bytes / result.best / 1e6;
+    if (level >= 0) {
+        fprintf(stderr, "%-16s %2d %10.2f MB/s %8.3f ns/byte\n", name, level, mb_per_s, result.best * 1e9 / bytes);
+    } else {
+        fprintf(stderr, "%-16s    %10.2f MB/s %8.3f ns/byte\n", name, mb_per_s, result.best * 1e9 / bytes);
+    }
+    return result;
+}
+
+static void bench_yaz0_compress(bench_state_t *state) {
+    // The compressor is kept between runs like a real caller would, only a new level starts a new one.
+    if (state->compressor.level != state->level) {
+        zelda64_yaz0_compressor_free(&state->compressor);
+        if (zelda64_yaz0_compressor_init(&state->compressor, state->level, zelda64_default_allocator()) !=
+            ZELDA64_OK) {
+            state->failed = true;
+            return;
+        }
+    }
+    if (zelda64_yaz0_compressor_compress(&state->compressor, state->compressed, state->compressed_capacity,
+                                         state->sample, state->sample_size, &state->compressed_size) != ZELDA64_OK) {
+        state->failed = true;
+    }
+}
+
+static void bench_yaz0_decompress(bench_state_t *state) {
+    if (zelda64_yaz0_decompress_checked(state->scratch, state->sample_size, state->compressed,
+                                        state->compressed_size) != ZELDA64_OK) {
+        state->failed = true;
+    }
+}
+
+static void bench_crc32(bench_state_t *state) {
+    // Keep the result alive so the call is not optimized out.
+    state->scratch[0] = (uint8_t) zelda64_crc32_calculate_checksum(state->rom->data, state->rom->size);
+}
+
+static void bench_n64_checksum(bench_state_t *state) {
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    zelda64_calculate_rom_checksum(state->rom->data, state->rom->size, state->handle.cic, &crc1, &crc2);
+    state->scratch[0] = (uint8_t) (crc1 ^ crc2);
+}
+
+static void bench_dma_scan(bench_state_t *state) {
+    uint64_t offset = 0;
+    if (zelda64_find_dma_table_offset(state->scratch, state->rom->size, &offset) != 0) {
+        state->failed = true;
+    }
+}
+
+static void bench_rom_compress(bench_state_t *state) {
+    static const uint32_t exclusions[] = {0, 1, 2};
+    if (zelda64_rom_compress(&state->handle, state->compressed, state->compressed_capacity, exclusions,
+                             sizeof exclusions / sizeof exclusions[0], state->level, zelda64_default_allocator(),
+                             &state->compressed_size) != ZELDA64_OK) {
+        state->failed = true;
+    }
+}
+
+static void bench_rom_decompress(bench_state_t *state) {
+    zelda64_rom_t compressed;
+    if (zelda64_rom_open(&compressed, state->compressed, state->compressed_size) != ZELDA64_OK ||
+        zelda64_rom_decompress(&compressed, state->scratch, state->scratch_size) != ZELDA64_OK) {
+        state->failed = true;
+    }
+}
+
+static void write_results(FILE *file, const bench_options_t *opts, const synthetic_rom_t *rom,
+                          const bench_result_t *results, size_t result_count) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": %d,\n", BENCH_FORMAT_VERSION);
+    fprintf(file, "  \"rom\": {\"seed\": %llu, \"files\": %u, \"size\": %zu},\n",
+            (unsigned long long) opts->seed, rom->file_count, rom->size);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < result_count; ++i) {
+        const bench_result_t *result = &results[i];
+        fprintf(file, "    {\"name\": \"%s\", ", result->name);
+        if (result->level >= 0) {
+            fprintf(file, "\"level\": %d, ", result->level);
+        } else {
+            fprintf(file, "\"level\": null, ");
+        }
+        fprintf(file, "\"bytes\": %zu, \"iterations\": %zu, \"best_s\": %.9f, \"mean_s\": %.9f, "
+                      "\"mb_per_s\": %.3f, \"ns_per_byte\": %.4f}%s\n",
+                result->bytes, result->iterations, result->best, result->total / (double) result->iterations,
+                (double) result->bytes / result->best / 1e6, result->best * 1e9 / (double) result->bytes,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+static void print_usage(FILE *stream) {
+    fprintf(stream, "Usage: zelda64-bench [-h] [-q] [-s seed] [-n files] [-t seconds] [-o results.json]\n");
+}
+
+static void print_help() {
+    print_usage(stdout);
+    printf("Measures the throughput of libzelda64 on a generated ROM. Results are written as JSON.\n");
+    printf("\t-s=<seed>\n\t\tSeed of the generated ROM, default %d.\n", BENCH_DEFAULT_SEED);
+    printf("\t-n=<files>\n\t\tAmount of files in the generated ROM, default %d.\n", BENCH_DEFAULT_FILE_COUNT);
+    printf("\t-t=<seconds>\n\t\tMinimum time to run each benchmark for, default %.1f.\n", BENCH_DEFAULT_MIN_TIME);
+    printf("\t-o=<results.json>\n\t\tWrites the results to a file instead of stdout.\n");
+    printf("\t-q\n\t\tSkips the full-ROM compress and decompress benchmarks.\n");
+}
+
+static bool parse_command_line_opts(bench_options_t *opts, int argc, const char *const *argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-h") == 0) {
+            print_help();
+            exit(EXIT_SUCCESS);
+        } else if (strcmp(arg, "-q") == 0) {
+            opts->skip_rom = true;
+        } else if (strcmp(arg, "-s") == 0 && has_value) {
+            opts->seed = strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(arg, "-n") == 0 && has_value) {
+            opts->file_count = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(arg, "-t") == 0 && has_value) {
+            opts->min_time = strtod(argv[++i], nullptr);
+        } else if (strcmp(arg, "-o") == 0 && has_value) {
+            opts->out_filename = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return opts->file_count >= 4;
+}
+
+int main(int argc, char *argv[]) {
+    bench_options_t opts = {
+            .seed = BENCH_DEFAULT_SEED,
+            .file_count = BENCH_DEFAULT_FILE_COUNT,
+            .min_time = BENCH_DEFAULT_MIN_TIME,
+    };
+    if (!parse_command_line_opts(&opts, argc, (const char *const *) argv)) {
+        print_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    zelda64_allocator_t allocator = zelda64_default_allocator();
+    synthetic_rom_t rom;
+    if (synthetic_rom_generate(&rom, opts.seed, opts.file_count, allocator) != ZELDA64_OK) {
+        fprintf(stderr, "could not generate a ROM\n");
+        return EXIT_FAILURE;
+    }
+    bench_state_t state = {
+            .rom = &rom,
+            .sample = rom.data + SYNTHETIC_ROM_DMA_OFFSET,
+            .sample_size = rom.size - SYNTHETIC_ROM_DMA_OFFSET < BENCH_SAMPLE_SIZE
+                           ? rom.size - SYNTHETIC_ROM_DMA_OFFSET : BENCH_SAMPLE_SIZE,
+            .scratch_size = rom.size,
+    };
+    int status = EXIT_SUCCESS;
+    bench_result_t results[ZELDA64_YAZ0_MAX_LEVEL + 8];
+    size_t result_count = 0;
+    if (zelda64_rom_open(&state.handle, rom.data, rom.size) != ZELDA64_OK) {
+        fprintf(stderr, "generated ROM is invalid\n");
+        synthetic_rom_free(&rom);
+        return EXIT_FAILURE;
+    }
+    size_t rom_bound = zelda64_rom_compress_bound(&state.handle);
+    size_t sample_bound = zelda64_yaz0_compress_bound(state.sample_size);
+    state.compressed_capacity = rom_bound > sample_bound ? rom_bound : sample_bound;
+    state.compressed = allocator.alloc(state.compressed_capacity, sizeof(uint8_t), allocator.userdata);
+    state.scratch = allocator.alloc(state.scratch_size, sizeof(uint8_t), allocator.userdata);
+    if (state.compressed == nullptr || state.scratch == nullptr ||
+        zelda64_yaz0_compressor_init(&state.compressor, 0, allocator) != ZELDA64_OK) {
+        fprintf(stderr, "out of memory\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    fprintf(stderr, "ROM: seed %llu, %u files, %zu bytes\n", (unsigned long long) opts.seed, rom.file_count,
+            rom.size);
+    for (int level = 0; level <= ZELDA64_YAZ0_MAX_LEVEL; ++level) {
+        results[result_count++] = run("yaz0_compress", level, state.sample_size, bench_yaz0_compress, &state,
+                                      opts.min_time);
+    }
+    // Decompress what the default level produces.
+    state.level = ZELDA64_YAZ0_GREEDY_LEVEL;
+    bench_yaz0_compress(&state);
+    results[result_count++] = run("yaz0_decompress", -1, state.sample_size, bench_yaz0_decompress, &state,
+                                  opts.min_time);
+    results[result_count++] = run("crc32", -1, rom.size, bench_crc32, &state, opts.min_time);
+    // The checksum only covers the megabyte after the bootcode, however large the ROM is.
+    results[result_count++] = run("n64_checksum", -1, ZELDA64_CHECKSUM_END - 0x1000, bench_n64_checksum, &state,
+                                  opts.min_time);
+    // Scan a copy of the ROM with the table moved to the very end, so the scan covers all of it.
+    memcpy(state.scratch, rom.data, rom.size);
+    memset(state.scratch + SYNTHETIC_ROM_DMA_OFFSET, 0xFF, 32);
+    memcpy(state.scratch + rom.size - 20, rom.data + SYNTHETIC_ROM_DMA_OFFSET, 20);
+    results[result_count++] = run("dma_scan", -1, rom.size, bench_dma_scan, &state, opts.min_time);
+    if (!opts.skip_rom) {
+        results[result_count++] = run("rom_compress", ZELDA64_YAZ0_GREEDY_LEVEL, rom.size, bench_rom_compress,
+                                      &state, opts.min_time);
+        results[result_count++] = run("rom_decompress", -1, rom.size, bench_rom_decompress, &state, opts.min_time);
+    }
+    if (state.failed) {
+        fprintf(stderr, "a benchmark failed, results are not meaningful\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    FILE *out = opts.out_filename != nullptr ? fopen(opts.out_filename, "w") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "could not open %s\n", opts.out_filename);
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    write_results(out, &opts, &rom, results, result_count);
+    if (out != stdout) {
+        fclose(out);
+    }
+cleanup:
+    zelda64_yaz0_compressor_free(&state.compressor);
+    if (state.compressed != nullptr) {
+        allocator.free(state.compressed, allocator.userdata);
+    }
+    if (state.scratch != nullptr) {
+        allocator.free(state.scratch, allocator.userdata);
+    }
+    synthetic_rom_free(&rom);
+    return status;
+}
@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <string.h>
+
+#include <zelda64/dma.h>
+
+#include "synthetic_rom.h"
+
+#define SYNTHETIC_ROM_MAKEROM_SIZE 0x1060
+#define SYNTHETIC_ROM_MIN_SIZE 0x101000
+
+typedef enum file_kind {
+    FILE_KIND_RANDOM = 0,
+    FILE_KIND_WORDS = 1,
+    FILE_KIND_RUNS = 2,
+    FILE_KIND_MATCHES = 3,
+} file_kind_t;
+
+// SplitMix64, small and good enough to make test data from.
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+static uint32_t random_range(uint64_t *state, uint32_t low, uint32_t high) {
+    return low + (uint32_t) (next_random(state) % (high - low + 1));
+}
+
+// Sizes follow the shape of the real game: mostly small files with the occasional large one.
+static uint32_t file_size(uint64_t *state, uint32_t index) {
+    uint32_t size = random_range(state, 0, 9) != 0
+                    ? random_range(state, 16, 4000)
+                    : random_range(state, 4000, index % 97 == 0 ? 400000 : 40000);
+    return (size + 15) & ~15u;
+}
+
+static void fill_file(uint8_t *dest, size_t size, file_kind_t kind, uint64_t *state) {
+    static const char *const words[] = {
+            "link", "zelda", "ganon", "\0\0\0\0", "\x3C\x01\x80\x10", "\x27\xBD\xFF\xE8", "hyrule", "ocarina",
+    };
+    static const size_t word_sizes[] = {4, 5, 5, 4, 4, 4, 6, 7};
+    size_t i = 0;
+    switch (kind) {
+        case FILE_KIND_RANDOM:
+            for (; i < size; ++i) {
+                dest[i] = (uint8_t) next_random(state);
+            }
+            break;
+        case FILE_KIND_WORDS:
+            while (i < size) {
+                size_t word = next_random(state) % 8;
+                for (size_t j = 0; j < word_sizes[word] && i < size; ++j) {
+                    dest[i++] = (uint8_t) words[word][j];
+                }
+            }
+            break;
+        case FILE_KIND_RUNS:
+            while (i < size) {
+                uint8_t value = (uint8_t) next_random(state);
+                for (uint32_t run = random_range(state, 1, 64); run > 0 && i < size; --run) {
+                    dest[i++] = value;
+                }
+            }
+            break;
+        case FILE_KIND_MATCHES:
+            // Literals from a small alphabet mixed with copies from up to a window back.
+            while (i < size) {
+                if (i > 0 && random_range(state, 0, 9) < 6) {
+                    size_t distance = random_range(state, 1, i < 4096 ? (uint32_t) i : 4096);
+                    for (uint32_t length = random_range(state, 3, 40); length > 0 && i < size; --length, ++i) {
+                        dest[i] = dest[i - distance];
+                    }
+                } else {
+                    dest[i++] = (uint8_t) (next_random(state) & 0x3F);
+                }
+            }
+            break;
+    }
+}
+
+zelda64_result_t synthetic_rom_generate(synthetic_rom_t *rom, uint64_t seed, uint32_t file_count,
+                                        zelda64_allocator_t allocator) {
+    assert(rom != nullptr);
+    assert(file_count >= 4);
+    *rom = (synthetic_rom_t) {
+            .file_count = file_count,
+            .allocator = allocator,
+    };
+    // Sizes and contents come from separate streams, so the layout does not depend on how files are filled.
+    uint64_t layout_state = seed;
+    uint64_t data_state = seed ^ 0x5A454C4441363421;
+    uint32_t *sizes = allocator.alloc(file_count, sizeof(uint32_t), allocator.userdata);
+    if (sizes == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    size_t dma_size = (size_t) file_count * 16;
+    size_t files_start = SYNTHETIC_ROM_DMA_OFFSET + dma_size;
+    size_t end = files_start;
+    for (uint32_t i = 3; i < file_count; ++i) {
+        // Leave some holes at the end of the table, like the unused entries of the game.
+        sizes[i] = i > file_count - file_count / 64 && i % 3 == 0 ? 0 : file_size(&layout_state, i);
+        end += sizes[i];
+    }
+    // Round up to a power of two no smaller than the area the checksum covers.
+    size_t size = 1;
+    while (size < end || size < SYNTHETIC_ROM_MIN_SIZE) {
+        size *= 2;
+    }
+    uint8_t *data = allocator.alloc(size, sizeof(uint8_t), allocator.userdata);
+    if (data == nullptr) {
+        allocator.free(sizes, allocator.userdata);
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    // The header and bootcode are noise behind a valid PI settings word.
+    fill_file(data, SYNTHETIC_ROM_MAKEROM_SIZE, FILE_KIND_RANDOM, &data_state);
+    memcpy(data, "\x80\x37\x12\x40", 4);
+    uint8_t *table = data + SYNTHETIC_ROM_DMA_OFFSET;
+    zelda64_dma_entry_t fixed[3] = {
+            {0, SYNTHETIC_ROM_MAKEROM_SIZE, 0, 0},
+            {SYNTHETIC_ROM_MAKEROM_SIZE, SYNTHETIC_ROM_DMA_OFFSET, SYNTHETIC_ROM_MAKEROM_SIZE, 0},
+            {SYNTHETIC_ROM_DMA_OFFSET, (uint32_t) files_start, SYNTHETIC_ROM_DMA_OFFSET, 0},
+    };
+    for (uint32_t i = 0; i < 3; ++i) {
+        zelda64_set_dma_table_entry(table, dma_size, i, fixed[i]);
+    }
+    size_t cursor = files_start;
+    for (uint32_t i = 3; i < file_count; ++i) {
+        zelda64_dma_entry_t entry = {0, 0, 0xFFFFFFFF, 0xFFFFFFFF};
+        if (sizes[i] > 0) {
+            fill_file(data + cursor, sizes[i], (file_kind_t) (i % 4), &data_state);
+            entry = (zelda64_dma_entry_t) {(uint32_t) cursor, (uint32_t) (cursor + sizes[i]), (uint32_t) cursor, 0};
+            cursor += sizes[i];
+        }
+        zelda64_set_dma_table_entry(table, dma_size, i, entry);
+    }
+    allocator.free(sizes, allocator.userdata);
+    rom->data = data;
+    rom->size = size;
+    return ZELDA64_OK;
+}
+
+void synthetic_rom_free(synthetic_rom_t *rom) {
+    assert(rom != nullptr);
+    if (rom->data != nullptr) {
+        rom->allocator.free(rom->data, rom->allocator.userdata);
+    }
+    rom->data = nullptr;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zelda64/zelda64.h>
+
+// Offset of the DMA table in generated ROMs, the same as in Ocarina of Time 1.0.
+#define SYNTHETIC_ROM_DMA_OFFSET 0x7430
+
+/**
+ * A decompressed ROM made up of generated files behind a valid DMA table. The files are a deterministic mix of
+ * incompressible, text-like, run-heavy and back-reference-heavy data, so every stage of the Yaz0 encoder gets work.
+ */
+typedef struct synthetic_rom {
+    uint8_t *data;
+    size_t size;
+    uint32_t file_count;
+    zelda64_allocator_t allocator;
+} synthetic_rom_t;
+
+/**
+ * Generates a ROM. The same seed and file count always give the same ROM.
+ * @param rom The ROM to initialize.
+ * @param seed Seed of the generator.
+ * @param file_count The amount of entries in the DMA table, at least 4.
+ * @param allocator The allocator used for the ROM.
+ * @return ZELDA64_OK on success or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t synthetic_rom_generate(synthetic_rom_t *rom, uint64_t seed, uint32_t file_count,
+                                        zelda64_allocator_t allocator);
+
+/**
+ * Frees a generated ROM.
+ * @param rom The ROM to free.
+ */
+void synthetic_rom_free(synthetic_rom_t *rom);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zelda64/zelda64.h>
+
+/**
+ * A bump allocator over one fixed block of memory. Allocations are carved off the front of the block and released all
+ * at once by resetting the arena, which makes it a cheap scratch region to reuse for every file of a ROM.
+ */
+typedef struct zelda64_arena {
+    uint8_t *data;
+    size_t capacity;
+    size_t used;
+    zelda64_allocator_t backing;
+} zelda64_arena_t;
+
+/**
+ * Initializes an arena, allocating its block from another allocator.
+ * @param arena The arena to initialize.
+ * @param capacity The size of the block in bytes.
+ * @param backing The allocator the block is allocated from.
+ * @return ZELDA64_OK on success or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_arena_init(zelda64_arena_t *arena, size_t capacity, zelda64_allocator_t backing);
+
+/**
+ * Frees the block of an arena. Everything allocated from it becomes invalid.
+ * @param arena The arena to free.
+ */
+void zelda64_arena_free(zelda64_arena_t *arena);
+
+/**
+ * Releases all allocations of an arena at once, keeping its block.
+ * @param arena The arena to reset.
+ */
+static inline void zelda64_arena_reset(zelda64_arena_t *arena) {
+    arena->used = 0;
+}
+
+/**
+ * Takes uninitialized memory from an arena.
+ * @param arena The arena to allocate from.
+ * @param size The amount of bytes to allocate.
+ * @return Pointer to the memory, aligned for any type, or nullptr if the arena is full.
+ */
+void *zelda64_arena_push(zelda64_arena_t *arena, size_t size);
@@ -10,3 +10,14 @@
  * @return CRC-32 checksum represented as a 32-bit unsigned integer.
  */
 uint32_t zelda64_crc32_calculate_checksum(const uint8_t *data, size_t size);
+
+/**
+ * Continues a CRC-32 checksum with more data, so that data can be checksummed in pieces.
+ * @param crc The checksum of the data so far, 0 to start a new checksum.
+ * @param data The buffer holding the data.
+ * @param size The size of the buffer in bytes.
+ * @return CRC-32 checksum of the data so far followed by the buffer.
+ * @note Safe to call from multiple threads. Uses carry-less multiplication or the CRC instructions when the processor
+ * supports them.
+ */
+uint32_t zelda64_crc32_update(uint32_t crc, const uint8_t *data, size_t size);
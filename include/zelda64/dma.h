@@ -19,6 +19,33 @@ typedef struct zelda64_dma_info {
     uint32_t entries;
 } zelda64_dma_info_t;
 
+typedef enum zelda64_file_kind {
+    ZELDA64_FILE_EMPTY = 0,
+    ZELDA64_FILE_UNCOMPRESSED = 1,
+    ZELDA64_FILE_COMPRESSED = 2,
+} zelda64_file_kind_t;
+
+/**
+ * A DMA table decoded into one array per field. Besides the fields, the table keeps the indices of all files that
+ * take up space sorted by virtual and by physical address, so addresses can be resolved to files by binary search.
+ */
+typedef struct zelda64_dma_table {
+    uint32_t count;
+    uint32_t *v_start;
+    uint32_t *v_end;
+    uint32_t *p_start;
+    uint32_t *p_end;
+    // One zelda64_file_kind_t per entry.
+    uint8_t *kind;
+    // Indices of the files with a non-empty virtual range, sorted by v_start.
+    uint32_t *by_virtual;
+    uint32_t virtual_count;
+    // Indices of the files stored in the ROM, sorted by p_start.
+    uint32_t *by_physical;
+    uint32_t physical_count;
+    zelda64_allocator_t allocator;
+} zelda64_dma_table_t;
+
 typedef struct zelda64_find_dma_table_params {
     size_t rom_size;
     size_t block_size;
@@ -113,3 +140,87 @@ static inline size_t zelda64_get_file_size(zelda64_dma_entry_t entry) {
         return 0;
     }
 }
+
+/**
+ * Decodes a DMA table.
+ * @param table The table to initialize.
+ * @param dma_data Buffer containing the DMA table in ROM format.
+ * @param size Size of the DMA table buffer in bytes.
+ * @param allocator The allocator used for the arrays of the table.
+ * @return ZELDA64_OK on success or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_dma_table_decode(zelda64_dma_table_t *table, const uint8_t *dma_data, size_t size,
+                                          zelda64_allocator_t allocator);
+
+/**
+ * Frees the arrays of a decoded DMA table.
+ * @param table The table to free.
+ */
+void zelda64_dma_table_free(zelda64_dma_table_t *table);
+
+/**
+ * Writes a decoded DMA table back out in ROM format.
+ * @param table The table to encode.
+ * @param dma_data Buffer to write the DMA table to.
+ * @param size Size of the buffer in bytes, which must hold at least 16 bytes per entry.
+ */
+void zelda64_dma_table_encode(const zelda64_dma_table_t *table, uint8_t *dma_data, size_t size);
+
+/**
+ * Returns the position in by_virtual of the first file that ends after an address. Together with by_virtual this
+ * walks all files overlapping a range in address order.
+ * @param table The table to search.
+ * @param address The virtual address.
+ * @return The position in by_virtual, virtual_count if all files end at or before the address.
+ */
+uint32_t zelda64_dma_table_lower_bound_virtual(const zelda64_dma_table_t *table, uint32_t address);
+
+/**
+ * Finds the file holding a virtual address.
+ * @param table The table to search.
+ * @param address The virtual address.
+ * @param index Output parameter holding the index of the file. Only changed if the function returns true.
+ * @return true if a file holds the address, false if not.
+ */
+bool zelda64_dma_table_find_virtual(const zelda64_dma_table_t *table, uint32_t address, uint32_t *index);
+
+/**
+ * Finds the file stored at a physical address.
+ * @param table The table to search.
+ * @param address The physical address.
+ * @param index Output parameter holding the index of the file. Only changed if the function returns true.
+ * @return true if a file is stored at the address, false if not.
+ */
+bool zelda64_dma_table_find_physical(const zelda64_dma_table_t *table, uint32_t address, uint32_t *index);
+
+/**
+ * Retrieves an entry of a decoded DMA table.
+ * @param table The table to read from.
+ * @param index Index of the DMA entry in the table.
+ * @return The DMA entry.
+ */
+static inline zelda64_dma_entry_t zelda64_dma_table_entry(const zelda64_dma_table_t *table, uint32_t index) {
+    return (zelda64_dma_entry_t) {
+            table->v_start[index],
+            table->v_end[index],
+            table->p_start[index],
+            table->p_end[index],
+    };
+}
+
+/**
+ * Returns the amount of bytes a file of a decoded DMA table takes up in the ROM.
+ * @param table The table to read from.
+ * @param index Index of the DMA entry in the table.
+ * @return The size of the file in bytes.
+ */
+static inline size_t zelda64_dma_table_stored_size(const zelda64_dma_table_t *table, uint32_t index) {
+    switch (table->kind[index]) {
+        case ZELDA64_FILE_COMPRESSED:
+            return table->p_end[index] - table->p_start[index];
+        case ZELDA64_FILE_UNCOMPRESSED:
+            return table->v_end[index] - table->v_start[index];
+        default:
+            return 0;
+    }
+}
@@ -3,9 +3,14 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <zelda64/dma.h>
+#include <zelda64/zelda64.h>
+
 #define ZELDA64_ROM_IMAGE_NAME_LENGTH 20
 #define ZELDA64_GAME_ID_LENGTH 2
 #define ZELDA64_BOOTCODE_LENGTH 4032
+// The boot checksum covers the ROM up to this offset, starting right after the bootcode.
+#define ZELDA64_CHECKSUM_END 0x101000
 
 typedef struct zelda64_rom_header {
     uint32_t pi_settings;
@@ -35,10 +40,130 @@ uint32_t zelda64_calculate_rom_cic(const uint8_t *bootcode, size_t size);
 
 /**
  * Calculates the N64 ROM checksum.
- * @param data Buffer holding data to calculate checksum for.
- * @param size The size of the buffer.
+ * @param data Buffer holding data to calculate checksum for, starting at the ROM header.
+ * @param size The size of the buffer, which must be at least 0x101000 bytes.
  * @param cic The CIC used by this ROM.
  * @param crc1 Output parameter holding the first CRC-32 value.
  * @param crc2 Output parameter holding the second CRC-32 value.
  */
 void zelda64_calculate_rom_checksum(const uint8_t *data, size_t size, uint32_t cic, uint32_t *crc1, uint32_t *crc2);
+
+/**
+ * Checks the checksum in the header of a ROM against its contents. The CIC is derived from the bootcode.
+ * @param rom Buffer holding the ROM, starting at the ROM header.
+ * @param size The size of the buffer in bytes.
+ * @return ZELDA64_OK if the checksum matches, ZELDA64_ERROR_INVALID_DATA if it does not or the ROM is too small.
+ */
+zelda64_result_t zelda64_verify_rom_checksum(const uint8_t *rom, size_t size);
+
+/**
+ * A ROM held in memory. The handle borrows the buffer and caches everything that is parsed from it, all functions
+ * taking a handle work on the buffer directly without going through read callbacks or copying it.
+ */
+typedef struct zelda64_rom {
+    const uint8_t *data;
+    size_t size;
+    zelda64_rom_header_t header;
+    uint32_t cic;
+    zelda64_dma_info_t dma_info;
+    // Points into data.
+    const uint8_t *dma_table;
+} zelda64_rom_t;
+
+/**
+ * Opens a ROM held in memory, parsing its header and locating its DMA table.
+ * @param rom The handle to initialize.
+ * @param data Buffer holding the ROM, which must outlive the handle and may not change while it is in use.
+ * @param size The size of the buffer in bytes.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if the buffer does not hold a ROM with a DMA table.
+ */
+zelda64_result_t zelda64_rom_open(zelda64_rom_t *rom, const uint8_t *data, size_t size);
+
+/**
+ * Retrieves the DMA entry of a file.
+ * @param rom The ROM.
+ * @param index Index of the file in the DMA table.
+ * @param entry Output parameter holding the entry.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if there is no such file.
+ */
+zelda64_result_t zelda64_rom_get_file_entry(const zelda64_rom_t *rom, uint32_t index, zelda64_dma_entry_t *entry);
+
+/**
+ * Retrieves a file as it is stored in the ROM, which is Yaz0 compressed data for compressed files.
+ * @param rom The ROM.
+ * @param index Index of the file in the DMA table.
+ * @param data Output parameter pointing into the ROM buffer, nullptr for empty files.
+ * @param size Output parameter holding the size of the stored file in bytes.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if there is no such file or it lies outside the ROM.
+ */
+zelda64_result_t zelda64_rom_get_file_data(const zelda64_rom_t *rom, uint32_t index, const uint8_t **data,
+                                           size_t *size);
+
+/**
+ * Reads a file, decompressing it if needed.
+ * @param rom The ROM.
+ * @param index Index of the file in the DMA table.
+ * @param dest Buffer to write the file to.
+ * @param dest_size The size of the buffer, which must be at least the size of the file in virtual address space.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_BUFFER_TOO_SMALL if the file does not fit, or
+ * ZELDA64_ERROR_INVALID_DATA if the file is missing or corrupt.
+ */
+zelda64_result_t zelda64_rom_read_file(const zelda64_rom_t *rom, uint32_t index, uint8_t *dest, size_t dest_size);
+
+/**
+ * Calculates the checksum of the ROM using the CIC found when it was opened.
+ * @param rom The ROM.
+ * @param crc1 Output parameter holding the first CRC-32 value.
+ * @param crc2 Output parameter holding the second CRC-32 value.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if the ROM is too small to be checksummed.
+ */
+zelda64_result_t zelda64_rom_calculate_checksum(const zelda64_rom_t *rom, uint32_t *crc1, uint32_t *crc2);
+
+/**
+ * Checks the checksum in the header of the ROM against its contents.
+ * @param rom The ROM.
+ * @return ZELDA64_OK if the checksum matches, ZELDA64_ERROR_INVALID_DATA if it does not or the ROM is too small.
+ */
+zelda64_result_t zelda64_rom_verify_checksum(const zelda64_rom_t *rom);
+
+/**
+ * Returns the size of the ROM after decompression, which ends with the last file in virtual address space.
+ * @param rom The ROM.
+ * @return The size in bytes.
+ */
+size_t zelda64_rom_decompressed_size(const zelda64_rom_t *rom);
+
+/**
+ * Decompresses every file of the ROM into a buffer and writes a DMA table describing the decompressed ROM.
+ * @param rom The ROM.
+ * @param dest Buffer to write the decompressed ROM to, may not overlap the ROM.
+ * @param dest_size The size of the buffer, which must be at least zelda64_rom_decompressed_size().
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_BUFFER_TOO_SMALL if the ROM does not fit, or
+ * ZELDA64_ERROR_INVALID_DATA if a file is corrupt.
+ */
+zelda64_result_t zelda64_rom_decompress(const zelda64_rom_t *rom, uint8_t *dest, size_t dest_size);
+
+/**
+ * Returns the largest size zelda64_rom_compress() can write for this ROM.
+ * @param rom The ROM.
+ * @return The size in bytes.
+ */
+size_t zelda64_rom_compress_bound(const zelda64_rom_t *rom);
+
+/**
+ * Compresses every file of a decompressed ROM into a buffer, laid out back to back in DMA table order. Files that are
+ * already compressed are copied as they are, and the files up to and including the DMA table are always stored.
+ * @param rom The ROM.
+ * @param dest Buffer to write the compressed ROM to, may not overlap the ROM.
+ * @param dest_size The size of the buffer, which must be at least zelda64_rom_compress_bound().
+ * @param exclusion_list Indices of the files that are stored uncompressed, may be nullptr if exclusion_list_size is 0.
+ * @param exclusion_list_size The amount of indices in the exclusion list.
+ * @param level The Yaz0 compression level, from 0 to ZELDA64_YAZ0_MAX_LEVEL.
+ * @param allocator The allocator used for the match finder.
+ * @param out_size Output parameter holding the size of the compressed ROM in bytes.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_BUFFER_TOO_SMALL if the buffer is smaller than the bound, or an error
+ * code if a file could not be compressed.
+ */
+zelda64_result_t zelda64_rom_compress(const zelda64_rom_t *rom, uint8_t *dest, size_t dest_size,
+                                      const uint32_t *exclusion_list, size_t exclusion_list_size, int level,
+                                      zelda64_allocator_t allocator, size_t *out_size);
@@ -5,7 +5,13 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <zelda64/zelda64.h>
+
 #define ZELDA64_YAZ0_MAGIC "Yaz0"
+#define ZELDA64_YAZ0_GREEDY_LEVEL 9
+#define ZELDA64_YAZ0_LAZY_LEVEL 10
+#define ZELDA64_YAZ0_OPTIMAL_LEVEL 11
+#define ZELDA64_YAZ0_MAX_LEVEL ZELDA64_YAZ0_OPTIMAL_LEVEL
 
 typedef struct zelda64_yaz0_header {
     char magic[4];
@@ -19,6 +25,87 @@ typedef struct zelda64_yaz0_data_group {
     size_t length;
 } zelda64_yaz0_data_group_t;
 
+#define ZELDA64_YAZ0_WINDOW_SIZE 0x1000
+
+/**
+ * State of a resumable Yaz0 decoder. Compressed data can be fed in and decompressed data taken out in pieces of any
+ * size, the only memory it needs is a window over the last 4 KB of output that back-references can reach.
+ */
+typedef struct zelda64_yaz0_stream {
+    // The header is collected here until all 16 bytes have arrived.
+    uint8_t header[16];
+    size_t header_size;
+    uint32_t uncompressed_size;
+    // The amount of bytes decompressed so far, which also locates the end of the window.
+    size_t total_out;
+    // Control byte of the current group and the amount of chunks left in it.
+    uint8_t control;
+    uint8_t chunks_left;
+    // Bytes of a back-reference that was split across inputs.
+    uint8_t pending[3];
+    uint8_t pending_size;
+    // Back-reference that was split across outputs.
+    size_t match_distance;
+    size_t match_remaining;
+    uint8_t window[ZELDA64_YAZ0_WINDOW_SIZE];
+} zelda64_yaz0_stream_t;
+
+/**
+ * Index over the source buffer used to find back-references. Positions are added to hash chains keyed on their first
+ * three bytes as the compressor moves forward, so a search only visits earlier positions that can actually match.
+ */
+typedef struct zelda64_yaz0_match_finder {
+    const uint8_t *src;
+    size_t src_size;
+    // The first position to compress. The positions before it can only be matched against.
+    size_t start;
+    // The next position to be added to the chains.
+    size_t cursor;
+    // How far back a match may be, how many candidates to visit per search, and the length at which to stop looking.
+    int search_range;
+    int max_chain;
+    int nice_length;
+    // A search starting out from a match at least this long only visits a 32nd of max_chain candidates.
+    int good_length;
+    // Most recent position for every hash, and the previous position with the same hash for every window slot.
+    int32_t *head;
+    int32_t *prev;
+    // Parse planned up front for the lazy and optimal levels: the length of the chunk to emit at every position from
+    // the start on (1 for a literal) and the distance of the back-reference.
+    uint16_t *plan_length;
+    uint16_t *plan_distance;
+    // Path costs for the optimal parse, and the amount of positions the plan arrays can hold.
+    uint32_t *plan_cost;
+    size_t plan_capacity;
+    // Size in bytes of the groups a greedy parse produces and of the groups the planned parse produces.
+    size_t greedy_size;
+    size_t planned_size;
+    zelda64_allocator_t allocator;
+} zelda64_yaz0_match_finder_t;
+
+/**
+ * Compresses whole buffers at a fixed level. The match finder memory is kept from one buffer to the next, so a single
+ * compressor can be reused for many files without allocating for each of them.
+ */
+typedef struct zelda64_yaz0_compressor {
+    zelda64_yaz0_match_finder_t finder;
+    int level;
+} zelda64_yaz0_compressor_t;
+
+/**
+ * Builds one Yaz0 stream out of ranges of a buffer that were compressed separately. The chunks of every range are
+ * packed into the groups of the stream, so a range may start in the middle of a group.
+ */
+typedef struct zelda64_yaz0_joiner {
+    uint8_t *dest;
+    size_t dest_capacity;
+    // The size of the stream so far, including the Yaz0 header.
+    size_t dest_size;
+    // Position of the header byte of the last group, and the amount of chunks in it. 0 chunks means it is full.
+    size_t group_pos;
+    int group_chunks;
+} zelda64_yaz0_joiner_t;
+
 /**
  * Attempts to read a Yaz0 header from a buffer.
  * @param buf The buffer to read from.
@@ -36,14 +123,88 @@ static inline bool zelda64_is_valid_yaz0_header(zelda64_yaz0_header_t header) {
     return memcmp(header.magic, ZELDA64_YAZ0_MAGIC, sizeof(header.magic)) == 0;
 }
 
+/**
+ * Returns the largest amount of bytes compressing a buffer can produce, including the Yaz0 header.
+ * @param src_size The size of the uncompressed data in bytes.
+ * @return The worst case size of the compressed data in bytes.
+ */
+static inline size_t zelda64_yaz0_compress_bound(size_t src_size) {
+    return 16 + src_size + (src_size + 7) / 8;
+}
+
 /**
  * Decompresses Yaz0 data.
  * @param dest Output buffer to write the decompressed data to.
  * @param dest_size Output buffer size in bytes.
  * @param src The source buffer to read the compressed data from.
+ * @note The source buffer is trusted to be valid, use zelda64_yaz0_decompress_checked() for untrusted data.
  */
 void zelda64_yaz0_decompress(uint8_t *dest, size_t dest_size, const uint8_t *src);
 
+/**
+ * Decompresses Yaz0 data, making sure nothing is read or written outside of the buffers.
+ * @param dest Output buffer to write the decompressed data to.
+ * @param dest_size Output buffer size in bytes.
+ * @param src The source buffer to read the compressed data from, starting with the Yaz0 header.
+ * @param src_size The size of the source buffer in bytes.
+ * @return ZELDA64_OK if the function succeeds, ZELDA64_ERROR_INVALID_DATA if the data is truncated, refers to data
+ * before the start of the output, or would write past the end of the output buffer.
+ */
+zelda64_result_t zelda64_yaz0_decompress_checked(uint8_t *dest, size_t dest_size, const uint8_t *src,
+                                                 size_t src_size);
+
+/**
+ * Prepares a stream for decompressing a new piece of Yaz0 data.
+ * @param stream The stream to initialize.
+ */
+void zelda64_yaz0_stream_init(zelda64_yaz0_stream_t *stream);
+
+/**
+ * Decompresses as much as the input and output allow, and can be called again with more of either to continue.
+ * @param stream The stream to decompress with.
+ * @param src The next piece of compressed data, starting with the Yaz0 header on the first call.
+ * @param src_size The size of the compressed data in bytes.
+ * @param src_read Output parameter holding the amount of bytes consumed from src.
+ * @param dest Buffer to write decompressed data to.
+ * @param dest_size The size of the output buffer in bytes.
+ * @param dest_written Output parameter holding the amount of bytes written to dest.
+ * @return ZELDA64_OK on success, also when more input or room for output is needed, and ZELDA64_ERROR_INVALID_DATA if
+ * the header is not a Yaz0 header or the data refers to data before the start of the output or past its end.
+ */
+zelda64_result_t zelda64_yaz0_stream_decompress(zelda64_yaz0_stream_t *stream,
+                                                const uint8_t *src, size_t src_size, size_t *src_read,
+                                                uint8_t *dest, size_t dest_size, size_t *dest_written);
+
+/**
+ * Checks whether a stream has produced all of its decompressed data.
+ * @param stream The stream to check.
+ * @return true once the header has been read and as many bytes as it announced have been written out.
+ */
+static inline bool zelda64_yaz0_stream_finished(const zelda64_yaz0_stream_t *stream) {
+    return stream->header_size == 16 && stream->total_out == stream->uncompressed_size;
+}
+
+/**
+ * Initializes a match finder over a source buffer.
+ * @param finder The match finder to initialize.
+ * @param src The source buffer that will be compressed.
+ * @param src_size The size of the source buffer.
+ * @param level The level of compression to use, from 0 to ZELDA64_YAZ0_MAX_LEVEL. Levels 1 to 3 are fast, levels 4 to
+ * 8 trade more time for a better ratio, and level 9 greedily takes the longest match within the window. Level 10 defers
+ * a match by one byte when the next position has a longer one, level 11 finds the smallest parse of the whole buffer.
+ * Levels 10 and 11 plan their parse here, and record its size next to that of the greedy parse.
+ * @param allocator The allocator used for the hash chains.
+ * @return ZELDA64_OK on success, an error code if not.
+ */
+zelda64_result_t zelda64_yaz0_match_finder_init(zelda64_yaz0_match_finder_t *finder, const uint8_t *src,
+                                                size_t src_size, int level, zelda64_allocator_t allocator);
+
+/**
+ * Frees the memory held by a match finder.
+ * @param finder The match finder to free.
+ */
+void zelda64_yaz0_match_finder_free(zelda64_yaz0_match_finder_t *finder);
+
 /**
  * Compresses a portion of the buffer into a Yaz0 data group.
  * @param src The source buffer to read from.
@@ -55,3 +216,101 @@ void zelda64_yaz0_decompress(uint8_t *dest, size_t dest_size, const uint8_t *src
  */
 int zelda64_yaz0_compress_group(const uint8_t *src, size_t src_size, int src_pos, int level,
                                 zelda64_yaz0_data_group_t *out);
+
+/**
+ * Compresses a portion of the match finder's source buffer into a Yaz0 data group.
+ * @param finder The match finder to search with. Groups should be compressed front to back, going back to an earlier
+ * position makes the finder rebuild its chains.
+ * @param src_pos The position of the buffer to start reading at.
+ * @param out The output to write to.
+ * @return The position in the buffer after the last byte read.
+ */
+int zelda64_yaz0_compress_group_indexed(zelda64_yaz0_match_finder_t *finder, int src_pos,
+                                        zelda64_yaz0_data_group_t *out);
+
+/**
+ * Initializes a compressor. Memory is only allocated once the first buffer is compressed.
+ * @param compressor The compressor to initialize.
+ * @param level The level of compression to use, see zelda64_yaz0_match_finder_init().
+ * @param allocator The allocator used for the match finder.
+ * @return ZELDA64_OK on success, an error code if not.
+ */
+zelda64_result_t zelda64_yaz0_compressor_init(zelda64_yaz0_compressor_t *compressor, int level,
+                                              zelda64_allocator_t allocator);
+
+/**
+ * Frees the memory held by a compressor.
+ * @param compressor The compressor to free.
+ */
+void zelda64_yaz0_compressor_free(zelda64_yaz0_compressor_t *compressor);
+
+/**
+ * Compresses a buffer, writing the Yaz0 header followed by the data groups.
+ * @param compressor The compressor to use. After the call its finder holds the parse sizes for the lazy and optimal
+ * levels.
+ * @param dest Buffer to write the compressed data to. A buffer of zelda64_yaz0_compress_bound() bytes always fits.
+ * @param dest_capacity The size of the output buffer in bytes.
+ * @param src The data to compress.
+ * @param src_size The size of the data in bytes.
+ * @param dest_size Output parameter holding the size of the compressed data in bytes.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_BUFFER_TOO_SMALL if the compressed data does not fit, or
+ * ZELDA64_ERROR_OUT_OF_MEMORY if the match finder could not be allocated.
+ */
+zelda64_result_t zelda64_yaz0_compressor_compress(zelda64_yaz0_compressor_t *compressor,
+                                                  uint8_t *dest, size_t dest_capacity,
+                                                  const uint8_t *src, size_t src_size, size_t *dest_size);
+
+/**
+ * Compresses a range of a buffer into Yaz0 data groups without a header, to be joined with the other ranges of the
+ * buffer by a zelda64_yaz0_joiner_t. Back-references reach into the window before the range but never past its end,
+ * so ranges can be compressed on separate threads for nearly the ratio of compressing the whole buffer at once.
+ * @param compressor The compressor to use.
+ * @param dest Buffer to write the groups to. A buffer of zelda64_yaz0_compress_bound(end - start) bytes always fits.
+ * @param dest_capacity The size of the output buffer in bytes.
+ * @param src The whole buffer.
+ * @param start Position of the first byte of the range.
+ * @param end Position after the last byte of the range.
+ * @param dest_size Output parameter holding the size of the groups in bytes. The last group may have less than 8
+ * chunks.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_BUFFER_TOO_SMALL if the groups do not fit, or
+ * ZELDA64_ERROR_OUT_OF_MEMORY if the match finder could not be allocated.
+ */
+zelda64_result_t zelda64_yaz0_compressor_compress_range(zelda64_yaz0_compressor_t *compressor,
+                                                        uint8_t *dest, size_t dest_capacity,
+                                                        const uint8_t *src, size_t start, size_t end,
+                                                        size_t *dest_size);
+
+/**
+ * Starts a Yaz0 stream by writing its header.
+ * @param joiner The joiner to initialize.
+ * @param dest Buffer to write the stream to. A buffer of zelda64_yaz0_compress_bound() bytes of the whole buffer holds
+ * any ranges compressed with zelda64_yaz0_compressor_compress_range().
+ * @param dest_capacity The size of the output buffer in bytes.
+ * @param uncompressed_size The size of the whole buffer in bytes.
+ * @return ZELDA64_OK on success or ZELDA64_ERROR_BUFFER_TOO_SMALL.
+ */
+zelda64_result_t zelda64_yaz0_joiner_init(zelda64_yaz0_joiner_t *joiner, uint8_t *dest, size_t dest_capacity,
+                                          size_t uncompressed_size);
+
+/**
+ * Appends the groups of the next range to a Yaz0 stream. Ranges must be appended in order.
+ * @param joiner The joiner to append to.
+ * @param groups The groups written by zelda64_yaz0_compressor_compress_range().
+ * @param groups_size The size of the groups in bytes.
+ * @param uncompressed_size The size of the range in bytes.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_BUFFER_TOO_SMALL if the stream does not fit, or
+ * ZELDA64_ERROR_INVALID_DATA if the groups do not decode to exactly uncompressed_size bytes.
+ */
+zelda64_result_t zelda64_yaz0_joiner_append(zelda64_yaz0_joiner_t *joiner, const uint8_t *groups, size_t groups_size,
+                                            size_t uncompressed_size);
+
+/**
+ * Compresses a buffer in one call, using the default allocator.
+ * @param dest Buffer to write the compressed data to, including the Yaz0 header.
+ * @param dest_capacity The size of the output buffer in bytes.
+ * @param src The data to compress.
+ * @param src_size The size of the data in bytes.
+ * @param level The level of compression to use, see zelda64_yaz0_match_finder_init().
+ * @return The size of the compressed data in bytes, or 0 if it did not fit or memory ran out.
+ */
+size_t zelda64_yaz0_compress(uint8_t *dest, size_t dest_capacity, const uint8_t *src, size_t src_size, int level);
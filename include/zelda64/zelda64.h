@@ -7,6 +7,9 @@
 typedef enum zelda64_result {
     ZELDA64_OK = 0,
     ZELDA64_ERROR_INVALID_DATA = 1,
+    ZELDA64_ERROR_OUT_OF_MEMORY = 2,
+    ZELDA64_ERROR_BUFFER_TOO_SMALL = 3,
+    ZELDA64_ERROR_IO = 4,
 } zelda64_result_t;
 
 typedef void *(zelda64_alloc_func_t)(size_t count, size_t size, void *userdata);
@@ -43,3 +46,4 @@ static inline zelda64_allocator_t zelda64_default_allocator() {
 typedef void *(zelda64_read_data_func_t)(size_t size, size_t offset, void *userdata);
 typedef void (zelda64_close_data_func_t)(void *data, size_t size, void *userdata);
 typedef void (zelda64_write_data_func_t)(void *data, size_t size, size_t offset, void *userdata);
+typedef zelda64_result_t (zelda64_finish_func_t)(void *userdata);
@@ -0,0 +1,36 @@
+#include <assert.h>
+#include <stdalign.h>
+
+#include <zelda64/arena.h>
+
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+zelda64_result_t zelda64_arena_init(zelda64_arena_t *arena, size_t capacity, zelda64_allocator_t backing) {
+    assert(arena != nullptr);
+    *arena = (zelda64_arena_t) {
+            .capacity = capacity,
+            .backing = backing,
+    };
+    arena->data = backing.alloc(capacity > 0 ? capacity : 1, sizeof(uint8_t), backing.userdata);
+    return arena->data != nullptr ? ZELDA64_OK : ZELDA64_ERROR_OUT_OF_MEMORY;
+}
+
+void zelda64_arena_free(zelda64_arena_t *arena) {
+    assert(arena != nullptr);
+    if (arena->data != nullptr) {
+        arena->backing.free(arena->data, arena->backing.userdata);
+    }
+    arena->data = nullptr;
+    arena->capacity = 0;
+    arena->used = 0;
+}
+
+void *zelda64_arena_push(zelda64_arena_t *arena, size_t size) {
+    assert(arena != nullptr);
+    size_t offset = (arena->used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    if (offset > arena->capacity || size > arena->capacity - offset) {
+        return nullptr;
+    }
+    arena->used = offset + size;
+    return arena->data + offset;
+}
@@ -1,32 +1,162 @@
+#include <stdbool.h>
+#include <string.h>
+
 #include <zelda64/crc32.h>
 
-static uint32_t crc_table[256] = {0};
+#include "crc32_table.h"
 
-#define CRC32_POLY 0xEDB88320
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZELDA64_CRC32_PCLMUL
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__)) && (defined(__linux__) || defined(__APPLE__))
+#define ZELDA64_CRC32_ARMV8
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
 
-static inline void generate_crc32_table() {
-    for (int_fast32_t i = 0; i < sizeof crc_table; ++i) {
-        uint32_t crc = i;
-        for (int_fast32_t j = 8; j > 0; --j) {
-            if (crc & 1) {
-                crc = (crc >> 1) ^ CRC32_POLY;
-            } else {
-                crc >>= 1;
-            }
-        }
-        crc_table[i] = crc;
+// Kernels below take and return the CRC register, that is, the checksum before its final inversion.
+
+static inline uint32_t crc32_bytes(uint32_t crc, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        crc = (crc >> 8) ^ crc32_tables[0][(crc ^ data[i]) & 0xFF];
     }
+    return crc;
 }
 
-uint32_t zelda64_crc32_calculate_checksum(const uint8_t *data, size_t size) {
-    if (crc_table[0] == 0) {
-        generate_crc32_table();
+static uint32_t crc32_slice_by_8(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; data += 8, size -= 8) {
+        // The words are assembled byte by byte, which compilers turn into plain loads on little-endian machines.
+        uint32_t lo = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8 |
+                             (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+        uint32_t hi = (uint32_t) data[4] | (uint32_t) data[5] << 8 |
+                      (uint32_t) data[6] << 16 | (uint32_t) data[7] << 24;
+        crc = crc32_tables[7][lo & 0xFF] ^ crc32_tables[6][(lo >> 8) & 0xFF] ^
+              crc32_tables[5][(lo >> 16) & 0xFF] ^ crc32_tables[4][lo >> 24] ^
+              crc32_tables[3][hi & 0xFF] ^ crc32_tables[2][(hi >> 8) & 0xFF] ^
+              crc32_tables[1][(hi >> 16) & 0xFF] ^ crc32_tables[0][hi >> 24];
+    }
+    return crc32_bytes(crc, data, size);
+}
+
+#ifdef ZELDA64_CRC32_PCLMUL
+// Folds 64 bytes at a time with carry-less multiplication, following Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction". The constants are those for the bit-reflected polynomial.
+// Requires at least 64 bytes and processes a multiple of 16 bytes, returns the amount of bytes processed.
+__attribute__((target("pclmul,sse4.1")))
+static size_t crc32_pclmul(uint32_t *crc, const uint8_t *data, size_t size) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+    const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    size_t processed = 64;
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) *crc));
+    // Fold four lanes of 128 bits in parallel.
+    for (; size - processed >= 64; processed += 64) {
+        const uint8_t *block = data + processed;
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (block + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (block + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (block + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (block + 0x30)));
+    }
+    // Fold the four lanes into one.
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    // Fold the remaining blocks of 16 bytes.
+    for (; size - processed >= 16; processed += 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (data + processed)));
+    }
+    // Fold 128 bits into 64 bits.
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    // Barrett reduction to 32 bits.
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    *crc = (uint32_t) _mm_extract_epi32(x1, 1);
+    return processed;
+}
+
+static inline bool has_pclmul(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#ifdef ZELDA64_CRC32_ARMV8
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof word);
+        crc = __crc32d(crc, word);
+    }
+    for (; size > 0; ++data, --size) {
+        crc = __crc32b(crc, *data);
     }
-    uint32_t crc = 0xFFFFFFFF;
-    for (int_fast32_t i = 0; i < size; ++i) {
-        const uint8_t ch = data[i];
-        const uint8_t t = (crc ^ ch) & 0xFF;
-        crc = (crc >> 8) ^ crc_table[t];
+    return crc;
+}
+
+static inline bool has_armv8_crc(void) {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return true;
+#endif
+}
+#endif
+
+// Below this size the setup cost of the vector kernels outweighs what they save.
+#define CRC32_VECTOR_THRESHOLD 64
+
+uint32_t zelda64_crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+    crc = ~crc;
+    if (size >= CRC32_VECTOR_THRESHOLD) {
+#if defined(ZELDA64_CRC32_PCLMUL)
+        if (has_pclmul()) {
+            size_t processed = crc32_pclmul(&crc, data, size);
+            data += processed;
+            size -= processed;
+        }
+#elif defined(ZELDA64_CRC32_ARMV8)
+        if (has_armv8_crc()) {
+            return ~crc32_armv8(crc, data, size);
+        }
+#endif
     }
-    return ~crc;
+    return ~crc32_slice_by_8(crc, data, size);
+}
+
+uint32_t zelda64_crc32_calculate_checksum(const uint8_t *data, size_t size) {
+    return zelda64_crc32_update(0, data, size);
 }
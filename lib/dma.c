@@ -4,6 +4,14 @@
 #include <zelda64/dma.h>
 #include "util.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZELDA64_DMA_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZELDA64_DMA_NEON
+#include <arm_neon.h>
+#endif
+
 static inline zelda64_dma_entry_t read_entry_from_buf(const uint8_t *buf) {
     return (zelda64_dma_entry_t) {
             u32_from_buf(buf),
@@ -28,17 +36,61 @@ static const uint8_t needle[] = {
         0x00, 0x00, 0x10, 0x60, // v_start2
 };
 
+// The v_end of the first entry is the only non-zero word at the start of the needle and rare in a ROM, so the scan
+// looks for that word and only compares the whole needle where it turns up.
+#define NEEDLE_KEY_OFFSET 4
+
+// Compares the whole needle against the words from offset up to end, returns whether one of them matches.
+static bool scan_words(const uint8_t *buffer, size_t buffer_length, size_t offset, size_t end, uint64_t *out) {
+    for (; offset < end; offset += 4) {
+        if (offset + sizeof(needle) <= buffer_length && memcmp(buffer + offset, needle, sizeof(needle)) == 0) {
+            *out = offset;
+            return true;
+        }
+    }
+    return false;
+}
+
 int zelda64_find_dma_table_offset(const uint8_t *buffer, size_t buffer_length, uint64_t *out) {
     assert(buffer != NULL);
     assert(out != NULL);
-    for (size_t offset = 0; offset + sizeof(needle) < buffer_length; offset += 4) {
-        const uint8_t *cursor = buffer + offset;
-        if (memcmp(cursor, needle, sizeof(needle)) == 0) {
-            *out = offset;
+    if (buffer_length < sizeof(needle)) {
+        return -1;
+    }
+    size_t last = buffer_length - sizeof(needle);
+    size_t offset = 0;
+#if defined(ZELDA64_DMA_SSE2) || defined(ZELDA64_DMA_NEON)
+    uint32_t key_word;
+    memcpy(&key_word, needle + NEEDLE_KEY_OFFSET, sizeof(key_word));
+#ifdef ZELDA64_DMA_SSE2
+    const __m128i key = _mm_set1_epi32((int) key_word);
+#else
+    const uint32x4_t key = vdupq_n_u32(key_word);
+#endif
+    // Test 64 bytes at a time for the key word, every lane holds a candidate at an offset four bytes earlier.
+    for (; offset + NEEDLE_KEY_OFFSET + 64 <= buffer_length && offset <= last; offset += 64) {
+        const uint8_t *block = buffer + offset + NEEDLE_KEY_OFFSET;
+#ifdef ZELDA64_DMA_SSE2
+        __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (block + 0x00)), key),
+                             _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (block + 0x10)), key)),
+                _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (block + 0x20)), key),
+                             _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (block + 0x30)), key)));
+        bool found = _mm_movemask_epi8(hits) != 0;
+#else
+        uint32x4_t hits = vorrq_u32(
+                vorrq_u32(vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(block + 0x00)), key),
+                          vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(block + 0x10)), key)),
+                vorrq_u32(vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(block + 0x20)), key),
+                          vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(block + 0x30)), key)));
+        bool found = vmaxvq_u32(hits) != 0;
+#endif
+        if (found && scan_words(buffer, buffer_length, offset, offset + 64, out)) {
             return 0;
         }
     }
-    return -1;
+#endif
+    return scan_words(buffer, buffer_length, offset, last + 1, out) ? 0 : -1;
 }
 
 zelda64_dma_info_t zelda64_get_dma_table_information(const uint8_t *buffer, size_t buffer_size, size_t dma_offset) {
@@ -53,31 +105,34 @@ zelda64_dma_info_t zelda64_get_dma_table_information(const uint8_t *buffer, size
 }
 
 zelda64_result_t seek_dma_offset(zelda64_find_dma_table_params_t params, size_t *dma_offset) {
-    size_t bytes_remaining = params.rom_size;
+    // Consecutive blocks overlap by all but the last word of the needle, so a table starting near the end of one
+    // block is found in the next. Blocks stay word aligned, as the table always is.
+    const size_t overlap = sizeof(needle) - 4;
+    size_t block_size = params.block_size & ~(size_t) 3;
+    if (block_size <= overlap) {
+        block_size = (overlap + 4) * 2;
+    }
     size_t bytes_read = 0;
     uint64_t result = 0;
-    while (bytes_remaining > 0) {
+    while (params.rom_size - bytes_read >= sizeof(needle)) {
         // Read the next block of data from the ROM file.
-        size_t block_size = params.block_size;
-        if (block_size > bytes_remaining) {
-            block_size = bytes_remaining;
-        }
-        uint8_t *data = params.read_block(params.block_size, bytes_read, params.userdata);
+        size_t size = params.rom_size - bytes_read < block_size ? params.rom_size - bytes_read : block_size;
+        uint8_t *data = params.read_block(size, bytes_read, params.userdata);
         if (data == nullptr) {
             return ZELDA64_ERROR_INVALID_DATA;
         }
-        if (!zelda64_find_dma_table_offset(data, block_size, &result)) {
+        bool found = !zelda64_find_dma_table_offset(data, size, &result);
+        if (params.close_block != nullptr) {
+            params.close_block(data, size, params.userdata);
+        }
+        if (found) {
             *dma_offset = bytes_read + result;
-            if (params.close_block != nullptr) {
-                params.close_block(data, block_size, params.userdata);
-            }
             return ZELDA64_OK;
         }
-        bytes_remaining -= block_size;
-        bytes_read += block_size;
-        if (params.close_block != nullptr) {
-            params.close_block(data, block_size, params.userdata);
+        if (size < block_size) {
+            break;
         }
+        bytes_read += block_size - overlap;
     }
     return ZELDA64_ERROR_INVALID_DATA;
 }
@@ -89,6 +144,9 @@ zelda64_result_t zelda64_find_dma_table(zelda64_find_dma_table_params_t params,
     }
     // Read first 3 entries from the DMA table.
     uint8_t *data = params.read_block(48, dma_offset, params.userdata);
+    if (data == nullptr) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
     *out = zelda64_get_dma_table_information(data, 48, 0);
     if (params.close_block != nullptr) {
         params.close_block(data, 48, params.userdata);
@@ -110,3 +168,125 @@ int zelda64_set_dma_table_entry(uint8_t *dma_data, size_t size, uint32_t index,
     return 0;
 }
 
+
+// Tables come out of ROMs close to sorted, so insertion sort does little more than one pass.
+static void sort_indices(uint32_t *indices, uint32_t count, const uint32_t *keys) {
+    for (uint32_t i = 1; i < count; ++i) {
+        uint32_t index = indices[i];
+        uint32_t j = i;
+        for (; j > 0 && keys[indices[j - 1]] > keys[index]; --j) {
+            indices[j] = indices[j - 1];
+        }
+        indices[j] = index;
+    }
+}
+
+zelda64_result_t zelda64_dma_table_decode(zelda64_dma_table_t *table, const uint8_t *dma_data, size_t size,
+                                          zelda64_allocator_t allocator) {
+    assert(table != nullptr);
+    assert(dma_data != nullptr);
+    uint32_t count = (uint32_t) (size / 16);
+    // All arrays share one allocation, the byte sized kinds go last to keep the others aligned.
+    uint32_t *fields = allocator.alloc((size_t) count * 6 * sizeof(uint32_t) + count + 1, sizeof(uint8_t),
+                                       allocator.userdata);
+    if (fields == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    *table = (zelda64_dma_table_t) {
+            .count = count,
+            .v_start = fields,
+            .v_end = fields + count,
+            .p_start = fields + count * 2,
+            .p_end = fields + count * 3,
+            .by_virtual = fields + count * 4,
+            .by_physical = fields + count * 5,
+            .kind = (uint8_t *) (fields + count * 6),
+            .allocator = allocator,
+    };
+    for (uint32_t i = 0; i < count; ++i) {
+        const zelda64_dma_entry_t entry = read_entry_from_buf(dma_data + i * 16);
+        table->v_start[i] = entry.v_start;
+        table->v_end[i] = entry.v_end;
+        table->p_start[i] = entry.p_start;
+        table->p_end[i] = entry.p_end;
+        if (zelda64_is_empty_file(entry)) {
+            table->kind[i] = ZELDA64_FILE_EMPTY;
+            continue;
+        }
+        table->kind[i] = zelda64_is_uncompressed_file(entry) ? ZELDA64_FILE_UNCOMPRESSED : ZELDA64_FILE_COMPRESSED;
+        if (entry.v_start < entry.v_end) {
+            table->by_virtual[table->virtual_count++] = i;
+        }
+        if (zelda64_dma_table_stored_size(table, i) > 0) {
+            table->by_physical[table->physical_count++] = i;
+        }
+    }
+    sort_indices(table->by_virtual, table->virtual_count, table->v_start);
+    sort_indices(table->by_physical, table->physical_count, table->p_start);
+    return ZELDA64_OK;
+}
+
+void zelda64_dma_table_free(zelda64_dma_table_t *table) {
+    assert(table != nullptr);
+    if (table->v_start != nullptr) {
+        table->allocator.free(table->v_start, table->allocator.userdata);
+    }
+    *table = (zelda64_dma_table_t) {};
+}
+
+void zelda64_dma_table_encode(const zelda64_dma_table_t *table, uint8_t *dma_data, size_t size) {
+    assert(table != nullptr);
+    assert(dma_data != nullptr);
+    assert((size_t) table->count * 16 <= size);
+    for (uint32_t i = 0; i < table->count; ++i) {
+        write_entry_to_buf(dma_data + i * 16, zelda64_dma_table_entry(table, i));
+    }
+}
+
+uint32_t zelda64_dma_table_lower_bound_virtual(const zelda64_dma_table_t *table, uint32_t address) {
+    assert(table != nullptr);
+    uint32_t low = 0;
+    uint32_t high = table->virtual_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (table->v_end[table->by_virtual[middle]] <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool zelda64_dma_table_find_virtual(const zelda64_dma_table_t *table, uint32_t address, uint32_t *index) {
+    uint32_t position = zelda64_dma_table_lower_bound_virtual(table, address);
+    if (position == table->virtual_count || table->v_start[table->by_virtual[position]] > address) {
+        return false;
+    }
+    *index = table->by_virtual[position];
+    return true;
+}
+
+bool zelda64_dma_table_find_physical(const zelda64_dma_table_t *table, uint32_t address, uint32_t *index) {
+    assert(table != nullptr);
+    // Find the last file starting at or before the address.
+    uint32_t low = 0;
+    uint32_t high = table->physical_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (table->p_start[table->by_physical[middle]] <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return false;
+    }
+    uint32_t candidate = table->by_physical[low - 1];
+    if (address - table->p_start[candidate] >= zelda64_dma_table_stored_size(table, candidate)) {
+        return false;
+    }
+    *index = candidate;
+    return true;
+}
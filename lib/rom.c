@@ -1,8 +1,10 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <zelda64/rom.h>
 #include <zelda64/crc32.h>
+#include <zelda64/yaz0.h>
 #include "util.h"
 
 #define CRC32_6101_BOOTCODE 0x6170A4A1
@@ -11,20 +13,80 @@
 #define CRC32_6105_BOOTCODE 0x98BC2C86
 #define CRC32_6106_BOOTCODE 0xACC8580A
 
-static inline uint32_t get_checksum_seed(uint32_t cic) {
-    switch (cic) {
-        case 6101:
-        case 6102:
-            return 0xF8CA4DDC;
-        case 6103:
-            return 0xA3886759;
-        case 6105:
-            return 0xDF26F436;
-        case 6106:
-            return 0x1FEA617A;
-        default:
-            return 0;
+// The checksum covers the first megabyte after the bootcode.
+#define CHECKSUM_START 0x1000
+#define CHECKSUM_END ZELDA64_CHECKSUM_END
+// The 6105 mixes a 256 byte table from its bootcode into the checksum.
+#define CHECKSUM_6105_TABLE 0x0750
+#define CHECKSUM_6105_TABLE_WORDS 64
+
+typedef enum checksum_finalizer {
+    CHECKSUM_FINALIZER_XOR = 0,
+    CHECKSUM_FINALIZER_ADD = 1,
+    CHECKSUM_FINALIZER_MULTIPLY = 2,
+} checksum_finalizer_t;
+
+typedef struct checksum_variant {
+    uint32_t cic;
+    uint32_t seed;
+    bool mixes_bootcode;
+    checksum_finalizer_t finalizer;
+} checksum_variant_t;
+
+static const checksum_variant_t checksum_variants[] = {
+        {6101, 0xF8CA4DDC, false, CHECKSUM_FINALIZER_XOR},
+        {6102, 0xF8CA4DDC, false, CHECKSUM_FINALIZER_XOR},
+        {6103, 0xA3886759, false, CHECKSUM_FINALIZER_ADD},
+        {6105, 0xDF26F436, true,  CHECKSUM_FINALIZER_XOR},
+        {6106, 0x1FEA617A, false, CHECKSUM_FINALIZER_MULTIPLY},
+};
+
+// Unknown chips are checksummed like a 6102 with a seed of 0.
+static const checksum_variant_t unknown_checksum_variant = {0, 0, false, CHECKSUM_FINALIZER_XOR};
+
+static const checksum_variant_t *get_checksum_variant(uint32_t cic) {
+    for (size_t i = 0; i < sizeof checksum_variants / sizeof checksum_variants[0]; ++i) {
+        if (checksum_variants[i].cic == cic) {
+            return &checksum_variants[i];
+        }
     }
+    return &unknown_checksum_variant;
+}
+
+typedef struct checksum_state {
+    uint32_t t1, t2, t3, t4, t5, t6;
+} checksum_state_t;
+
+// Runs the checksum over a range of words. The bootcode table is only used by the 6105, every other chip passes
+// nullptr. Both kernels below inline this with a constant table, so the check is resolved at compile time.
+static inline void checksum_words(checksum_state_t *restrict state, const uint8_t *restrict data, size_t size,
+                                  const uint32_t *restrict table) {
+    uint32_t t1 = state->t1, t2 = state->t2, t3 = state->t3, t4 = state->t4, t5 = state->t5, t6 = state->t6;
+    for (size_t i = 0; i < size; i += 4) {
+        uint32_t d = u32_from_buf(data + i);
+        if ((t6 + d) < t6) t4++;
+        t6 += d;
+        t3 ^= d;
+        uint32_t r = (d << (d & 0x1F)) | (d >> ((32 - (d & 0x1F)) & 0x1F));
+        t5 += r;
+        if (t2 > d) t2 ^= r;
+        else t2 ^= t6 ^ d;
+        if (table != nullptr) {
+            // The table is indexed by the low byte of the ROM offset, which lines up with i as data starts at 0x1000.
+            t1 += table[(i >> 2) & (CHECKSUM_6105_TABLE_WORDS - 1)] ^ d;
+        } else {
+            t1 += t5 ^ d;
+        }
+    }
+    *state = (checksum_state_t) {t1, t2, t3, t4, t5, t6};
+}
+
+static void checksum_kernel_standard(checksum_state_t *state, const uint8_t *data, size_t size) {
+    checksum_words(state, data, size, nullptr);
+}
+
+static void checksum_kernel_6105(checksum_state_t *state, const uint8_t *data, size_t size, const uint32_t *table) {
+    checksum_words(state, data, size, table);
 }
 
 void zelda64_read_rom_header_from_buffer(zelda64_rom_header_t *destination, const uint8_t *const buffer,
@@ -55,7 +117,7 @@ uint32_t zelda64_calculate_rom_cic(const uint8_t *bootcode, size_t size) {
         case CRC32_6101_BOOTCODE:
             return 6101;
         case CRC32_6102_BOOTCODE:
-            return 6012;
+            return 6102;
         case CRC32_6103_BOOTCODE:
             return 6103;
         case CRC32_6105_BOOTCODE:
@@ -69,35 +131,307 @@ uint32_t zelda64_calculate_rom_cic(const uint8_t *bootcode, size_t size) {
 
 void zelda64_calculate_rom_checksum(const uint8_t *data, size_t size, uint32_t cic,
                                     uint32_t *restrict crc1, uint32_t *restrict crc2) {
-    assert(size >= 0x101000);
-    uint32_t seed = get_checksum_seed(cic);
-    uint32_t t1 = seed, t2 = seed, t3 = seed, t4 = seed, t5 = seed, t6 = seed;
-    for (int_fast32_t i = 0x1000; i < 0x101000; i += 4) {
-        uint32_t d = u32_from_buf(data + i);
-        if ((t6 + d) < t6) t4++;
-        t6 += d;
-        t3 ^= d;
-        uint32_t r = (d << (d & 0x1F)) | (d >> (32 - (d & 0x1F)));
-        t5 += r;
-        if (t2 > d) t2 ^= r;
-        else t2 ^= t6 ^ d;
-        if (cic == 6105) {
-            uint32_t p = 0x0750 + (i & 0xFF);
-            uint32_t b = u32_from_buf(data + p);
-            t1 += b ^ d;
+    assert(data != nullptr);
+    assert(size >= CHECKSUM_END);
+    // Everything that depends on the chip is decided once, up front.
+    const checksum_variant_t *variant = get_checksum_variant(cic);
+    uint32_t seed = variant->seed;
+    checksum_state_t state = {seed, seed, seed, seed, seed, seed};
+    if (variant->mixes_bootcode) {
+        uint32_t table[CHECKSUM_6105_TABLE_WORDS];
+        for (size_t i = 0; i < CHECKSUM_6105_TABLE_WORDS; ++i) {
+            table[i] = u32_from_buf(data + CHECKSUM_6105_TABLE + i * 4);
+        }
+        checksum_kernel_6105(&state, data + CHECKSUM_START, CHECKSUM_END - CHECKSUM_START, table);
+    } else {
+        checksum_kernel_standard(&state, data + CHECKSUM_START, CHECKSUM_END - CHECKSUM_START);
+    }
+    switch (variant->finalizer) {
+        case CHECKSUM_FINALIZER_ADD:
+            *crc1 = (state.t6 ^ state.t4) + state.t3;
+            *crc2 = (state.t5 ^ state.t2) + state.t1;
+            break;
+        case CHECKSUM_FINALIZER_MULTIPLY:
+            *crc1 = (state.t6 * state.t4) + state.t3;
+            *crc2 = (state.t5 * state.t2) + state.t1;
+            break;
+        default:
+            *crc1 = state.t6 ^ state.t4 ^ state.t3;
+            *crc2 = state.t5 ^ state.t2 ^ state.t1;
+            break;
+    }
+}
+
+zelda64_result_t zelda64_verify_rom_checksum(const uint8_t *rom, size_t size) {
+    assert(rom != nullptr);
+    if (size < CHECKSUM_END) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    uint32_t cic = zelda64_calculate_rom_cic(rom + 64, ZELDA64_BOOTCODE_LENGTH);
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    zelda64_calculate_rom_checksum(rom, size, cic, &crc1, &crc2);
+    if (crc1 != u32_from_buf(rom + 16) || crc2 != u32_from_buf(rom + 20)) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_rom_open(zelda64_rom_t *rom, const uint8_t *data, size_t size) {
+    assert(rom != nullptr);
+    assert(data != nullptr);
+    *rom = (zelda64_rom_t) {
+            .data = data,
+            .size = size,
+    };
+    zelda64_read_rom_header_from_buffer(&rom->header, data, size);
+    if (size >= 64 + ZELDA64_BOOTCODE_LENGTH) {
+        rom->cic = zelda64_calculate_rom_cic(data + 64, ZELDA64_BOOTCODE_LENGTH);
+    }
+    uint64_t dma_offset = 0;
+    if (zelda64_find_dma_table_offset(data, size, &dma_offset) != 0 || dma_offset + 48 > size) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    zelda64_dma_info_t dma_info = zelda64_get_dma_table_information(data, size, dma_offset);
+    if (dma_info.entries == 0 || dma_info.offset > size || dma_info.size > size - dma_info.offset) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    rom->dma_info = dma_info;
+    rom->dma_table = data + dma_info.offset;
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_rom_get_file_entry(const zelda64_rom_t *rom, uint32_t index, zelda64_dma_entry_t *entry) {
+    assert(rom != nullptr);
+    assert(entry != nullptr);
+    if (index >= rom->dma_info.entries) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    *entry = zelda64_get_dma_table_entry(rom->dma_table, rom->dma_info.size, index);
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_rom_get_file_data(const zelda64_rom_t *rom, uint32_t index, const uint8_t **data,
+                                           size_t *size) {
+    assert(data != nullptr);
+    assert(size != nullptr);
+    zelda64_dma_entry_t entry;
+    if (zelda64_rom_get_file_entry(rom, index, &entry) != ZELDA64_OK) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    size_t file_size = zelda64_get_file_size(entry);
+    if (file_size == 0) {
+        *data = nullptr;
+        *size = 0;
+        return ZELDA64_OK;
+    }
+    // The padding of the last compressed file may run past the end of the ROM.
+    if (entry.p_start >= rom->size) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    if (file_size > rom->size - entry.p_start) {
+        if (!zelda64_is_compressed_file(entry)) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        file_size = rom->size - entry.p_start;
+    }
+    *data = rom->data + entry.p_start;
+    *size = file_size;
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_rom_read_file(const zelda64_rom_t *rom, uint32_t index, uint8_t *dest, size_t dest_size) {
+    assert(dest != nullptr || dest_size == 0);
+    zelda64_dma_entry_t entry;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    if (zelda64_rom_get_file_entry(rom, index, &entry) != ZELDA64_OK ||
+        zelda64_rom_get_file_data(rom, index, &data, &size) != ZELDA64_OK) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    if (zelda64_is_empty_file(entry)) {
+        return ZELDA64_OK;
+    }
+    if (entry.v_end < entry.v_start) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    if (dest_size < entry.v_end - entry.v_start) {
+        return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+    }
+    if (zelda64_is_uncompressed_file(entry)) {
+        memcpy(dest, data, size);
+        return ZELDA64_OK;
+    }
+    if (size < 16) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    zelda64_yaz0_header_t header = zelda64_get_yaz0_header(data, size);
+    if (!zelda64_is_valid_yaz0_header(header) ||
+        header.uncompressed_size > entry.v_end - entry.v_start) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    return zelda64_yaz0_decompress_checked(dest, header.uncompressed_size, data, size);
+}
+
+zelda64_result_t zelda64_rom_calculate_checksum(const zelda64_rom_t *rom, uint32_t *crc1, uint32_t *crc2) {
+    assert(rom != nullptr);
+    if (rom->size < CHECKSUM_END) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    zelda64_calculate_rom_checksum(rom->data, rom->size, rom->cic, crc1, crc2);
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_rom_verify_checksum(const zelda64_rom_t *rom) {
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    if (zelda64_rom_calculate_checksum(rom, &crc1, &crc2) != ZELDA64_OK ||
+        crc1 != rom->header.crc1_checksum || crc2 != rom->header.crc2_checksum) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    return ZELDA64_OK;
+}
+
+size_t zelda64_rom_decompressed_size(const zelda64_rom_t *rom) {
+    assert(rom != nullptr);
+    size_t size = rom->dma_info.offset + rom->dma_info.size;
+    for (uint32_t i = 0; i < rom->dma_info.entries; ++i) {
+        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(rom->dma_table, rom->dma_info.size, i);
+        if (!zelda64_is_empty_file(entry) && entry.v_end > size) {
+            size = entry.v_end;
+        }
+    }
+    return size;
+}
+
+zelda64_result_t zelda64_rom_decompress(const zelda64_rom_t *rom, uint8_t *dest, size_t dest_size) {
+    assert(rom != nullptr);
+    assert(dest != nullptr);
+    size_t size = zelda64_rom_decompressed_size(rom);
+    if (dest_size < size) {
+        return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+    }
+    // Anything not covered by a file is zero, like the holes in a decompressed ROM file.
+    memset(dest, 0, size);
+    uint8_t *dma_out = dest + rom->dma_info.offset;
+    for (uint32_t i = 0; i < rom->dma_info.entries; ++i) {
+        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(rom->dma_table, rom->dma_info.size, i);
+        if (zelda64_is_empty_file(entry)) {
+            continue;
+        }
+        if (entry.v_start > size) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        zelda64_result_t result = zelda64_rom_read_file(rom, i, dest + entry.v_start, size - entry.v_start);
+        if (result != ZELDA64_OK) {
+            return result;
+        }
+    }
+    // The table is written last, the file holding it was copied over it above.
+    for (uint32_t i = 0; i < rom->dma_info.entries; ++i) {
+        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(rom->dma_table, rom->dma_info.size, i);
+        if (!zelda64_is_empty_file(entry)) {
+            entry.p_start = entry.v_start;
+            entry.p_end = 0;
+        }
+        zelda64_set_dma_table_entry(dma_out, rom->dma_info.size, i, entry);
+    }
+    return ZELDA64_OK;
+}
+
+static bool is_excluded(const uint32_t *exclusion_list, size_t exclusion_list_size, uint32_t index) {
+    for (size_t i = 0; i < exclusion_list_size; ++i) {
+        if (exclusion_list[i] == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t zelda64_rom_compress_bound(const zelda64_rom_t *rom) {
+    assert(rom != nullptr);
+    size_t size = 0;
+    for (uint32_t i = 0; i < rom->dma_info.entries; ++i) {
+        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(rom->dma_table, rom->dma_info.size, i);
+        if (entry.v_start == entry.v_end || zelda64_is_empty_file(entry)) {
+            continue;
+        }
+        if (zelda64_is_compressed_file(entry)) {
+            size += zelda64_get_file_size(entry);
         } else {
-            t1 += t5 ^ d;
+            size += (zelda64_yaz0_compress_bound(zelda64_get_file_size(entry)) + 31) & -16;
+        }
+    }
+    size_t dma_end = rom->dma_info.offset + rom->dma_info.size;
+    return size > dma_end ? size : dma_end;
+}
+
+zelda64_result_t zelda64_rom_compress(const zelda64_rom_t *rom, uint8_t *dest, size_t dest_size,
+                                      const uint32_t *exclusion_list, size_t exclusion_list_size, int level,
+                                      zelda64_allocator_t allocator, size_t *out_size) {
+    assert(rom != nullptr);
+    assert(dest != nullptr);
+    assert(out_size != nullptr);
+    size_t dma_end = rom->dma_info.offset + rom->dma_info.size;
+    if (dest_size < zelda64_rom_compress_bound(rom)) {
+        return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+    }
+    // The table can only be written once every file is in place, as the file holding it is copied over it.
+    uint8_t *dma_out = allocator.alloc(rom->dma_info.size, sizeof(uint8_t), allocator.userdata);
+    if (dma_out == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(dma_out, rom->dma_table, rom->dma_info.size);
+    // One compressor is reused for every file, so its match finder is only allocated once.
+    zelda64_yaz0_compressor_t compressor;
+    zelda64_result_t result = zelda64_yaz0_compressor_init(&compressor, level, allocator);
+    // Files are laid out back to back in table order. Unlike zelda64_compress_rom() there is no minimum gain, every
+    // file that is not excluded is compressed.
+    size_t cursor = 0;
+    size_t end = 0;
+    for (uint32_t i = 0; i < rom->dma_info.entries && result == ZELDA64_OK; ++i) {
+        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(rom->dma_table, rom->dma_info.size, i);
+        if (entry.v_start == entry.v_end || zelda64_is_empty_file(entry)) {
+            continue;
+        }
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        if (zelda64_rom_get_file_data(rom, i, &data, &size) != ZELDA64_OK) {
+            result = ZELDA64_ERROR_INVALID_DATA;
+            break;
         }
-        // calculate the CRC
-        if (cic == 6103) {
-            *crc1 = (t6 ^ t4) + t3;
-            *crc2 = (t5 ^ t2) + t1;
-        } else if (cic == 6106) {
-            *crc1 = (t6 * t4) + t3;
-            *crc2 = (t5 * t2) + t1;
+        size_t written = size;
+        size_t stored = size;
+        if (zelda64_is_compressed_file(entry)) {
+            memcpy(dest + cursor, data, size);
+            stored = zelda64_get_file_size(entry);
+            memset(dest + cursor + size, 0, stored - size);
+            entry.p_end = cursor + stored;
+        } else if (entry.v_start < dma_end || is_excluded(exclusion_list, exclusion_list_size, i)) {
+            // The files up to and including the DMA table keep their place, since the table is written back to its
+            // own offset.
+            memcpy(dest + cursor, data, size);
         } else {
-            *crc1 = t6 ^ t4 ^ t3;
-            *crc2 = t5 ^ t2 ^ t1;
+            result = zelda64_yaz0_compressor_compress(&compressor, dest + cursor, dest_size - cursor, data, size,
+                                                      &written);
+            if (result != ZELDA64_OK) {
+                break;
+            }
+            // File sizes must be aligned.
+            stored = (written + 31) & -16;
+            memset(dest + cursor + written, 0, stored - written);
+            entry.p_end = cursor + stored;
         }
+        entry.p_start = cursor;
+        end = cursor + written;
+        cursor += stored;
+        zelda64_set_dma_table_entry(dma_out, rom->dma_info.size, i, entry);
+    }
+    if (result == ZELDA64_OK) {
+        memcpy(dest + rom->dma_info.offset, dma_out, rom->dma_info.size);
+        *out_size = end > dma_end ? end : dma_end;
     }
+    zelda64_yaz0_compressor_free(&compressor);
+    allocator.free(dma_out, allocator.userdata);
+    return result;
 }
@@ -17,44 +17,272 @@ zelda64_yaz0_header_t zelda64_get_yaz0_header(const uint8_t *buf, size_t size) {
     return header;
 }
 
-void zelda64_yaz0_decompress(uint8_t *dest, size_t dest_size, const uint8_t *src) {
-    uint64_t src_index = 16; // skip header
-    uint64_t dest_index = 0;
-    uint8_t count = 0;
-    uint8_t cb;
+// The most a single group can read from the source and write to the destination.
+#define YAZ0_GROUP_MAX_SRC (1 + 8 * 3)
+#define YAZ0_GROUP_MAX_DEST (8 * YAZ0_MAX_LENGTH)
+// Back-references are copied in chunks of this size, and may write up to a chunk past their end.
+#define YAZ0_COPY_CHUNK 16
+
+// Copies a back-reference with room for overshooting the end by up to YAZ0_COPY_CHUNK - 1 bytes.
+static inline void copy_match_wide(uint8_t *out, size_t distance, size_t length) {
+    const uint8_t *from = out - distance;
+    if (distance == 1) {
+        memset(out, *from, length);
+    } else if (distance >= YAZ0_COPY_CHUNK) {
+        // The chunks never overlap, and each one only reads bytes that were already written.
+        for (size_t i = 0; i < length; i += YAZ0_COPY_CHUNK) {
+            memcpy(out + i, from + i, YAZ0_COPY_CHUNK);
+        }
+    } else if (distance >= 8) {
+        for (size_t i = 0; i < length; i += 8) {
+            memcpy(out + i, from + i, 8);
+        }
+    } else {
+        for (size_t i = 0; i < length; ++i) {
+            out[i] = from[i];
+        }
+    }
+}
+
+zelda64_result_t zelda64_yaz0_decompress_checked(uint8_t *restrict dest, size_t dest_size,
+                                                 const uint8_t *restrict src, size_t src_size) {
+    assert(dest != nullptr || dest_size == 0);
+    assert(src != nullptr);
+    if (src_size < 16) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    size_t src_index = 16; // skip header
+    size_t dest_index = 0;
     while (dest_index < dest_size) {
-        if (count == 0) {
-            cb = src[src_index++];
-            count = 8;
+        // Away from the end of either buffer a whole group fits, so only the distances need checking.
+        if (src_size - src_index >= YAZ0_GROUP_MAX_SRC &&
+            dest_size - dest_index >= YAZ0_GROUP_MAX_DEST + YAZ0_COPY_CHUNK) {
+            uint8_t cb = src[src_index++];
+            if (cb == 0xFF) {
+                // A group of nothing but literals, common in data that hardly compresses.
+                memcpy(dest + dest_index, src + src_index, 8);
+                dest_index += 8;
+                src_index += 8;
+                continue;
+            }
+            for (int i = 0; i < 8; ++i, cb <<= 1) {
+                if (cb & 0x80) {
+                    dest[dest_index++] = src[src_index++];
+                    continue;
+                }
+                uint8_t b1 = src[src_index++];
+                uint8_t b2 = src[src_index++];
+                size_t distance = (((b1 & 0xF) << 8) | b2) + 1;
+                size_t bytes = (b1 >> 4) ? (b1 >> 4) + 2 : src[src_index++] + 0x12;
+                if (distance > dest_index) {
+                    return ZELDA64_ERROR_INVALID_DATA;
+                }
+                copy_match_wide(dest + dest_index, distance, bytes);
+                dest_index += bytes;
+            }
+            continue;
         }
-        // Check the 7th bit, if it's a 1 we can just copy a byte. :-)
-        if (cb & 0x80) {
-            dest[dest_index++] = src[src_index++];
-        } else {
+        // Near the end every chunk is checked on its own.
+        if (src_index >= src_size) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        uint8_t cb = src[src_index++];
+        for (int i = 0; i < 8 && dest_index < dest_size; ++i, cb <<= 1) {
+            if (cb & 0x80) {
+                if (src_index >= src_size) {
+                    return ZELDA64_ERROR_INVALID_DATA;
+                }
+                dest[dest_index++] = src[src_index++];
+                continue;
+            }
+            if (src_size - src_index < 2) {
+                return ZELDA64_ERROR_INVALID_DATA;
+            }
             uint8_t b1 = src[src_index++];
             uint8_t b2 = src[src_index++];
-            uint32_t distance = (((b1 & 0xF) << 8) | b2) + 1;
-            uint32_t cursor = dest_index - distance;
-            uint32_t bytes = b1 >> 4;
+            size_t distance = (((b1 & 0xF) << 8) | b2) + 1;
+            size_t bytes = b1 >> 4;
             if (bytes == 0) {
+                if (src_index >= src_size) {
+                    return ZELDA64_ERROR_INVALID_DATA;
+                }
                 bytes = src[src_index++] + 0x12;
             } else {
                 bytes += 2;
             }
-            for (uint32_t n = 0; n < bytes; ++n) {
-                dest[dest_index++] = dest[cursor++];
+            if (distance > dest_index || bytes > dest_size - dest_index) {
+                return ZELDA64_ERROR_INVALID_DATA;
+            }
+            for (size_t n = 0; n < bytes; ++n, ++dest_index) {
+                dest[dest_index] = dest[dest_index - distance];
             }
         }
-        cb = cb << 1;
-        count--;
     }
+    return ZELDA64_OK;
+}
+
+void zelda64_yaz0_stream_init(zelda64_yaz0_stream_t *stream) {
+    assert(stream != nullptr);
+    // The window is only ever read after it was written, so it does not need clearing.
+    stream->header_size = 0;
+    stream->uncompressed_size = 0;
+    stream->total_out = 0;
+    stream->control = 0;
+    stream->chunks_left = 0;
+    stream->pending_size = 0;
+    stream->match_distance = 0;
+    stream->match_remaining = 0;
+}
+
+// Appends freshly written output to the window, which is a ring buffer indexed by the total output position.
+static void stream_append_window(zelda64_yaz0_stream_t *stream, const uint8_t *data, size_t size) {
+    if (size >= ZELDA64_YAZ0_WINDOW_SIZE) {
+        data += size - ZELDA64_YAZ0_WINDOW_SIZE;
+        stream->total_out += size - ZELDA64_YAZ0_WINDOW_SIZE;
+        size = ZELDA64_YAZ0_WINDOW_SIZE;
+    }
+    while (size > 0) {
+        size_t start = stream->total_out & (ZELDA64_YAZ0_WINDOW_SIZE - 1);
+        size_t length = ZELDA64_YAZ0_WINDOW_SIZE - start;
+        if (length > size) {
+            length = size;
+        }
+        memcpy(stream->window + start, data, length);
+        data += length;
+        size -= length;
+        stream->total_out += length;
+    }
+}
+
+// Copies as much of the pending back-reference as fits, returns the amount of bytes written. Output written during the
+// current call is read back from dest, anything older from the window.
+static size_t stream_copy_match(zelda64_yaz0_stream_t *stream, uint8_t *dest, size_t dest_index, size_t dest_size) {
+    size_t length = stream->match_remaining;
+    if (length > dest_size - dest_index) {
+        length = dest_size - dest_index;
+    }
+    size_t distance = stream->match_distance;
+    if (distance <= dest_index) {
+        uint8_t *out = dest + dest_index;
+        const uint8_t *from = out - distance;
+        if (distance >= length) {
+            memcpy(out, from, length);
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                out[i] = from[i];
+            }
+        }
+    } else {
+        for (size_t i = dest_index; i < dest_index + length; ++i) {
+            dest[i] = i >= distance ? dest[i - distance]
+                                    : stream->window[(stream->total_out + i - distance) & (ZELDA64_YAZ0_WINDOW_SIZE - 1)];
+        }
+    }
+    stream->match_remaining -= length;
+    return length;
+}
+
+zelda64_result_t zelda64_yaz0_stream_decompress(zelda64_yaz0_stream_t *stream,
+                                                const uint8_t *src, size_t src_size, size_t *src_read,
+                                                uint8_t *dest, size_t dest_size, size_t *dest_written) {
+    assert(stream != nullptr);
+    assert(src != nullptr || src_size == 0);
+    assert(dest != nullptr || dest_size == 0);
+    assert(src_read != nullptr);
+    assert(dest_written != nullptr);
+    size_t src_index = 0;
+    size_t dest_index = 0;
+    zelda64_result_t result = ZELDA64_OK;
+    if (stream->header_size < 16) {
+        size_t length = 16 - stream->header_size;
+        if (length > src_size) {
+            length = src_size;
+        }
+        memcpy(stream->header + stream->header_size, src, length);
+        stream->header_size += length;
+        src_index += length;
+        if (stream->header_size < 16) {
+            goto done;
+        }
+        zelda64_yaz0_header_t header = zelda64_get_yaz0_header(stream->header, 16);
+        if (!zelda64_is_valid_yaz0_header(header)) {
+            result = ZELDA64_ERROR_INVALID_DATA;
+            goto done;
+        }
+        stream->uncompressed_size = header.uncompressed_size;
+    }
+    // Never write more than the header announced.
+    if (dest_size > stream->uncompressed_size - stream->total_out) {
+        dest_size = stream->uncompressed_size - stream->total_out;
+    }
+    // The window is only brought up to date when returning, until then total_out is where this call started.
+    while (dest_index < dest_size) {
+        if (stream->match_remaining > 0) {
+            dest_index += stream_copy_match(stream, dest, dest_index, dest_size);
+            continue;
+        }
+        if (stream->chunks_left == 0) {
+            if (src_index >= src_size) {
+                break;
+            }
+            stream->control = src[src_index++];
+            stream->chunks_left = 8;
+        }
+        if (stream->control & 0x80) {
+            if (src_index >= src_size) {
+                break;
+            }
+            dest[dest_index++] = src[src_index++];
+        } else {
+            // Back-references are two bytes, or three when the length does not fit in the top nibble.
+            while (stream->pending_size < 2 && src_index < src_size) {
+                stream->pending[stream->pending_size++] = src[src_index++];
+            }
+            if (stream->pending_size < 2) {
+                break;
+            }
+            size_t bytes = stream->pending[0] >> 4;
+            if (bytes == 0) {
+                if (stream->pending_size < 3) {
+                    if (src_index >= src_size) {
+                        break;
+                    }
+                    stream->pending[stream->pending_size++] = src[src_index++];
+                }
+                bytes = stream->pending[2] + 0x12;
+            } else {
+                bytes += 2;
+            }
+            size_t distance = (((stream->pending[0] & 0xF) << 8) | stream->pending[1]) + 1;
+            size_t position = stream->total_out + dest_index;
+            stream->pending_size = 0;
+            if (distance > position || bytes > stream->uncompressed_size - position) {
+                result = ZELDA64_ERROR_INVALID_DATA;
+                break;
+            }
+            stream->match_distance = distance;
+            stream->match_remaining = bytes;
+        }
+        stream->control <<= 1;
+        stream->chunks_left--;
+    }
+done:
+    stream_append_window(stream, dest, dest_index);
+    *src_read = src_index;
+    *dest_written = dest_index;
+    return result;
+}
+
+void zelda64_yaz0_decompress(uint8_t *dest, size_t dest_size, const uint8_t *src) {
+    // Without a size the source is assumed to hold everything it refers to.
+    zelda64_yaz0_decompress_checked(dest, dest_size, src, SIZE_MAX);
 }
 
 void yaz0_search(const uint8_t *src, size_t src_size, int pos, int max_length, int search_range,
                  int *restrict found, int *restrict found_length) {
     int f = 0;
     int f_len = 1;
-    if (pos + 2 < src_size) {
+    if ((size_t) pos + 2 < src_size) {
         // Look back as far as the range allows us.
         int search = pos - search_range;
         if (search < 0) {
@@ -80,13 +308,13 @@ void yaz0_search(const uint8_t *src, size_t src_size, int pos, int max_length, i
             if (!match_found) {
                 break;
             }
-            int p1 = search + 1;
-            int p2 = pos + 1;
+            size_t p1 = search + 1;
+            size_t p2 = pos + 1;
             while (p2 < end && src[p1] == src[p2]) {
                 ++p1;
                 ++p2;
             }
-            int len = p2 - pos;
+            int len = (int) (p2 - pos);
             if (f_len < len) {
                 f_len = len;
                 f = search;
@@ -104,7 +332,7 @@ void yaz0_search(const uint8_t *src, size_t src_size, int pos, int max_length, i
 void calculate_prefix_table(const uint8_t *restrict needle, size_t size, int *restrict table) {
     int len = 0;
     table[0] = 0;
-    int i = 1;
+    size_t i = 1;
     while (i < size) {
         if (needle[i] == needle[len]) {
             ++len;
@@ -129,8 +357,8 @@ void find_longest_match(const uint8_t *data, size_t data_size,
     int table[needle_size];
     calculate_prefix_table(needle, needle_size, table);
 
-    int i = 0;
-    int j = 0;
+    size_t i = 0;
+    size_t j = 0;
     int longest_start = 0;
     int longest_match = 0;
     while ((data_size - i) >= (needle_size - j)) {
@@ -140,16 +368,16 @@ void find_longest_match(const uint8_t *data, size_t data_size,
         }
         // If our match is the same size as our needle, we got a full match, stop, this is as good as it'll get.
         if (j == needle_size) {
-            longest_start = i - j;
-            longest_match = j;
+            longest_start = (int) (i - j);
+            longest_match = (int) j;
             break;
         }
             // We failed to match after X characters.
         else if (i < data_size && data[i] != needle[j]) {
             if (j != 0) {
-                if (j > longest_match && j > 2) {
-                    longest_start = i - j;
-                    longest_match = j;
+                if (j > (size_t) longest_match && j > 2) {
+                    longest_start = (int) (i - j);
+                    longest_match = (int) j;
                 }
                 j = table[j - 1];
             } else {
@@ -161,15 +389,305 @@ void find_longest_match(const uint8_t *data, size_t data_size,
     *match_size = longest_match;
 }
 
-int zelda64_yaz0_compress_group(const uint8_t *restrict src, size_t src_size, int src_pos, int level,
-                                zelda64_yaz0_data_group_t *restrict out) {
-    int search_range = 0;
-    // The level controls the search range:
-    if (level >= 0 && level <= 9) {
-        search_range = 0x10e0 * level / 9 - 0x0e0;
+// The hash chains key on the first three bytes of a match, which is also the shortest match Yaz0 can encode.
+#define YAZ0_HASH_BITS 15
+#define YAZ0_HASH_SIZE (1 << YAZ0_HASH_BITS)
+#define YAZ0_WINDOW_SIZE 0x1000
+#define YAZ0_WINDOW_MASK (YAZ0_WINDOW_SIZE - 1)
+
+typedef enum match_finder_parser {
+    MATCH_FINDER_PARSER_GREEDY = 0,
+    MATCH_FINDER_PARSER_LAZY = 1,
+    MATCH_FINDER_PARSER_OPTIMAL = 2,
+} match_finder_parser_t;
+
+typedef struct match_finder_config {
+    int search_range;
+    int max_chain;
+    int nice_length;
+    int good_length;
+    match_finder_parser_t parser;
+} match_finder_config_t;
+
+static const match_finder_config_t match_finder_configs[ZELDA64_YAZ0_MAX_LEVEL + 1] = {
+        {0,                0,                0,               YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        // Fast: few candidates, settle for the first decent match.
+        {0x0400,           4,                16,              YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        {0x0800,           8,                32,              YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        {YAZ0_WINDOW_SIZE, 16,               64,              YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        // Normal: walk deeper chains and only stop early on a maximum length match.
+        {YAZ0_WINDOW_SIZE, 32,               YAZ0_MAX_LENGTH, YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        {YAZ0_WINDOW_SIZE, 64,               YAZ0_MAX_LENGTH, YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        {YAZ0_WINDOW_SIZE, 128,              YAZ0_MAX_LENGTH, YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        {YAZ0_WINDOW_SIZE, 256,              YAZ0_MAX_LENGTH, YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        {YAZ0_WINDOW_SIZE, 1024,             YAZ0_MAX_LENGTH, YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        // Exhaustive: every position in the window is a candidate.
+        {YAZ0_WINDOW_SIZE, YAZ0_WINDOW_SIZE, YAZ0_MAX_LENGTH, YAZ0_MAX_LENGTH, MATCH_FINDER_PARSER_GREEDY},
+        // The planned parses search every position, not only where a chunk starts. Most positions start out from the
+        // match found one position earlier, and those only get a short walk.
+        {YAZ0_WINDOW_SIZE, YAZ0_WINDOW_SIZE, YAZ0_MAX_LENGTH, 12,              MATCH_FINDER_PARSER_LAZY},
+        {YAZ0_WINDOW_SIZE, YAZ0_WINDOW_SIZE, YAZ0_MAX_LENGTH, 12,              MATCH_FINDER_PARSER_OPTIMAL},
+};
+
+static inline uint32_t yaz0_hash(const uint8_t *buf) {
+    return (u24_from_buf(buf) * 0x9E3779B1u) >> (32 - YAZ0_HASH_BITS);
+}
+
+// Adds every position before pos to the hash chains.
+static void match_finder_insert(zelda64_yaz0_match_finder_t *finder, size_t pos) {
+    if (pos < finder->cursor) {
+        // Going backwards, the chains now hold positions ahead of us. Start over from the window before pos.
+        memset(finder->head, 0xFF, YAZ0_HASH_SIZE * sizeof(int32_t));
+        finder->cursor = pos > YAZ0_WINDOW_SIZE ? pos - YAZ0_WINDOW_SIZE : 0;
+    } else if (pos > finder->cursor + YAZ0_WINDOW_SIZE) {
+        // Positions out of the window can never be matched against, no need to insert them.
+        finder->cursor = pos - YAZ0_WINDOW_SIZE;
+    }
+    // Only positions with three bytes left can be hashed.
+    size_t end = pos;
+    if (end + 2 > finder->src_size) {
+        end = finder->src_size > 2 ? finder->src_size - 2 : 0;
+    }
+    for (size_t i = finder->cursor; i < end; ++i) {
+        uint32_t hash = yaz0_hash(finder->src + i);
+        finder->prev[i & YAZ0_WINDOW_MASK] = finder->head[hash];
+        finder->head[hash] = (int32_t) i;
+    }
+    if (pos > finder->cursor) {
+        finder->cursor = pos;
+    }
+}
+
+// Searches for the longest match at pos. The search starts out from the match passed in through found and found_length,
+// and only looks for longer ones.
+static void match_finder_search(zelda64_yaz0_match_finder_t *finder, int pos,
+                                int *restrict found, int *restrict found_length) {
+    const uint8_t *src = finder->src;
+    int f = *found;
+    int f_len = *found_length;
+    match_finder_insert(finder, pos);
+    if ((size_t) pos + 2 < finder->src_size && f_len < finder->nice_length) {
+        int max_length = YAZ0_MAX_LENGTH;
+        if ((size_t) max_length > finder->src_size - pos) {
+            max_length = (int) (finder->src_size - pos);
+        }
+        int nice_length = finder->nice_length < max_length ? finder->nice_length : max_length;
+        int limit = pos - finder->search_range;
+        // A match running up to the end of the input can not be extended, and comparing past it would over-read.
+        int chain = f_len < max_length ? finder->max_chain : 0;
+        if (f_len >= finder->good_length) {
+            chain >>= 5;
+        }
+        // Chains run from the most recent position backwards, so the first candidate out of range ends the search.
+        for (int32_t candidate = finder->head[yaz0_hash(src + pos)];
+             candidate >= 0 && candidate >= limit && chain > 0;
+             candidate = finder->prev[candidate & YAZ0_WINDOW_MASK], --chain) {
+            // Check the byte that would make this match longer than the best one first, most candidates fail there.
+            if (src[candidate + f_len] != src[pos + f_len] || src[candidate] != src[pos]) {
+                continue;
+            }
+            int len = 0;
+            while (len < max_length && src[candidate + len] == src[pos + len]) {
+                ++len;
+            }
+            if (len > f_len) {
+                f_len = len;
+                f = candidate;
+                if (f_len >= nice_length) {
+                    break;
+                }
+            }
+        }
+    }
+    *found = f;
+    *found_length = f_len;
+}
+
+// Chunk sizes in bits, including the bit in the group header.
+#define YAZ0_LITERAL_COST 9
+#define YAZ0_SHORT_MATCH_COST 17
+#define YAZ0_LONG_MATCH_COST 25
+
+static inline uint32_t chunk_cost(uint32_t length) {
+    if (length < 3) {
+        return YAZ0_LITERAL_COST;
+    }
+    return length < 0x12 ? YAZ0_SHORT_MATCH_COST : YAZ0_LONG_MATCH_COST;
+}
+
+// Calculates the size in bytes of the groups produced by following a parse from the start of the buffer.
+static size_t parse_size(const uint16_t *lengths, size_t size) {
+    size_t bytes = 0;
+    size_t chunks = 0;
+    for (size_t pos = 0; pos < size; pos += lengths[pos], ++chunks) {
+        bytes += chunk_cost(lengths[pos]) / 8;
+    }
+    return bytes + (chunks + 7) / 8;
+}
+
+static void match_finder_free_plan(zelda64_yaz0_match_finder_t *finder) {
+    zelda64_allocator_t allocator = finder->allocator;
+    if (finder->plan_length != nullptr) {
+        allocator.free(finder->plan_length, allocator.userdata);
+        finder->plan_length = nullptr;
+    }
+    if (finder->plan_distance != nullptr) {
+        allocator.free(finder->plan_distance, allocator.userdata);
+        finder->plan_distance = nullptr;
+    }
+    if (finder->plan_cost != nullptr) {
+        allocator.free(finder->plan_cost, allocator.userdata);
+        finder->plan_cost = nullptr;
+    }
+    finder->plan_capacity = 0;
+}
+
+// Finds the longest match at every position from the start of the finder on, and picks the chunks to emit from those.
+// The plan arrays are indexed relative to the start.
+static zelda64_result_t match_finder_plan(zelda64_yaz0_match_finder_t *finder, match_finder_parser_t parser) {
+    size_t start = finder->start;
+    size_t size = finder->src_size - start;
+    zelda64_allocator_t allocator = finder->allocator;
+    // The arrays are kept between buffers and only grow when a larger one comes along.
+    if (finder->plan_capacity < size + 1 || (parser == MATCH_FINDER_PARSER_OPTIMAL && finder->plan_cost == nullptr)) {
+        match_finder_free_plan(finder);
+        finder->plan_length = allocator.alloc(size + 1, sizeof(uint16_t), allocator.userdata);
+        finder->plan_distance = allocator.alloc(size + 1, sizeof(uint16_t), allocator.userdata);
+        if (parser == MATCH_FINDER_PARSER_OPTIMAL) {
+            finder->plan_cost = allocator.alloc(size + 1, sizeof(uint32_t), allocator.userdata);
+        }
+        if (finder->plan_length == nullptr || finder->plan_distance == nullptr ||
+            (parser == MATCH_FINDER_PARSER_OPTIMAL && finder->plan_cost == nullptr)) {
+            match_finder_free_plan(finder);
+            return ZELDA64_ERROR_OUT_OF_MEMORY;
+        }
+        finder->plan_capacity = size + 1;
+    }
+    uint16_t *lengths = finder->plan_length;
+    int found = 0;
+    int found_length = 1;
+    for (size_t pos = 0; pos < size; ++pos) {
+        // The match at the previous position continues here with one byte less, so only longer ones need a search.
+        if (found_length > 3) {
+            ++found;
+            --found_length;
+        } else {
+            found = 0;
+            found_length = 1;
+        }
+        match_finder_search(finder, (int) (start + pos), &found, &found_length);
+        lengths[pos] = found_length > 2 ? found_length : 1;
+        finder->plan_distance[pos] = found_length > 2 ? start + pos - found : 0;
+    }
+    finder->greedy_size = parse_size(lengths, size);
+    if (parser == MATCH_FINDER_PARSER_LAZY) {
+        // Emit a literal instead when the next position starts a longer match. Only lengths[pos + 1] is read, which
+        // has not been changed yet, so the plan can overwrite the match lengths in place.
+        for (size_t pos = 0; pos + 1 < size; ++pos) {
+            if (lengths[pos] > 2 && lengths[pos + 1] > lengths[pos]) {
+                lengths[pos] = 1;
+            }
+        }
+    } else if (parser == MATCH_FINDER_PARSER_OPTIMAL) {
+        // Shortest path from every position to the end of the buffer. Any length up to the longest match is valid at
+        // the same distance, so every position has edges for a literal and each of those lengths.
+        uint32_t *costs = finder->plan_cost;
+        costs[size] = 0;
+        for (size_t pos = size; pos-- > 0;) {
+            uint32_t longest = lengths[pos];
+            uint32_t best_cost = YAZ0_LITERAL_COST + costs[pos + 1];
+            uint32_t best_length = 1;
+            for (uint32_t length = 3; length <= longest; ++length) {
+                uint32_t cost = chunk_cost(length) + costs[pos + length];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_length = length;
+                }
+            }
+            costs[pos] = best_cost;
+            lengths[pos] = best_length;
+        }
     }
+    finder->planned_size = parse_size(lengths, size);
+    return ZELDA64_OK;
+}
+
+// Points a finder at a new buffer, reusing the memory it holds from earlier buffers.
+static zelda64_result_t match_finder_reset(zelda64_yaz0_match_finder_t *finder, const uint8_t *src, size_t start,
+                                           size_t src_size, int level) {
+    if (level < 0) {
+        level = 0;
+    } else if (level > ZELDA64_YAZ0_MAX_LEVEL) {
+        level = ZELDA64_YAZ0_MAX_LEVEL;
+    }
+    const match_finder_config_t *config = &match_finder_configs[level];
+    zelda64_allocator_t allocator = finder->allocator;
+    finder->src = src;
+    finder->src_size = src_size;
+    finder->start = start;
+    // Inserting positions jumps ahead to the window before the start, which primes the chains with it.
+    finder->cursor = 0;
+    finder->search_range = config->search_range;
+    finder->max_chain = config->max_chain;
+    finder->nice_length = config->nice_length;
+    finder->good_length = config->good_length;
+    finder->greedy_size = 0;
+    finder->planned_size = 0;
+    if (config->parser == MATCH_FINDER_PARSER_GREEDY) {
+        // A plan left over from another level would be followed instead of searching.
+        match_finder_free_plan(finder);
+    }
+    if (config->search_range == 0) {
+        return ZELDA64_OK;
+    }
+    if (finder->head == nullptr) {
+        finder->head = allocator.alloc(YAZ0_HASH_SIZE, sizeof(int32_t), allocator.userdata);
+    }
+    if (finder->prev == nullptr) {
+        finder->prev = allocator.alloc(YAZ0_WINDOW_SIZE, sizeof(int32_t), allocator.userdata);
+    }
+    if (finder->head == nullptr || finder->prev == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    memset(finder->head, 0xFF, YAZ0_HASH_SIZE * sizeof(int32_t));
+    if (config->parser != MATCH_FINDER_PARSER_GREEDY) {
+        return match_finder_plan(finder, config->parser);
+    }
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_yaz0_match_finder_init(zelda64_yaz0_match_finder_t *finder, const uint8_t *src,
+                                                size_t src_size, int level, zelda64_allocator_t allocator) {
+    assert(finder != nullptr);
+    *finder = (zelda64_yaz0_match_finder_t) {
+            .allocator = allocator,
+    };
+    zelda64_result_t result = match_finder_reset(finder, src, 0, src_size, level);
+    if (result != ZELDA64_OK) {
+        zelda64_yaz0_match_finder_free(finder);
+    }
+    return result;
+}
+
+void zelda64_yaz0_match_finder_free(zelda64_yaz0_match_finder_t *finder) {
+    assert(finder != nullptr);
+    if (finder->head != nullptr) {
+        finder->allocator.free(finder->head, finder->allocator.userdata);
+        finder->head = nullptr;
+    }
+    if (finder->prev != nullptr) {
+        finder->allocator.free(finder->prev, finder->allocator.userdata);
+        finder->prev = nullptr;
+    }
+    match_finder_free_plan(finder);
+}
+
+// Compresses the next group, writing its header byte to header and its chunks to chunks.
+static int compress_group(const uint8_t *restrict src, size_t src_size, int src_pos, int search_range,
+                          zelda64_yaz0_match_finder_t *finder, uint8_t *restrict header, uint8_t *restrict chunks,
+                          size_t *restrict length) {
     // Read over the source array.
-    if (src_pos < src_size) {
+    if ((size_t) src_pos < src_size) {
         // Yaz0 compresses data into groups, a 1-byte header with 8 chunks of variable size, each bit in the header
         // Indicates the size of each chunk. If a bit is high (1), that means the chunk is one byte and should be copied
         // directly during decompression. If a bit is low (0), then the byte specifies the location in the compressed
@@ -181,55 +699,230 @@ int zelda64_yaz0_compress_group(const uint8_t *restrict src, size_t src_size, in
         // metadata that will be attached to the uncompressed data and the 16-byte Yaz0 header.
         size_t group_pos = 0;
         uint8_t bitmask = 0x80;
-        for (int i = 0; i < 8 && src_pos < src_size; ++i) {
+        *header = 0;
+        for (int i = 0; i < 8 && (size_t) src_pos < src_size; ++i) {
             int found = 0;
-            int found_length = 0;
+            int found_length = 1;
             if (search_range > 0) {
-                /*
-                // Calculate look back position.
-                int search = src_pos - search_range;
-                if (search < 0) {
-                    search = 0;
-                }
-                int search_end = search_range;
-                if (search_end > src_size) {
-                    search_end = src_size;
-                }
-                if (search_end > src_pos) {
-                    search_end = src_pos;
-                }
-                // The size of the needle (ideally we find this!)
-                size_t needle_size = YAZ0_MAX_LENGTH;
-                if (needle_size > src_size - src_pos) {
-                    needle_size = src_size - src_pos;
+                if (finder != nullptr && finder->plan_length != nullptr) {
+                    found_length = finder->plan_length[src_pos - finder->start];
+                    found = src_pos - finder->plan_distance[src_pos - finder->start];
+                } else if (finder != nullptr) {
+                    match_finder_search(finder, src_pos, &found, &found_length);
+                } else {
+                    yaz0_search(src, src_size, src_pos, YAZ0_MAX_LENGTH, search_range, &found, &found_length);
                 }
-                // Here, we now use our own algorithm!
-                find_longest_match(src + search, search_end, src + src_pos, needle_size,
-                                   &found, &found_length);
-                found = search + found;
-                */
-                yaz0_search(src, src_size, src_pos, YAZ0_MAX_LENGTH, search_range, &found, &found_length);
             }
             if (found_length > 2) {
                 int delta = src_pos - found - 1;
                 if (found_length < 0x12) {
-                    out->chunks[group_pos++] = ((found_length - 2) << 4) | (delta >> 8) ;
-                    out->chunks[group_pos++] = (delta & 0xFF);
+                    chunks[group_pos++] = ((found_length - 2) << 4) | (delta >> 8) ;
+                    chunks[group_pos++] = (delta & 0xFF);
                 } else {
-                    out->chunks[group_pos++] = delta >> 8;
-                    out->chunks[group_pos++] = delta & 0xFF;
-                    out->chunks[group_pos++] = (found_length - 0x12) & 0xFF;
+                    chunks[group_pos++] = delta >> 8;
+                    chunks[group_pos++] = delta & 0xFF;
+                    chunks[group_pos++] = (found_length - 0x12) & 0xFF;
                 }
                 src_pos += found_length;
             } else {
                 // This means that there was no found match, so we should copy the byte directly.
-                out->chunks[group_pos++] = src[src_pos++];
-                out->header |= bitmask;
+                chunks[group_pos++] = src[src_pos++];
+                *header |= bitmask;
             }
             bitmask = bitmask >> 1;
         }
-        out->length = group_pos;
+        *length = group_pos;
         return src_pos;
     }
     return 0;
 }
+
+int zelda64_yaz0_compress_group(const uint8_t *restrict src, size_t src_size, int src_pos, int level,
+                                zelda64_yaz0_data_group_t *restrict out) {
+    int search_range = 0;
+    // The level controls the search range:
+    if (level >= 0 && level <= 9) {
+        search_range = 0x10e0 * level / 9 - 0x0e0;
+    }
+    return compress_group(src, src_size, src_pos, search_range, nullptr, &out->header, out->chunks, &out->length);
+}
+
+int zelda64_yaz0_compress_group_indexed(zelda64_yaz0_match_finder_t *finder, int src_pos,
+                                        zelda64_yaz0_data_group_t *out) {
+    assert(finder != nullptr);
+    assert(out != nullptr);
+    return compress_group(finder->src, finder->src_size, src_pos, finder->search_range, finder,
+                          &out->header, out->chunks, &out->length);
+}
+
+zelda64_result_t zelda64_yaz0_compressor_init(zelda64_yaz0_compressor_t *compressor, int level,
+                                              zelda64_allocator_t allocator) {
+    assert(compressor != nullptr);
+    *compressor = (zelda64_yaz0_compressor_t) {
+            .finder = {
+                    .allocator = allocator,
+            },
+            .level = level,
+    };
+    return ZELDA64_OK;
+}
+
+void zelda64_yaz0_compressor_free(zelda64_yaz0_compressor_t *compressor) {
+    assert(compressor != nullptr);
+    zelda64_yaz0_match_finder_free(&compressor->finder);
+}
+
+// Compresses the finder's buffer from its start on into groups. The last group may have less than 8 chunks.
+static zelda64_result_t compress_groups(zelda64_yaz0_match_finder_t *finder, uint8_t *restrict dest,
+                                        size_t dest_capacity, size_t *dest_size) {
+    const uint8_t *src = finder->src;
+    size_t src_size = finder->src_size;
+    size_t dest_pos = 0;
+    int src_pos = (int) finder->start;
+    while ((size_t) src_pos < src_size) {
+        size_t length = 0;
+        if (dest_capacity - dest_pos >= YAZ0_GROUP_MAX_SRC) {
+            // Groups go straight into the output while a whole one is certain to fit.
+            src_pos = compress_group(src, src_size, src_pos, finder->search_range, finder,
+                                     dest + dest_pos, dest + dest_pos + 1, &length);
+        } else {
+            uint8_t group[YAZ0_GROUP_MAX_SRC];
+            src_pos = compress_group(src, src_size, src_pos, finder->search_range, finder,
+                                     group, group + 1, &length);
+            if (dest_capacity - dest_pos < length + 1) {
+                return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+            }
+            memcpy(dest + dest_pos, group, length + 1);
+        }
+        dest_pos += length + 1;
+    }
+    *dest_size = dest_pos;
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_yaz0_compressor_compress(zelda64_yaz0_compressor_t *compressor,
+                                                  uint8_t *restrict dest, size_t dest_capacity,
+                                                  const uint8_t *restrict src, size_t src_size, size_t *dest_size) {
+    assert(compressor != nullptr);
+    assert(dest != nullptr);
+    assert(src != nullptr || src_size == 0);
+    assert(dest_size != nullptr);
+    if (dest_capacity < 16 || src_size > UINT32_MAX) {
+        return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+    }
+    zelda64_result_t result = match_finder_reset(&compressor->finder, src, 0, src_size, compressor->level);
+    if (result != ZELDA64_OK) {
+        return result;
+    }
+    memcpy(dest, ZELDA64_YAZ0_MAGIC, 4);
+    u32_to_buf(src_size, dest + 4);
+    memset(dest + 8, 0, 8);
+    result = compress_groups(&compressor->finder, dest + 16, dest_capacity - 16, dest_size);
+    if (result == ZELDA64_OK) {
+        *dest_size += 16;
+    }
+    return result;
+}
+
+zelda64_result_t zelda64_yaz0_compressor_compress_range(zelda64_yaz0_compressor_t *compressor,
+                                                        uint8_t *restrict dest, size_t dest_capacity,
+                                                        const uint8_t *restrict src, size_t start, size_t end,
+                                                        size_t *dest_size) {
+    assert(compressor != nullptr);
+    assert(dest != nullptr);
+    assert(src != nullptr || end == 0);
+    assert(start <= end);
+    assert(dest_size != nullptr);
+    if (end > UINT32_MAX) {
+        return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+    }
+    // Ending the buffer at the end of the range keeps matches from running past it.
+    zelda64_result_t result = match_finder_reset(&compressor->finder, src, start, end, compressor->level);
+    if (result != ZELDA64_OK) {
+        return result;
+    }
+    return compress_groups(&compressor->finder, dest, dest_capacity, dest_size);
+}
+
+zelda64_result_t zelda64_yaz0_joiner_init(zelda64_yaz0_joiner_t *joiner, uint8_t *dest, size_t dest_capacity,
+                                          size_t uncompressed_size) {
+    assert(joiner != nullptr);
+    assert(dest != nullptr);
+    if (dest_capacity < 16 || uncompressed_size > UINT32_MAX) {
+        return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+    }
+    *joiner = (zelda64_yaz0_joiner_t) {
+            .dest = dest,
+            .dest_capacity = dest_capacity,
+            .dest_size = 16,
+    };
+    memcpy(dest, ZELDA64_YAZ0_MAGIC, 4);
+    u32_to_buf(uncompressed_size, dest + 4);
+    memset(dest + 8, 0, 8);
+    return ZELDA64_OK;
+}
+
+zelda64_result_t zelda64_yaz0_joiner_append(zelda64_yaz0_joiner_t *joiner, const uint8_t *groups, size_t groups_size,
+                                            size_t uncompressed_size) {
+    assert(joiner != nullptr);
+    assert(groups != nullptr || groups_size == 0);
+    size_t pos = 0;
+    size_t decoded = 0;
+    while (decoded < uncompressed_size) {
+        if (pos >= groups_size) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        uint8_t header = groups[pos++];
+        for (int bit = 0; bit < 8 && decoded < uncompressed_size; ++bit) {
+            bool literal = header & (0x80 >> bit);
+            size_t chunk_size = 1;
+            if (literal) {
+                decoded += 1;
+            } else if (groups_size - pos < 2) {
+                return ZELDA64_ERROR_INVALID_DATA;
+            } else if (groups[pos] >> 4 != 0) {
+                chunk_size = 2;
+                decoded += (groups[pos] >> 4) + 2;
+            } else if (groups_size - pos < 3) {
+                return ZELDA64_ERROR_INVALID_DATA;
+            } else {
+                chunk_size = 3;
+                decoded += groups[pos + 2] + 0x12;
+            }
+            if (pos + chunk_size > groups_size) {
+                return ZELDA64_ERROR_INVALID_DATA;
+            }
+            // The chunk goes into the group the output ends with, which is opened when the previous one is full.
+            if (joiner->group_chunks == 0) {
+                if (joiner->dest_size == joiner->dest_capacity) {
+                    return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+                }
+                joiner->group_pos = joiner->dest_size++;
+                joiner->dest[joiner->group_pos] = 0;
+            }
+            if (joiner->dest_capacity - joiner->dest_size < chunk_size) {
+                return ZELDA64_ERROR_BUFFER_TOO_SMALL;
+            }
+            if (literal) {
+                joiner->dest[joiner->group_pos] |= 0x80 >> joiner->group_chunks;
+            }
+            memcpy(joiner->dest + joiner->dest_size, groups + pos, chunk_size);
+            joiner->dest_size += chunk_size;
+            joiner->group_chunks = (joiner->group_chunks + 1) & 7;
+            pos += chunk_size;
+        }
+    }
+    // A back-reference running past the range would overlap the next one.
+    return decoded == uncompressed_size ? ZELDA64_OK : ZELDA64_ERROR_INVALID_DATA;
+}
+
+size_t zelda64_yaz0_compress(uint8_t *restrict dest, size_t dest_capacity, const uint8_t *restrict src,
+                             size_t src_size, int level) {
+    zelda64_yaz0_compressor_t compressor;
+    zelda64_yaz0_compressor_init(&compressor, level, zelda64_default_allocator());
+    size_t dest_size = 0;
+    zelda64_result_t result = zelda64_yaz0_compressor_compress(&compressor, dest, dest_capacity, src, src_size,
+                                                               &dest_size);
+    zelda64_yaz0_compressor_free(&compressor);
+    return result == ZELDA64_OK ? dest_size : 0;
+}
@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <string.h>
+
+#include "async_writer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Runs are large enough that the file system sees few, big writes, and few enough that memory use stays bounded.
+#define ASYNC_WRITER_RUN_COUNT 4
+#define ASYNC_WRITER_RUN_SIZE (1024 * 1024)
+
+typedef struct async_writer_run {
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+} async_writer_run_t;
+
+// Runs are used round-robin. Runs from written up to submitted are queued for the writer thread, and the run after
+// them is the one being filled. Only the writer thread advances written, only writers advance submitted.
+struct async_writer {
+    zelda64_allocator_t allocator;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t run_submitted;
+    pthread_cond_t run_written;
+    async_writer_run_t runs[ASYNC_WRITER_RUN_COUNT];
+    size_t submitted;
+    size_t written;
+    bool failed;
+    bool stopping;
+};
+
+// Writes a vector of buffers to consecutive bytes of the file, picking up where a short write left off.
+static bool write_vector(int fd, struct iovec *vector, int count, off_t offset) {
+    while (count > 0) {
+#if defined(__linux__) || defined(__FreeBSD__)
+        ssize_t written = pwritev(fd, vector, count, offset);
+#else
+        ssize_t written = pwrite(fd, vector->iov_base, vector->iov_len, offset);
+#endif
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        offset += written;
+        while (count > 0 && (size_t) written >= vector->iov_len) {
+            written -= (ssize_t) vector->iov_len;
+            ++vector;
+            --count;
+        }
+        if (count > 0) {
+            vector->iov_base = (uint8_t *) vector->iov_base + written;
+            vector->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// Writes the runs from begin up to end, every group of runs that follow each other in the file in one go.
+static bool write_runs(async_writer_t *writer, size_t begin, size_t end) {
+    struct iovec vector[ASYNC_WRITER_RUN_COUNT];
+    bool success = true;
+    while (begin < end) {
+        const async_writer_run_t *first = &writer->runs[begin % ASYNC_WRITER_RUN_COUNT];
+        size_t next_offset = first->offset;
+        int count = 0;
+        do {
+            const async_writer_run_t *run = &writer->runs[begin % ASYNC_WRITER_RUN_COUNT];
+            vector[count++] = (struct iovec) {.iov_base = run->data, .iov_len = run->size};
+            next_offset = run->offset + run->size;
+            ++begin;
+        } while (begin < end && writer->runs[begin % ASYNC_WRITER_RUN_COUNT].offset == next_offset);
+        success = write_vector(writer->fd, vector, count, (off_t) first->offset) && success;
+    }
+    return success;
+}
+
+static void *writer_thread(void *userdata) {
+    async_writer_t *writer = (async_writer_t *) userdata;
+    pthread_mutex_lock(&writer->lock);
+    while (true) {
+        if (writer->written == writer->submitted) {
+            if (writer->stopping) {
+                break;
+            }
+            pthread_cond_wait(&writer->run_submitted, &writer->lock);
+            continue;
+        }
+        size_t begin = writer->written;
+        size_t end = writer->submitted;
+        pthread_mutex_unlock(&writer->lock);
+        bool success = write_runs(writer, begin, end);
+        for (size_t i = begin; i < end; ++i) {
+            writer->runs[i % ASYNC_WRITER_RUN_COUNT].size = 0;
+        }
+        pthread_mutex_lock(&writer->lock);
+        writer->failed = writer->failed || !success;
+        writer->written = end;
+        pthread_cond_broadcast(&writer->run_written);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return nullptr;
+}
+
+// Hands the run being filled to the writer thread, and waits for the next run to be free.
+static void submit_run(async_writer_t *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->submitted++;
+    pthread_cond_signal(&writer->run_submitted);
+    while (writer->submitted - writer->written >= ASYNC_WRITER_RUN_COUNT) {
+        pthread_cond_wait(&writer->run_written, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static void free_writer(async_writer_t *writer) {
+    zelda64_allocator_t allocator = writer->allocator;
+    for (size_t i = 0; i < ASYNC_WRITER_RUN_COUNT; ++i) {
+        if (writer->runs[i].data != nullptr) {
+            allocator.free(writer->runs[i].data, allocator.userdata);
+        }
+    }
+    pthread_cond_destroy(&writer->run_written);
+    pthread_cond_destroy(&writer->run_submitted);
+    pthread_mutex_destroy(&writer->lock);
+    if (writer->fd >= 0) {
+        close(writer->fd);
+    }
+    allocator.free(writer, allocator.userdata);
+}
+
+async_writer_t *async_writer_open(const char *filename, zelda64_allocator_t allocator) {
+    assert(filename != nullptr);
+    async_writer_t *writer = allocator.alloc(1, sizeof(async_writer_t), allocator.userdata);
+    if (writer == nullptr) {
+        return nullptr;
+    }
+    writer->allocator = allocator;
+    pthread_mutex_init(&writer->lock, nullptr);
+    pthread_cond_init(&writer->run_submitted, nullptr);
+    pthread_cond_init(&writer->run_written, nullptr);
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        free_writer(writer);
+        return nullptr;
+    }
+    for (size_t i = 0; i < ASYNC_WRITER_RUN_COUNT; ++i) {
+        writer->runs[i].data = allocator.alloc(ASYNC_WRITER_RUN_SIZE, sizeof(uint8_t), allocator.userdata);
+        if (writer->runs[i].data == nullptr) {
+            free_writer(writer);
+            return nullptr;
+        }
+    }
+    if (pthread_create(&writer->thread, nullptr, writer_thread, writer) != 0) {
+        free_writer(writer);
+        return nullptr;
+    }
+    return writer;
+}
+
+bool async_writer_close(async_writer_t *writer) {
+    assert(writer != nullptr);
+    bool success = async_writer_flush(writer);
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->run_submitted);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, nullptr);
+    free_writer(writer);
+    return success;
+}
+
+void async_writer_reserve(async_writer_t *writer, size_t size) {
+    assert(writer != nullptr);
+    if (ftruncate(writer->fd, (off_t) size) != 0) {
+        pthread_mutex_lock(&writer->lock);
+        writer->failed = true;
+        pthread_mutex_unlock(&writer->lock);
+    }
+}
+
+void async_writer_write(async_writer_t *writer, const void *data, size_t size, size_t offset) {
+    assert(writer != nullptr);
+    const uint8_t *cursor = data;
+    while (size > 0) {
+        async_writer_run_t *run = &writer->runs[writer->submitted % ASYNC_WRITER_RUN_COUNT];
+        if (run->size == 0) {
+            run->offset = offset;
+        } else if (run->offset + run->size != offset) {
+            // Not a continuation of the run, so it can not grow any further.
+            submit_run(writer);
+            continue;
+        }
+        size_t block = ASYNC_WRITER_RUN_SIZE - run->size < size ? ASYNC_WRITER_RUN_SIZE - run->size : size;
+        memcpy(run->data + run->size, cursor, block);
+        run->size += block;
+        cursor += block;
+        offset += block;
+        size -= block;
+        if (run->size == ASYNC_WRITER_RUN_SIZE) {
+            submit_run(writer);
+        }
+    }
+}
+
+bool async_writer_flush(async_writer_t *writer) {
+    assert(writer != nullptr);
+    if (writer->runs[writer->submitted % ASYNC_WRITER_RUN_COUNT].size > 0) {
+        submit_run(writer);
+    }
+    pthread_mutex_lock(&writer->lock);
+    while (writer->written < writer->submitted) {
+        pthread_cond_wait(&writer->run_written, &writer->lock);
+    }
+    bool success = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return success;
+}
+
+#else
+
+async_writer_t *async_writer_open(const char *filename, zelda64_allocator_t allocator) {
+    return nullptr;
+}
+
+bool async_writer_close(async_writer_t *writer) {
+    return false;
+}
+
+void async_writer_reserve(async_writer_t *writer, size_t size) {
+}
+
+void async_writer_write(async_writer_t *writer, const void *data, size_t size, size_t offset) {
+}
+
+bool async_writer_flush(async_writer_t *writer) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <zelda64/zelda64.h>
+
+// Collects positioned writes into large contiguous runs and writes them out on a dedicated thread, so the threads
+// producing the output never wait on the file system. Runs that follow each other in the file are written with a
+// single vectored write.
+typedef struct async_writer async_writer_t;
+
+/**
+ * Creates or truncates a file and starts a writer thread for it.
+ * @param filename The file to write to.
+ * @param allocator The allocator used for the writer and its buffers.
+ * @return The new writer, or nullptr if the file could not be opened or the platform has no positioned writes.
+ */
+async_writer_t *async_writer_open(const char *filename, zelda64_allocator_t allocator);
+
+/**
+ * Flushes all pending writes, stops the writer thread, closes the file and frees the writer.
+ * @param writer The writer to close.
+ * @return true if every write made it to the file, false otherwise.
+ */
+bool async_writer_close(async_writer_t *writer);
+
+/**
+ * Sets the size of the file, without writing anything.
+ * @param writer The writer to resize the file of.
+ * @param size The new size of the file in bytes.
+ */
+void async_writer_reserve(async_writer_t *writer, size_t size);
+
+/**
+ * Queues a write. The data is copied, so it may be reused as soon as the function returns. Blocks only when all
+ * buffers are waiting to be written. Writes must not be made from several threads at the same time.
+ * @param writer The writer to write to.
+ * @param data The data to write.
+ * @param size The size of the data in bytes.
+ * @param offset Where in the file to write the data.
+ */
+void async_writer_write(async_writer_t *writer, const void *data, size_t size, size_t offset);
+
+/**
+ * Waits until every write queued so far is in the file.
+ * @param writer The writer to flush.
+ * @return true if every write so far made it to the file, false if any of them failed.
+ */
+bool async_writer_flush(async_writer_t *writer);
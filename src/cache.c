@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zelda64/yaz0.h>
+
+#include "cache.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_directory(path) mkdir(path, 0755)
+#define process_id() ((unsigned long) getpid())
+#elif defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#define make_directory(path) _mkdir(path)
+#define process_id() ((unsigned long) _getpid())
+#endif
+
+// Bumped whenever the encoder changes its output, so entries made by an older encoder are not mixed in.
+#define CACHE_FORMAT_VERSION 2
+#define CACHE_PATH_MAX 4096
+
+// Numbers the temporary files of this process. Worker indices are not unique once several runs share a pool.
+static atomic_ulong temporary_count;
+
+static bool cache_entry_path(const zelda64_compress_cache_t *cache, zelda64_compress_cache_key_t key,
+                             char path[CACHE_PATH_MAX]) {
+    char name[SHA256_DIGEST_SIZE * 2 + 1];
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+        snprintf(name + i * 2, 3, "%02x", key.digest[i]);
+    }
+    int length = snprintf(path, CACHE_PATH_MAX, "%s/%s-%d-%zu-v%d.yaz0", cache->directory, name, key.level,
+                          key.segment_size, CACHE_FORMAT_VERSION);
+    return length > 0 && length < CACHE_PATH_MAX;
+}
+
+bool zelda64_compress_cache_open(zelda64_compress_cache_t *cache, const char *directory) {
+    assert(cache != nullptr);
+    assert(directory != nullptr);
+    cache->directory = directory;
+#ifdef make_directory
+    if (make_directory(directory) != 0 && errno != EEXIST) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+zelda64_compress_cache_key_t zelda64_compress_cache_key(const uint8_t *data, size_t size, int level,
+                                                        size_t segment_size) {
+    // Files that fit in one segment come out the same as unsegmented ones, so they share their entries.
+    zelda64_compress_cache_key_t key = {
+            .level = level,
+            .segment_size = segment_size > 0 && size > segment_size ? segment_size : 0,
+    };
+    sha256(data, size, key.digest);
+    return key;
+}
+
+bool zelda64_compress_cache_lookup(const zelda64_compress_cache_t *cache, zelda64_compress_cache_key_t key,
+                                   const uint8_t *data, size_t size, uint8_t *dest, size_t *dest_size,
+                                   zelda64_allocator_t allocator) {
+    char path[CACHE_PATH_MAX];
+    if (!cache_entry_path(cache, key, path)) {
+        return false;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    size_t capacity = zelda64_yaz0_compress_bound(size);
+    size_t read = fread(dest, sizeof(uint8_t), capacity, file);
+    // An entry larger than the bound can not have been made by the encoder.
+    bool fits = read < capacity || fgetc(file) == EOF;
+    fclose(file);
+    if (!fits || read < 16) {
+        return false;
+    }
+    zelda64_yaz0_header_t header = zelda64_get_yaz0_header(dest, read);
+    if (!zelda64_is_valid_yaz0_header(header) || header.uncompressed_size != size) {
+        return false;
+    }
+    // Decompressing is far cheaper than compressing, so make sure the entry really holds this file.
+    uint8_t *check = allocator.alloc(size > 0 ? size : 1, sizeof(uint8_t), allocator.userdata);
+    if (check == nullptr) {
+        return false;
+    }
+    bool valid = zelda64_yaz0_decompress_checked(check, size, dest, read) == ZELDA64_OK &&
+                 memcmp(check, data, size) == 0;
+    allocator.free(check, allocator.userdata);
+    if (valid) {
+        *dest_size = read;
+    }
+    return valid;
+}
+
+void zelda64_compress_cache_store(const zelda64_compress_cache_t *cache, zelda64_compress_cache_key_t key,
+                                  const uint8_t *data, size_t size) {
+    char path[CACHE_PATH_MAX];
+    char temporary_path[CACHE_PATH_MAX];
+    if (!cache_entry_path(cache, key, path)) {
+        return;
+    }
+#ifdef process_id
+    unsigned long owner = process_id();
+#else
+    unsigned long owner = 0;
+#endif
+    unsigned long number = atomic_fetch_add(&temporary_count, 1);
+    int length = snprintf(temporary_path, CACHE_PATH_MAX, "%s.%lu.%lu.tmp", path, owner, number);
+    if (length <= 0 || length >= CACHE_PATH_MAX) {
+        return;
+    }
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == nullptr) {
+        return;
+    }
+    bool written = fwrite(data, sizeof(uint8_t), size, file) == size;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary_path, path) != 0) {
+        remove(temporary_path);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zelda64/zelda64.h>
+
+#include "sha256.h"
+
+// On-disk cache of compressed files. Every entry is a Yaz0 blob named after the SHA-256 digest of the uncompressed
+// file, the compression level and the segment size it was made with, so any file that was compressed before can be
+// reused as is.
+typedef struct zelda64_compress_cache {
+    const char *directory;
+} zelda64_compress_cache_t;
+
+typedef struct zelda64_compress_cache_key {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int level;
+    // The size of the segments the file was split into, 0 when it was compressed in one piece.
+    size_t segment_size;
+} zelda64_compress_cache_key_t;
+
+/**
+ * Opens a cache directory, creating it if it does not exist yet.
+ * @param cache The cache to open.
+ * @param directory Path to the directory, which must outlive the cache.
+ * @return true on success, false if the directory could not be created.
+ */
+bool zelda64_compress_cache_open(zelda64_compress_cache_t *cache, const char *directory);
+
+/**
+ * Derives the key of a file.
+ * @param data The uncompressed file.
+ * @param size The size of the file in bytes.
+ * @param level The compression level.
+ * @param segment_size The segment size the file is compressed with, see zelda64_compress_file().
+ * @return The key of the file.
+ */
+zelda64_compress_cache_key_t zelda64_compress_cache_key(const uint8_t *data, size_t size, int level,
+                                                        size_t segment_size);
+
+/**
+ * Looks up a file in the cache. The entry is only returned when it decompresses back to the file exactly.
+ * @param cache The cache to search.
+ * @param key The key of the file.
+ * @param data The uncompressed file.
+ * @param size The size of the file in bytes.
+ * @param dest Buffer to read the compressed file into, which must hold zelda64_yaz0_compress_bound(size) bytes.
+ * @param dest_size Output parameter holding the size of the compressed file.
+ * @param allocator Allocator for the scratch buffer used to check the entry.
+ * @return true on a hit, false if the file is not in the cache or its entry is damaged.
+ * @note Safe to call from multiple threads.
+ */
+bool zelda64_compress_cache_lookup(const zelda64_compress_cache_t *cache, zelda64_compress_cache_key_t key,
+                                   const uint8_t *data, size_t size, uint8_t *dest, size_t *dest_size,
+                                   zelda64_allocator_t allocator);
+
+/**
+ * Adds a compressed file to the cache. The entry is written to a temporary file first and renamed into place, so
+ * readers never see a partial entry. Failures are ignored, the cache only speeds things up.
+ * @param cache The cache to add to.
+ * @param key The key of the file.
+ * @param data The compressed file.
+ * @param size The size of the compressed file in bytes.
+ * @note Safe to call from multiple threads, every call writes its own temporary file.
+ */
+void zelda64_compress_cache_store(const zelda64_compress_cache_t *cache, zelda64_compress_cache_key_t key,
+                                  const uint8_t *data, size_t size);
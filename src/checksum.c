@@ -0,0 +1,62 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zelda64/rom.h>
+
+#include "checksum.h"
+#include "../lib/util.h"
+
+// CRC1 and CRC2 follow each other in the header.
+#define CHECKSUM_HEADER_OFFSET 0x10
+
+zelda64_result_t zelda64_checksum_fixup_init(zelda64_checksum_fixup_t *fixup, zelda64_allocator_t allocator) {
+    assert(fixup != nullptr);
+    *fixup = (zelda64_checksum_fixup_t) {
+            .head = allocator.alloc(ZELDA64_CHECKSUM_END, sizeof(uint8_t), allocator.userdata),
+            .allocator = allocator,
+    };
+    return fixup->head != nullptr ? ZELDA64_OK : ZELDA64_ERROR_OUT_OF_MEMORY;
+}
+
+void zelda64_checksum_fixup_free(zelda64_checksum_fixup_t *fixup) {
+    assert(fixup != nullptr);
+    if (fixup->head != nullptr) {
+        fixup->allocator.free(fixup->head, fixup->allocator.userdata);
+        fixup->head = nullptr;
+    }
+}
+
+void zelda64_checksum_fixup_update(zelda64_checksum_fixup_t *fixup, const uint8_t *data, size_t size, size_t offset) {
+    if (fixup->head == nullptr) {
+        return;
+    }
+    if (offset + size > fixup->written_end) {
+        fixup->written_end = offset + size;
+    }
+    if (offset < ZELDA64_CHECKSUM_END) {
+        size_t copied = size < ZELDA64_CHECKSUM_END - offset ? size : ZELDA64_CHECKSUM_END - offset;
+        memcpy(fixup->head + offset, data, copied);
+    }
+}
+
+void zelda64_checksum_fixup_write(zelda64_checksum_fixup_t *fixup, zelda64_write_data_func_t *write_data,
+                                  void *userdata) {
+    if (fixup->head == nullptr || fixup->written_end < ZELDA64_CHECKSUM_END) {
+        return;
+    }
+    uint32_t cic = zelda64_calculate_rom_cic(fixup->head + 64, ZELDA64_BOOTCODE_LENGTH);
+    // Without knowing the CIC there is no telling which checksum is right, so whatever the header holds is kept.
+    if (cic == 0) {
+        fprintf(stderr, "unknown bootcode, leaving the header checksum as it is\n");
+        return;
+    }
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    zelda64_calculate_rom_checksum(fixup->head, ZELDA64_CHECKSUM_END, cic, &crc1, &crc2);
+    uint8_t checksum[8];
+    u32_to_buf(crc1, checksum);
+    u32_to_buf(crc2, checksum + 4);
+    write_data(checksum, sizeof checksum, CHECKSUM_HEADER_OFFSET, userdata);
+    zelda64_checksum_fixup_update(fixup, checksum, sizeof checksum, CHECKSUM_HEADER_OFFSET);
+}
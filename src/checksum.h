@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zelda64/zelda64.h>
+
+// Keeps a copy of the part of an output ROM the boot checksum covers, taken as the output is written, so CRC1 and
+// CRC2 in the header can be fixed up at the end without reading the output back. A zero-initialized fix-up is
+// disabled and does nothing.
+typedef struct zelda64_checksum_fixup {
+    uint8_t *head;
+    // The end of the furthest write, the checksum is only written once the whole range has been.
+    size_t written_end;
+    zelda64_allocator_t allocator;
+} zelda64_checksum_fixup_t;
+
+/**
+ * Initializes a fix-up, allocating the copy of the checksummed range.
+ * @param fixup The fix-up to initialize.
+ * @param allocator The allocator used for the copy.
+ * @return ZELDA64_OK on success or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_checksum_fixup_init(zelda64_checksum_fixup_t *fixup, zelda64_allocator_t allocator);
+
+/**
+ * Frees the copy held by a fix-up.
+ * @param fixup The fix-up to free.
+ */
+void zelda64_checksum_fixup_free(zelda64_checksum_fixup_t *fixup);
+
+/**
+ * Copies the part of a write to the output that falls in the checksummed range. Must be called for every write, in
+ * the order the writes reach the output.
+ * @param fixup The fix-up to update.
+ * @param data The data written.
+ * @param size The size of the data in bytes.
+ * @param offset The offset in the output the data was written to.
+ */
+void zelda64_checksum_fixup_update(zelda64_checksum_fixup_t *fixup, const uint8_t *data, size_t size, size_t offset);
+
+/**
+ * Calculates the checksum for the CIC the bootcode was made for and writes it into the header of the output. Outputs
+ * too small to hold the checksummed range are left alone, as are outputs with an unknown bootcode, with a warning on
+ * stderr.
+ * @param fixup The fix-up holding the copy of the output.
+ * @param write_data The write callback of the output.
+ * @param userdata Pointer passed in to write_data.
+ */
+void zelda64_checksum_fixup_write(zelda64_checksum_fixup_t *fixup, zelda64_write_data_func_t *write_data,
+                                  void *userdata);
@@ -1,68 +1,322 @@
 #include <assert.h>
+#include <inttypes.h>
+#include <stdalign.h>
 #include <stdio.h>
 #include <pthread.h>
 
+#include <zelda64/arena.h>
 #include <zelda64/dma.h>
 #include <zelda64/yaz0.h>
 
+#include "cache.h"
+#include "checksum.h"
 #include "compress.h"
+#include "pool.h"
 #include "../lib/util.h"
 
+// Files at least this large have a few samples compressed first when they look like noise, to predict whether
+// compressing all of them is worth it. Smaller files are compressed whole and checked afterwards.
+#define PREFILTER_SAMPLE_SIZE (1024 * 16)
+#define PREFILTER_SAMPLE_COUNT 4
+#define PREFILTER_MIN_SIZE (PREFILTER_SAMPLE_SIZE * PREFILTER_SAMPLE_COUNT * 2)
+// Samples count as noise from a collision entropy of 7.2 bits per byte, that is, when the chance of two bytes being
+// equal is at most 1 in 147. No coder of single bytes could shrink such data by more than a tenth.
+#define PREFILTER_NOISE_RATIO 147
+
 typedef enum compressor_action {
     COMPRESSOR_ACTION_SKIP = 0,
     COMPRESSOR_ACTION_COPY = 1,
     COMPRESSOR_ACTION_COMPRESS = 2,
 } compressor_action_t;
 
-typedef struct compressor_worker_params {
-    const zelda64_compress_rom_params_t *compress_params;
-    void *data;
+typedef struct compressor_job {
+    zelda64_dma_entry_t entry;
+    compressor_action_t action;
+    // Slot in the output arena holding the compressed file, filled in by the workers.
+    uint8_t *data;
     size_t size;
-    size_t write_offset;
-} compressor_worker_params_t;
-
-#define COMPRESSION_BUFFER_SIZE 4096
-
-size_t compress_worker(void *userdata) {
-    assert(userdata != nullptr);
-    compressor_worker_params_t *params = (compressor_worker_params_t *) userdata;
-    uint8_t buffer[COMPRESSION_BUFFER_SIZE] = {};
-    // First, write the Yaz0 header.
-    zelda64_yaz0_header_t header = {
-            .magic = ZELDA64_YAZ0_MAGIC,
-            .uncompressed_size = params->size,
+    // Bytes saved by the lazy or optimal parse compared to a greedy one, negative when the parse came out larger.
+    int64_t saved;
+    // Whether the compressed file came out of the cache.
+    bool cached;
+    // Time spent compressing the file or looking it up in the cache.
+    double seconds;
+} compressor_job_t;
+
+typedef struct compressor_context {
+    const zelda64_compress_rom_params_t *params;
+    zelda64_allocator_t allocator;
+    compressor_job_t *jobs;
+    // Indices into jobs in the order the workers should pick them up in.
+    uint32_t *queue;
+    uint32_t entries;
+    // One compressor per worker, reused for every file the worker picks up.
+    zelda64_yaz0_compressor_t *compressors;
+    // Segments of large files are compressed as nested batches on the same pool.
+    worker_pool_t *pool;
+    // The callbacks are not required to be thread safe, so all reads are serialized.
+    pthread_mutex_t io_lock;
+    zelda64_result_t result;
+} compressor_context_t;
+
+static void fail(compressor_context_t *context, zelda64_result_t result) {
+    pthread_mutex_lock(&context->io_lock);
+    context->result = result;
+    pthread_mutex_unlock(&context->io_lock);
+}
+
+// Checks whether the bytes of a sample are spread so evenly over all values that it looks like noise.
+static bool looks_like_noise(const uint8_t *data, size_t size) {
+    uint32_t counts[256] = {};
+    for (size_t i = 0; i < size; ++i) {
+        counts[data[i]]++;
+    }
+    uint64_t collisions = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        collisions += (uint64_t) counts[i] * counts[i];
+    }
+    return collisions * PREFILTER_NOISE_RATIO <= (uint64_t) size * size;
+}
+
+static bool is_worth_compressing(size_t uncompressed_size, size_t compressed_size, int min_gain) {
+    return compressed_size * 100 < uncompressed_size * (size_t) (100 - min_gain);
+}
+
+// Predicts whether a file shrinks by at least min_gain percent. Files of which any sample has some structure are
+// assumed to, only for files that look like noise throughout are the samples compressed to find out.
+static bool predict_worth_compressing(zelda64_yaz0_compressor_t *compressor, uint8_t *scratch, size_t scratch_size,
+                                      const uint8_t *data, size_t size, int min_gain) {
+    size_t stride = (size - PREFILTER_SAMPLE_SIZE) / (PREFILTER_SAMPLE_COUNT - 1);
+    for (size_t i = 0; i < PREFILTER_SAMPLE_COUNT; ++i) {
+        if (!looks_like_noise(data + i * stride, PREFILTER_SAMPLE_SIZE)) {
+            return true;
+        }
+    }
+    size_t compressed_size = 0;
+    for (size_t i = 0; i < PREFILTER_SAMPLE_COUNT; ++i) {
+        size_t sample_size = 0;
+        if (zelda64_yaz0_compressor_compress(compressor, scratch, scratch_size, data + i * stride,
+                                             PREFILTER_SAMPLE_SIZE, &sample_size) != ZELDA64_OK) {
+            return true;
+        }
+        compressed_size += sample_size;
+    }
+    return is_worth_compressing(PREFILTER_SAMPLE_SIZE * PREFILTER_SAMPLE_COUNT, compressed_size, min_gain);
+}
+
+typedef struct compressor_segment {
+    // Slot in the scratch buffer holding the groups of the segment.
+    uint8_t *groups;
+    size_t size;
+    int64_t saved;
+    zelda64_result_t result;
+} compressor_segment_t;
+
+typedef struct compressor_segment_context {
+    const uint8_t *data;
+    size_t data_size;
+    size_t segment_size;
+    int level;
+    zelda64_allocator_t allocator;
+    compressor_segment_t *segments;
+} compressor_segment_context_t;
+
+static void compress_segment_job(size_t index, [[maybe_unused]] size_t worker, void *userdata) {
+    compressor_segment_context_t *context = (compressor_segment_context_t *) userdata;
+    compressor_segment_t *segment = &context->segments[index];
+    size_t start = index * context->segment_size;
+    size_t end = start + context->segment_size < context->data_size ? start + context->segment_size : context->data_size;
+    // Worker indices are only unique within this batch while the outer one is still running, so the compressors of
+    // the workers are off limits.
+    zelda64_yaz0_compressor_t compressor;
+    zelda64_yaz0_compressor_init(&compressor, context->level, context->allocator);
+    segment->result = zelda64_yaz0_compressor_compress_range(&compressor, segment->groups,
+                                                             zelda64_yaz0_compress_bound(context->segment_size),
+                                                             context->data, start, end, &segment->size);
+    if (segment->result == ZELDA64_OK && compressor.finder.plan_length != nullptr) {
+        segment->saved = (int64_t) compressor.finder.greedy_size - (int64_t) compressor.finder.planned_size;
+    }
+    zelda64_yaz0_compressor_free(&compressor);
+}
+
+zelda64_result_t zelda64_compress_file(zelda64_yaz0_compressor_t *compressor, worker_pool_t *pool,
+                                       size_t segment_size, const uint8_t *data, size_t size, uint8_t *dest,
+                                       size_t *dest_size, int64_t *saved, zelda64_allocator_t allocator) {
+    assert(compressor != nullptr);
+    size_t bound = zelda64_yaz0_compress_bound(size);
+    int64_t planned = 0;
+    if (segment_size == 0 || size <= segment_size) {
+        zelda64_result_t result = zelda64_yaz0_compressor_compress(compressor, dest, bound, data, size, dest_size);
+        if (result == ZELDA64_OK && saved != nullptr && compressor->finder.plan_length != nullptr) {
+            *saved = (int64_t) compressor->finder.greedy_size - (int64_t) compressor->finder.planned_size;
+        }
+        return result;
+    }
+    assert(pool != nullptr);
+    size_t count = (size + segment_size - 1) / segment_size;
+    size_t segment_bound = zelda64_yaz0_compress_bound(segment_size);
+    compressor_segment_t *segments = allocator.alloc(count, sizeof(compressor_segment_t), allocator.userdata);
+    uint8_t *scratch = allocator.alloc(count, segment_bound, allocator.userdata);
+    zelda64_result_t result = segments != nullptr && scratch != nullptr ? ZELDA64_OK : ZELDA64_ERROR_OUT_OF_MEMORY;
+    if (result == ZELDA64_OK) {
+        for (size_t i = 0; i < count; ++i) {
+            segments[i].groups = scratch + i * segment_bound;
+        }
+        compressor_segment_context_t context = {
+                .data = data,
+                .data_size = size,
+                .segment_size = segment_size,
+                .level = compressor->level,
+                .allocator = allocator,
+                .segments = segments,
+        };
+        worker_pool_run(pool, count, compress_segment_job, &context);
+        // The segments only depend on the file, so the stream is the same however they were spread over threads.
+        zelda64_yaz0_joiner_t joiner;
+        result = zelda64_yaz0_joiner_init(&joiner, dest, bound, size);
+        for (size_t i = 0; i < count && result == ZELDA64_OK; ++i) {
+            size_t range_size = i + 1 < count ? segment_size : size - i * segment_size;
+            result = segments[i].result;
+            if (result == ZELDA64_OK) {
+                result = zelda64_yaz0_joiner_append(&joiner, segments[i].groups, segments[i].size, range_size);
+            }
+            planned += segments[i].saved;
+        }
+        *dest_size = joiner.dest_size;
+    }
+    if (result == ZELDA64_OK && saved != nullptr) {
+        *saved = planned;
+    }
+    if (segments != nullptr) {
+        allocator.free(segments, allocator.userdata);
+    }
+    if (scratch != nullptr) {
+        allocator.free(scratch, allocator.userdata);
+    }
+    return result;
+}
+
+static void compress_job(size_t index, size_t worker, void *userdata) {
+    compressor_context_t *context = (compressor_context_t *) userdata;
+    const zelda64_compress_rom_params_t *params = context->params;
+    uint32_t i = context->queue[index];
+    compressor_job_t *job = &context->jobs[i];
+    size_t uncompressed_size = zelda64_get_file_size(job->entry);
+    pthread_mutex_lock(&context->io_lock);
+    uint8_t *data = params->read_rom_data(uncompressed_size, job->entry.p_start, params->userdata);
+    pthread_mutex_unlock(&context->io_lock);
+    if (job->data == nullptr) {
+        fail(context, ZELDA64_ERROR_OUT_OF_MEMORY);
+    } else if (data == nullptr) {
+        fail(context, ZELDA64_ERROR_INVALID_DATA);
+    }
+    if (job->data != nullptr && data != nullptr) {
+        double start = zelda64_stats_now();
+        zelda64_yaz0_compressor_t *compressor = &context->compressors[worker];
+        size_t bound = zelda64_yaz0_compress_bound(uncompressed_size);
+        if (params->min_gain > 0 && uncompressed_size >= PREFILTER_MIN_SIZE &&
+            zelda64_is_uncompressed_file(job->entry) &&
+            !predict_worth_compressing(compressor, job->data, bound, data, uncompressed_size, params->min_gain)) {
+            if (params->stats == nullptr) {
+                printf("storing incompressible file %d/%d\n", i + 1, context->entries);
+            }
+            job->action = COMPRESSOR_ACTION_COPY;
+            job->seconds = zelda64_stats_now() - start;
+            pthread_mutex_lock(&context->io_lock);
+            params->close_rom_data(data, uncompressed_size, params->userdata);
+            pthread_mutex_unlock(&context->io_lock);
+            return;
+        }
+        zelda64_compress_cache_key_t key;
+        if (params->cache != nullptr) {
+            key = zelda64_compress_cache_key(data, uncompressed_size, params->level, params->segment_size);
+            job->cached = zelda64_compress_cache_lookup(params->cache, key, data, uncompressed_size,
+                                                        job->data, &job->size, context->allocator);
+        }
+        if (job->cached) {
+            if (params->stats == nullptr) {
+                printf("reusing cached file %d/%d\n", i + 1, context->entries);
+            }
+        } else {
+            if (params->stats == nullptr) {
+                printf("compressing file %d/%d\n", i + 1, context->entries);
+            }
+            zelda64_result_t result = zelda64_compress_file(compressor, context->pool, params->segment_size, data,
+                                                            uncompressed_size, job->data, &job->size, &job->saved,
+                                                            context->allocator);
+            if (result != ZELDA64_OK) {
+                fail(context, result);
+            } else if (params->cache != nullptr) {
+                zelda64_compress_cache_store(params->cache, key, job->data, job->size);
+            }
+        }
+        // Whatever the prediction, a file that turned out not to shrink enough is stored as it is.
+        if (params->min_gain > 0 && zelda64_is_uncompressed_file(job->entry) &&
+            !is_worth_compressing(uncompressed_size, (job->size + 31) & -16, params->min_gain)) {
+            job->action = COMPRESSOR_ACTION_COPY;
+        }
+        job->seconds = zelda64_stats_now() - start;
+    }
+    if (data != nullptr) {
+        pthread_mutex_lock(&context->io_lock);
+        params->close_rom_data(data, uncompressed_size, params->userdata);
+        pthread_mutex_unlock(&context->io_lock);
+    }
+}
+
+// Builds the order in which files are handed to the workers: files above the threshold first, largest to smallest,
+// followed by all other files in table order.
+static uint32_t build_queue(compressor_context_t *context) {
+    size_t threshold = context->params->threshold;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < context->entries; ++i) {
+        if (context->jobs[i].action == COMPRESSOR_ACTION_COMPRESS &&
+            threshold > 0 && zelda64_get_file_size(context->jobs[i].entry) >= threshold) {
+            context->queue[count++] = i;
+        }
+    }
+    for (uint32_t i = 1; i < count; ++i) {
+        uint32_t index = context->queue[i];
+        size_t size = zelda64_get_file_size(context->jobs[index].entry);
+        uint32_t j = i;
+        for (; j > 0 && zelda64_get_file_size(context->jobs[context->queue[j - 1]].entry) < size; --j) {
+            context->queue[j] = context->queue[j - 1];
+        }
+        context->queue[j] = index;
+    }
+    for (uint32_t i = 0; i < context->entries; ++i) {
+        if (context->jobs[i].action == COMPRESSOR_ACTION_COMPRESS &&
+            (threshold == 0 || zelda64_get_file_size(context->jobs[i].entry) < threshold)) {
+            context->queue[count++] = i;
+        }
+    }
+    return count;
+}
+
+static void report_file(const zelda64_compress_rom_params_t *params, uint32_t index, const compressor_job_t *job,
+                        size_t output_size) {
+    if (params->stats == nullptr || params->stats->file == nullptr) {
+        return;
+    }
+    zelda64_file_stats_t stats = {
+            .index = index,
+            .action = ZELDA64_FILE_ACTION_SKIPPED,
+            .output_size = output_size,
+            .seconds = job->seconds,
     };
-    memcpy(buffer, header.magic, 4);
-    u32_to_buf(header.uncompressed_size, buffer + 4);
-    size_t bytes_written = 16;
-    // Now we can move forward with decompression!
-    int bytes_read = 0;
-    size_t bytes_out = 0;
-    while (bytes_read < params->size) {
-        if (bytes_written + 25 > sizeof buffer) {
-            // Write out the buffer we got so far and reset it.
-            params->compress_params->write_data(buffer, bytes_written, params->write_offset + bytes_out,
-                                                params->compress_params->userdata);
-            bytes_out += bytes_written;
-            memset(buffer, 0, sizeof buffer);
-            bytes_written = 0;
-        }
-        zelda64_yaz0_data_group_t group = {};
-        bytes_read = zelda64_yaz0_compress_group(params->data, params->size, bytes_read, 9, &group);
-        // Copy the group to the intermediate compression buffer.
-        buffer[bytes_written] = group.header;
-        memcpy(buffer + bytes_written + 1, group.chunks, group.length);
-        bytes_written += group.length + 1;
-    }
-    // Finalize writing data.
-    params->compress_params->write_data(buffer, bytes_written, params->write_offset + bytes_out,
-                                        params->compress_params->userdata);
-    // File sizes must be aligned so do that here:
-    bytes_written = (bytes_out + bytes_written + 31) & -16;
-    return bytes_written;
+    if (job->entry.v_start != job->entry.v_end && job->action != COMPRESSOR_ACTION_SKIP) {
+        stats.input_size = zelda64_get_file_size(job->entry);
+        if (job->action == COMPRESSOR_ACTION_COPY) {
+            stats.action = ZELDA64_FILE_ACTION_COPIED;
+        } else {
+            stats.action = job->cached ? ZELDA64_FILE_ACTION_CACHED : ZELDA64_FILE_ACTION_COMPRESSED;
+        }
+    }
+    params->stats->file(&stats, params->stats->userdata);
 }
 
 zelda64_result_t zelda64_compress_rom(zelda64_compress_rom_params_t params, zelda64_allocator_t allocator) {
+    double start = zelda64_stats_now();
     zelda64_dma_info_t dma_info = {};
     zelda64_find_dma_table_params_t find_dma_table_params = {
             .rom_size = params.rom_size,
@@ -76,55 +330,206 @@ zelda64_result_t zelda64_compress_rom(zelda64_compress_rom_params_t params, zeld
     }
     // Read the entire DMA table into memory, too.
     uint8_t *dma_table = params.read_rom_data(dma_info.size, dma_info.offset, params.userdata);
+    if (dma_table == nullptr) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    zelda64_result_t result = ZELDA64_OK;
     uint8_t *dma_out = allocator.alloc(dma_info.size, sizeof(uint8_t), allocator.userdata);
-    compressor_action_t *actions = allocator.alloc(dma_info.entries, sizeof(compressor_action_t), allocator.userdata);
+    compressor_job_t *jobs = allocator.alloc(dma_info.entries, sizeof(compressor_job_t), allocator.userdata);
+    uint32_t *queue = allocator.alloc(dma_info.entries, sizeof(uint32_t), allocator.userdata);
+    worker_pool_t *pool = params.pool != nullptr ? params.pool : worker_pool_create(params.thread_count, allocator);
+    size_t compressor_count = pool != nullptr ? worker_pool_size(pool) : 0;
+    zelda64_yaz0_compressor_t *compressors = allocator.alloc(compressor_count, sizeof(zelda64_yaz0_compressor_t),
+                                                             allocator.userdata);
+    zelda64_arena_t outputs = {};
+    zelda64_checksum_fixup_t checksum = {};
+    for (size_t i = 0; compressors != nullptr && i < compressor_count; ++i) {
+        zelda64_yaz0_compressor_init(&compressors[i], params.level, allocator);
+    }
+    if (dma_out == nullptr || jobs == nullptr || queue == nullptr || pool == nullptr || compressors == nullptr ||
+        (params.fix_checksum && zelda64_checksum_fixup_init(&checksum, allocator) != ZELDA64_OK)) {
+        result = ZELDA64_ERROR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
     for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
-        actions[i] = COMPRESSOR_ACTION_COMPRESS;
+        jobs[i].entry = zelda64_get_dma_table_entry(dma_table, dma_info.size, i);
+        jobs[i].action = COMPRESSOR_ACTION_COMPRESS;
     }
     // Any excluded files should simply be copied over from the source.
-    for (int_fast32_t i = 0; i < params.exclusion_list_size; ++i) {
+    for (size_t i = 0; i < params.exclusion_list_size; ++i) {
         uint32_t exclusion = params.exclusion_list[i];
-        actions[exclusion] = COMPRESSOR_ACTION_COPY;
+        if (exclusion < dma_info.entries) {
+            jobs[exclusion].action = COMPRESSOR_ACTION_COPY;
+        }
+    }
+    // The files up to and including the DMA table keep their place, since the table is written back to its own offset.
+    for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
+        if (jobs[i].entry.v_start < dma_info.offset + dma_info.size && jobs[i].action == COMPRESSOR_ACTION_COMPRESS) {
+            jobs[i].action = COMPRESSOR_ACTION_COPY;
+        }
+    }
+    // Dead files have nothing to compress.
+    for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
+        if (jobs[i].entry.v_start == jobs[i].entry.v_end && jobs[i].action == COMPRESSOR_ACTION_COMPRESS) {
+            jobs[i].action = COMPRESSOR_ACTION_SKIP;
+        }
+    }
+    // Every compressed file gets a slot of its bound in one arena, handed out up front so the workers need no
+    // allocations of their own and the whole pass takes a single one.
+    size_t outputs_size = 0;
+    for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
+        if (jobs[i].action == COMPRESSOR_ACTION_COMPRESS) {
+            outputs_size += zelda64_yaz0_compress_bound(zelda64_get_file_size(jobs[i].entry)) + alignof(max_align_t);
+        }
     }
-    // The way to do this is a bit odd. The plan is to essentially read from the source rom sequentially. A DMA table
-    // should, technically speaking, be in the correct order.
+    if (zelda64_arena_init(&outputs, outputs_size, allocator) != ZELDA64_OK) {
+        result = ZELDA64_ERROR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+    for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
+        if (jobs[i].action == COMPRESSOR_ACTION_COMPRESS) {
+            size_t bound = zelda64_yaz0_compress_bound(zelda64_get_file_size(jobs[i].entry));
+            jobs[i].data = zelda64_arena_push(&outputs, bound);
+        }
+    }
+    // First pass: compress every file into its own slot, spread over the worker threads.
+    compressor_context_t context = {
+            .params = &params,
+            .allocator = allocator,
+            .jobs = jobs,
+            .queue = queue,
+            .compressors = compressors,
+            .pool = pool,
+            .entries = dma_info.entries,
+            .result = ZELDA64_OK,
+    };
+    pthread_mutex_init(&context.io_lock, nullptr);
+    worker_pool_run(pool, build_queue(&context), compress_job, &context);
+    pthread_mutex_destroy(&context.io_lock);
+    result = context.result;
+    if (result != ZELDA64_OK) {
+        goto cleanup;
+    }
+    // Every file size is known now, so the output can be sized before it is written.
+    if (params.reserve != nullptr) {
+        // The output ends with the data of the last file, without the padding that would follow it.
+        size_t output_size = dma_info.offset + dma_info.size;
+        size_t cursor = 0;
+        size_t end = 0;
+        for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
+            const compressor_job_t *job = &jobs[i];
+            if (job->entry.v_start == job->entry.v_end) {
+                continue;
+            }
+            if (job->action == COMPRESSOR_ACTION_COMPRESS) {
+                end = cursor + job->size;
+                cursor += (job->size + 31) & -16;
+            } else if (job->action == COMPRESSOR_ACTION_COPY) {
+                end = cursor + zelda64_get_file_size(job->entry);
+                cursor = end;
+            }
+        }
+        params.reserve(end > output_size ? end : output_size, params.userdata);
+    }
+    // Second pass: lay the files out sequentially in table order. This is what makes the output independent of the
+    // order in which the workers finished.
     size_t cursor = 0;
+    int64_t saved = 0;
+    size_t cached = 0;
+    double file_seconds = 0;
+    bool verbose = params.stats == nullptr;
     for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
-        // Read the data from the ROM.
-        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(dma_table, dma_info.size, i);
+        compressor_job_t *job = &jobs[i];
+        size_t file_start = cursor;
+        saved += job->saved;
+        cached += job->cached;
+        file_seconds += job->seconds;
+        zelda64_dma_entry_t entry = job->entry;
         if (entry.v_start != entry.v_end) {
-            size_t uncompressed_size = zelda64_get_file_size(entry);
-            uint8_t *data = params.read_rom_data(uncompressed_size, entry.p_start, params.userdata);
             entry.p_start = cursor;
-            if (actions[i] == COMPRESSOR_ACTION_COMPRESS) {
-                printf("compressing file %d/%d\n", i + 1, dma_info.entries);
-                compressor_worker_params_t worker_params = {
-                        .data = data,
-                        .size = uncompressed_size,
-                        .compress_params = &params,
-                        .write_offset = cursor,
-                };
-                size_t compressed_size = compress_worker(&worker_params);
+            if (job->action == COMPRESSOR_ACTION_COMPRESS) {
+                params.write_data(job->data, job->size, cursor, params.userdata);
+                zelda64_checksum_fixup_update(&checksum, job->data, job->size, cursor);
+                // File sizes must be aligned so do that here:
+                size_t compressed_size = (job->size + 31) & -16;
                 entry.p_end = cursor + compressed_size;
                 cursor += compressed_size; // advance write cursor
-            } else if (actions[i] == COMPRESSOR_ACTION_COPY) {
-                printf("copying file %d/%d\n", i + 1, dma_info.entries);
+            } else if (job->action == COMPRESSOR_ACTION_COPY) {
+                if (verbose) {
+                    printf("copying file %d/%d\n", i + 1, dma_info.entries);
+                }
+                size_t uncompressed_size = zelda64_get_file_size(entry);
+                uint8_t *data = params.read_rom_data(uncompressed_size, job->entry.p_start, params.userdata);
+                if (data == nullptr) {
+                    result = ZELDA64_ERROR_INVALID_DATA;
+                    goto cleanup;
+                }
                 params.write_data(data, uncompressed_size, cursor, params.userdata);
+                zelda64_checksum_fixup_update(&checksum, data, uncompressed_size, cursor);
+                params.close_rom_data(data, uncompressed_size, params.userdata);
                 cursor += uncompressed_size;
             } else {
-                printf("skipping file %d/%d\n", i + 1, dma_info.entries);
+                if (verbose) {
+                    printf("skipping file %d/%d\n", i + 1, dma_info.entries);
+                }
                 entry.p_start = 0xFF'FF'FF'FF;
                 entry.p_end = 0xFF'FF'FF'FF;
             }
-            params.close_rom_data(data, uncompressed_size, params.userdata);
-        } else {
+        } else if (verbose) {
             printf("skipping dead file at %d/%d\n", i + 1, dma_info.entries);
         }
+        report_file(&params, i, job, cursor - file_start);
         // Write the entry into the DMA table.
         zelda64_set_dma_table_entry(dma_out, dma_info.size, i, entry);
     }
-    params.close_rom_data(dma_table, dma_info.size, params.userdata);
     params.write_data(dma_out, dma_info.size, dma_info.offset, params.userdata);
-    allocator.free(dma_out, allocator.userdata);
-    return ZELDA64_OK;
+    zelda64_checksum_fixup_update(&checksum, dma_out, dma_info.size, dma_info.offset);
+    zelda64_checksum_fixup_write(&checksum, params.write_data, params.userdata);
+    if (params.finish != nullptr) {
+        result = params.finish(params.userdata);
+        if (result != ZELDA64_OK) {
+            goto cleanup;
+        }
+    }
+    if (params.stats != nullptr && params.stats->rom != nullptr) {
+        zelda64_rom_stats_t stats = {
+                .files = dma_info.entries,
+                .input_size = params.rom_size,
+                .output_size = cursor > dma_info.offset + dma_info.size ? cursor : dma_info.offset + dma_info.size,
+                .seconds = zelda64_stats_now() - start,
+                .file_seconds = file_seconds,
+        };
+        params.stats->rom(&stats, params.stats->userdata);
+    }
+    if (verbose && params.cache != nullptr) {
+        printf("reused %zu cached files\n", cached);
+    }
+    if (verbose && params.level > ZELDA64_YAZ0_GREEDY_LEVEL) {
+        printf("%s parsing %s %" PRId64 " bytes compared to greedy parsing\n",
+               params.level == ZELDA64_YAZ0_LAZY_LEVEL ? "lazy" : "optimal", saved >= 0 ? "saved" : "lost",
+               saved >= 0 ? saved : -saved);
+    }
+cleanup:
+    zelda64_arena_free(&outputs);
+    zelda64_checksum_fixup_free(&checksum);
+    if (jobs != nullptr) {
+        allocator.free(jobs, allocator.userdata);
+    }
+    if (compressors != nullptr) {
+        for (size_t i = 0; i < compressor_count; ++i) {
+            zelda64_yaz0_compressor_free(&compressors[i]);
+        }
+        allocator.free(compressors, allocator.userdata);
+    }
+    if (pool != nullptr && pool != params.pool) {
+        worker_pool_destroy(pool);
+    }
+    if (queue != nullptr) {
+        allocator.free(queue, allocator.userdata);
+    }
+    if (dma_out != nullptr) {
+        allocator.free(dma_out, allocator.userdata);
+    }
+    params.close_rom_data(dma_table, dma_info.size, params.userdata);
+    return result;
 }
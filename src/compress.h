@@ -1,17 +1,75 @@
 #pragma once
 
+#include <stdint.h>
+
+#include <zelda64/yaz0.h>
 #include <zelda64/zelda64.h>
 
+#include "cache.h"
+#include "pool.h"
+#include "stats.h"
+
 typedef struct zelda64_compress_rom_params {
     zelda64_read_data_func_t *read_rom_data;
     zelda64_close_data_func_t *close_rom_data;
+    // Optional callback to reserve space for the output, called once with the final size before anything is written.
+    void (*reserve)(size_t size, void *userdata);
     zelda64_write_data_func_t *write_data;
+    // Optional callback called once after the last write of a successful run, for example to flush buffered writes.
+    // A result other than ZELDA64_OK fails the run.
+    zelda64_finish_func_t *finish;
+    // Recalculates CRC1 and CRC2 in the header of the output from a copy of the checksummed range taken as it is
+    // written, right before finish is called.
+    bool fix_checksum;
+    // Files that are stored as they are. The list is optional, files that barely shrink are stored as well.
     uint32_t *exclusion_list;
     size_t exclusion_list_size;
+    // Files that do not shrink by at least this many percent are stored as they are, which saves time decompressing
+    // them for next to no space. Large files are sampled first and only compressed when their samples do shrink. Set
+    // to 0 to compress every file that is not on the exclusion list.
+    int min_gain;
     size_t rom_size;
     size_t block_size;
+    // Files of at least this many bytes are compressed before any smaller file, so that the largest files do not end
+    // up on the tail of the run. Set to 0 to compress files in DMA table order.
     size_t threshold;
+    // Files larger than this are split into segments of this size, which are compressed on separate threads and joined
+    // into one Yaz0 stream, so that a few large files do not hold up the end of the run. Every segment can still refer
+    // back into the window before it. Set to 0 to compress every file in one piece.
+    size_t segment_size;
+    // The amount of worker threads to compress files on. When set to 0 all files are compressed on the calling thread.
+    // The output is identical regardless of the amount of threads. Callbacks are never called concurrently.
+    size_t thread_count;
+    // Optional pool to run on instead of one made for this run, so that several runs can share their threads. When set,
+    // thread_count is ignored.
+    worker_pool_t *pool;
+    // The Yaz0 compression level, from 0 (store only) to ZELDA64_YAZ0_MAX_LEVEL.
+    int level;
+    // Optional cache of compressed files. Files found in it are not compressed again, and files that were compressed
+    // are added to it.
+    const zelda64_compress_cache_t *cache;
+    // Optional receiver of per-file and ROM statistics. When set, the progress lines on stdout are left out.
+    const zelda64_stats_sink_t *stats;
     void *userdata;
 } zelda64_compress_rom_params_t;
 
-zelda64_result_t zelda64_compress_rom(zelda64_compress_rom_params_t params, zelda64_allocator_t allocator);
\ No newline at end of file
+zelda64_result_t zelda64_compress_rom(zelda64_compress_rom_params_t params, zelda64_allocator_t allocator);
+
+/**
+ * Compresses one file the way zelda64_compress_rom() does, so that every mode writes the same stream for a file.
+ * @param compressor The compressor to use for files of at most segment_size bytes, which sets the level.
+ * @param pool The pool to compress the segments of larger files on. May be a pool the caller is running a job on.
+ * @param segment_size Files larger than this are split into segments of this size, see
+ * zelda64_compress_rom_params_t. 0 compresses every file in one piece.
+ * @param data The file to compress.
+ * @param size The size of the file in bytes.
+ * @param dest Buffer for the compressed file, which must hold zelda64_yaz0_compress_bound(size) bytes.
+ * @param dest_size Output parameter holding the size of the compressed file.
+ * @param saved Optional output parameter holding the amount of bytes the lazy or optimal parse saved compared to a
+ * greedy one. Left alone at greedy levels.
+ * @param allocator The allocator for the segments.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_OUT_OF_MEMORY, or the result of the encoder.
+ */
+zelda64_result_t zelda64_compress_file(zelda64_yaz0_compressor_t *compressor, worker_pool_t *pool,
+                                       size_t segment_size, const uint8_t *data, size_t size, uint8_t *dest,
+                                       size_t *dest_size, int64_t *saved, zelda64_allocator_t allocator);
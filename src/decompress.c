@@ -1,7 +1,12 @@
+#include <pthread.h>
+
+#include <zelda64/arena.h>
 #include <zelda64/dma.h>
 #include <zelda64/yaz0.h>
 
+#include "checksum.h"
 #include "decompress.h"
+#include "pool.h"
 
 typedef enum decompressor_action {
     DECOMPRESSOR_ACTION_SKIP = 0,
@@ -19,8 +24,143 @@ static inline decompressor_action_t get_decompressor_action(zelda64_dma_entry_t
     }
 }
 
+typedef struct decompressor_context {
+    const zelda64_decompress_rom_params_t *params;
+    zelda64_allocator_t allocator;
+    const uint8_t *dma_table;
+    uint8_t *dma_out;
+    zelda64_dma_info_t dma_info;
+    // One scratch region per worker, large enough for the largest file.
+    zelda64_arena_t *arenas;
+    zelda64_checksum_fixup_t checksum;
+    // The callbacks are not required to be thread safe, so all calls to them are serialized.
+    pthread_mutex_t io_lock;
+    zelda64_result_t result;
+    double file_seconds;
+} decompressor_context_t;
+
+static void *read_rom_data(decompressor_context_t *context, size_t size, size_t offset) {
+    pthread_mutex_lock(&context->io_lock);
+    void *data = context->params->read_rom_data(size, offset, context->params->userdata);
+    pthread_mutex_unlock(&context->io_lock);
+    return data;
+}
+
+static void close_rom_data(decompressor_context_t *context, void *data, size_t size) {
+    if (context->params->close_rom_data != nullptr) {
+        pthread_mutex_lock(&context->io_lock);
+        context->params->close_rom_data(data, size, context->params->userdata);
+        pthread_mutex_unlock(&context->io_lock);
+    }
+}
+
+static void write_data(decompressor_context_t *context, void *data, size_t size, size_t offset) {
+    pthread_mutex_lock(&context->io_lock);
+    context->params->write_data(data, size, offset, context->params->userdata);
+    zelda64_checksum_fixup_update(&context->checksum, data, size, offset);
+    pthread_mutex_unlock(&context->io_lock);
+}
+
+static void fail(decompressor_context_t *context, zelda64_result_t result) {
+    pthread_mutex_lock(&context->io_lock);
+    context->result = result;
+    pthread_mutex_unlock(&context->io_lock);
+}
+
+static void report_file(decompressor_context_t *context, uint32_t index, decompressor_action_t action,
+                        size_t input_size, size_t output_size, double seconds) {
+    const zelda64_stats_sink_t *stats = context->params->stats;
+    if (stats == nullptr) {
+        return;
+    }
+    static const zelda64_file_action_t actions[] = {
+            [DECOMPRESSOR_ACTION_SKIP] = ZELDA64_FILE_ACTION_SKIPPED,
+            [DECOMPRESSOR_ACTION_COPY] = ZELDA64_FILE_ACTION_COPIED,
+            [DECOMPRESSOR_ACTION_DECOMPRESS] = ZELDA64_FILE_ACTION_DECOMPRESSED,
+    };
+    zelda64_file_stats_t file_stats = {
+            .index = index,
+            .action = actions[action],
+            .input_size = input_size,
+            .output_size = output_size,
+            .seconds = seconds,
+    };
+    pthread_mutex_lock(&context->io_lock);
+    context->file_seconds += seconds;
+    if (stats->file != nullptr) {
+        stats->file(&file_stats, stats->userdata);
+    }
+    pthread_mutex_unlock(&context->io_lock);
+}
+
+static void decompress_job(size_t index, size_t worker, void *userdata) {
+    decompressor_context_t *context = (decompressor_context_t *) userdata;
+    double start = zelda64_stats_now();
+    zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(context->dma_table, context->dma_info.size, index);
+    decompressor_action_t action = get_decompressor_action(entry);
+    size_t size = zelda64_get_file_size(entry);
+    // The padding of the last file may run past the end of the ROM, only request what is actually there.
+    size_t rom_size = context->params->rom_size;
+    if (action != DECOMPRESSOR_ACTION_SKIP && entry.p_start < rom_size && size > rom_size - entry.p_start) {
+        size = rom_size - entry.p_start;
+    }
+    switch (action) {
+        case DECOMPRESSOR_ACTION_SKIP:
+            report_file(context, index, action, 0, 0, 0);
+            return;
+        case DECOMPRESSOR_ACTION_COPY: {
+            if (size > 0) {
+                uint8_t *data = read_rom_data(context, size, entry.p_start);
+                if (data == nullptr) {
+                    fail(context, ZELDA64_ERROR_INVALID_DATA);
+                    return;
+                }
+                write_data(context, data, size, entry.v_start);
+                close_rom_data(context, data, size);
+            }
+            break;
+        }
+        case DECOMPRESSOR_ACTION_DECOMPRESS: {
+            // Too small to even hold a Yaz0 header.
+            uint8_t *data = size >= 16 ? read_rom_data(context, size, entry.p_start) : nullptr;
+            if (data == nullptr) {
+                fail(context, ZELDA64_ERROR_INVALID_DATA);
+                return;
+            }
+            zelda64_yaz0_header_t header = zelda64_get_yaz0_header(data, size);
+            // Files may not write past their own range, that would overlap with other files written in parallel.
+            if (!zelda64_is_valid_yaz0_header(header) || header.uncompressed_size > entry.v_end - entry.v_start) {
+                close_rom_data(context, data, size);
+                fail(context, ZELDA64_ERROR_INVALID_DATA);
+                return;
+            }
+            zelda64_arena_t *arena = &context->arenas[worker];
+            zelda64_arena_reset(arena);
+            uint8_t *out_data = zelda64_arena_push(arena, header.uncompressed_size);
+            if (out_data == nullptr) {
+                close_rom_data(context, data, size);
+                fail(context, ZELDA64_ERROR_OUT_OF_MEMORY);
+                return;
+            }
+            zelda64_result_t result = zelda64_yaz0_decompress_checked(out_data, header.uncompressed_size, data, size);
+            close_rom_data(context, data, size);
+            if (result != ZELDA64_OK) {
+                fail(context, result);
+                return;
+            }
+            write_data(context, out_data, header.uncompressed_size, entry.v_start);
+            break;
+        }
+    }
+    entry.p_start = entry.v_start;
+    entry.p_end = 0;
+    zelda64_set_dma_table_entry(context->dma_out, context->dma_info.size, index, entry);
+    report_file(context, index, action, size, entry.v_end - entry.v_start, zelda64_stats_now() - start);
+}
+
 zelda64_result_t zelda64_decompress_rom(zelda64_decompress_rom_params_t params,
                                                    zelda64_allocator_t allocator) {
+    double start = zelda64_stats_now();
     zelda64_dma_info_t dma_info = {};
     zelda64_find_dma_table_params_t find_dma_table_params = {
             .rom_size = params.rom_size,
@@ -34,51 +174,88 @@ zelda64_result_t zelda64_decompress_rom(zelda64_decompress_rom_params_t params,
     }
     // Now we can read in the entire DMA table with relative ease.
     uint8_t *dma_table = params.read_rom_data(dma_info.size, dma_info.offset, params.userdata);
+    if (dma_table == nullptr) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
     uint8_t *dma_out = allocator.alloc(dma_info.size, sizeof (uint8_t), allocator.userdata);
-    // Pre-allocate the destination.
-    params.reserve(params.rom_size * 2, params.userdata);
+    worker_pool_t *pool = params.pool != nullptr ? params.pool : worker_pool_create(params.thread_count, allocator);
+    // Size the scratch regions to the largest decompressed file, so no file needs an allocation of its own.
+    size_t largest_file = 0;
     for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
         zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(dma_table, dma_info.size, i);
-        decompressor_action_t action = get_decompressor_action(entry);
-        size_t size = zelda64_get_file_size(entry);
-        switch (action) {
-            case DECOMPRESSOR_ACTION_SKIP:
-                continue;
-            case DECOMPRESSOR_ACTION_COPY: {
-                if (size > 0) {
-                    uint8_t *data = params.read_rom_data(size, entry.p_start, params.userdata);
-                    params.write_data(data, size, entry.v_start, params.userdata);
-                    if (params.close_rom_data != nullptr) {
-                        params.close_rom_data(data, size, params.userdata);
-                    }
-                }
-                break;
+        if (get_decompressor_action(entry) == DECOMPRESSOR_ACTION_DECOMPRESS && entry.v_end > entry.v_start &&
+            entry.v_end - entry.v_start > largest_file) {
+            largest_file = entry.v_end - entry.v_start;
+        }
+    }
+    size_t arena_count = pool != nullptr ? worker_pool_size(pool) : 0;
+    zelda64_arena_t *arenas = allocator.alloc(arena_count, sizeof(zelda64_arena_t), allocator.userdata);
+    bool arenas_ready = arenas != nullptr;
+    for (size_t i = 0; arenas_ready && i < arena_count; ++i) {
+        arenas_ready = zelda64_arena_init(&arenas[i], largest_file, allocator) == ZELDA64_OK;
+    }
+    decompressor_context_t context = {
+            .params = &params,
+            .allocator = allocator,
+            .dma_table = dma_table,
+            .dma_out = dma_out,
+            .dma_info = dma_info,
+            .arenas = arenas,
+            .result = ZELDA64_OK,
+    };
+    bool checksum_ready = !params.fix_checksum ||
+                          zelda64_checksum_fixup_init(&context.checksum, allocator) == ZELDA64_OK;
+    if (dma_out == nullptr || pool == nullptr || !arenas_ready || !checksum_ready) {
+        context.result = ZELDA64_ERROR_OUT_OF_MEMORY;
+    } else {
+        // Pre-allocate the destination.
+        params.reserve(params.rom_size * 2, params.userdata);
+        // Files past the reserved space still extend the output, up to the last file in virtual address space.
+        size_t output_size = params.rom_size * 2;
+        for (int_fast32_t i = 0; i < dma_info.entries; ++i) {
+            zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(dma_table, dma_info.size, i);
+            if (get_decompressor_action(entry) != DECOMPRESSOR_ACTION_SKIP && entry.v_end > output_size) {
+                output_size = entry.v_end;
             }
-            case DECOMPRESSOR_ACTION_DECOMPRESS: {
-                uint8_t *data = params.read_rom_data(size, entry.p_start, params.userdata);
-                zelda64_yaz0_header_t header = zelda64_get_yaz0_header(data, size);
-                if (!zelda64_is_valid_yaz0_header(header)) {
-                    if (params.close_rom_data != nullptr) {
-                        params.close_rom_data(data, size, params.userdata);
-                        params.close_rom_data(dma_table, dma_info.size, params.userdata);
-                    }
-                    return ZELDA64_ERROR_INVALID_DATA;
-                }
-                uint8_t *out_data = allocator.alloc(header.uncompressed_size, sizeof(uint8_t), allocator.userdata);
-                zelda64_yaz0_decompress(out_data, header.uncompressed_size, data);
-                params.write_data(out_data, header.uncompressed_size, entry.v_start, params.userdata);
-                allocator.free(data, allocator.userdata);
-                break;
+        }
+        // Every entry knows where it goes in the output, so they can all be decompressed independently.
+        pthread_mutex_init(&context.io_lock, nullptr);
+        worker_pool_run(pool, dma_info.entries, decompress_job, &context);
+        pthread_mutex_destroy(&context.io_lock);
+        if (context.result == ZELDA64_OK) {
+            params.write_data(dma_out, dma_info.size, dma_info.offset, params.userdata);
+            zelda64_checksum_fixup_update(&context.checksum, dma_out, dma_info.size, dma_info.offset);
+            zelda64_checksum_fixup_write(&context.checksum, params.write_data, params.userdata);
+            if (params.finish != nullptr) {
+                context.result = params.finish(params.userdata);
             }
         }
-        entry.p_start = entry.v_start;
-        entry.p_end = 0;
-        zelda64_set_dma_table_entry(dma_out, dma_info.size, i, entry);
+        if (context.result == ZELDA64_OK && params.stats != nullptr && params.stats->rom != nullptr) {
+            zelda64_rom_stats_t stats = {
+                    .files = dma_info.entries,
+                    .input_size = params.rom_size,
+                    .output_size = output_size,
+                    .seconds = zelda64_stats_now() - start,
+                    .file_seconds = context.file_seconds,
+            };
+            params.stats->rom(&stats, params.stats->userdata);
+        }
+    }
+    if (pool != nullptr && pool != params.pool) {
+        worker_pool_destroy(pool);
+    }
+    if (arenas != nullptr) {
+        for (size_t i = 0; i < arena_count; ++i) {
+            zelda64_arena_free(&arenas[i]);
+        }
+        allocator.free(arenas, allocator.userdata);
     }
     if (params.close_rom_data != nullptr) {
         params.close_rom_data(dma_table, dma_info.size, params.userdata);
     }
-    params.write_data(dma_out, dma_info.size, dma_info.offset, params.userdata);
-    allocator.free(dma_out, allocator.userdata);
-    return ZELDA64_OK;
+    if (dma_out != nullptr) {
+        allocator.free(dma_out, allocator.userdata);
+    }
+    zelda64_checksum_fixup_free(&context.checksum);
+    return context.result;
 }
@@ -6,6 +6,9 @@
 #include <zelda64/dma.h>
 #include <zelda64/zelda64.h>
 
+#include "pool.h"
+#include "stats.h"
+
 typedef struct zelda64_decompress_rom_params {
     // Callback function that requests data from the ROM file. This is a required function and must return an uint8_t
     // array of at least `size` bytes long.
@@ -20,6 +23,14 @@ typedef struct zelda64_decompress_rom_params {
     // Write callback function.
     zelda64_write_data_func_t *write_data;
 
+    // Optional callback called once after the last write of a successful run, for example to flush buffered writes.
+    // A result other than ZELDA64_OK fails the run.
+    zelda64_finish_func_t *finish;
+
+    // Recalculates CRC1 and CRC2 in the header of the output from a copy of the checksummed range taken as it is
+    // written, right before finish is called.
+    bool fix_checksum;
+
     // When reading sequentially over the ROM, this is the largest block of data the compressor will request at a
     // time. It is recommended to set this to something large that is a multiple of 16, like 8K or 16K.
     size_t block_size;
@@ -27,6 +38,17 @@ typedef struct zelda64_decompress_rom_params {
     // The size of the ROM in bytes.
     size_t rom_size;
 
+    // The amount of worker threads to decompress files on. When set to 0 all files are decompressed on the calling
+    // thread. Every file is written to its own range of the output. Callbacks are never called concurrently.
+    size_t thread_count;
+
+    // Optional pool to run on instead of one made for this run, so that several runs can share their threads. When set,
+    // thread_count is ignored.
+    worker_pool_t *pool;
+
+    // Optional receiver of per-file and ROM statistics.
+    const zelda64_stats_sink_t *stats;
+
     // Pointer to user data that will be passed in to any callback functions.
     void *userdata;
 } zelda64_decompress_rom_params_t;
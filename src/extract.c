@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <zelda64/arena.h>
+#include <zelda64/crc32.h>
+#include <zelda64/dma.h>
+
+#include "extract.h"
+#include "pool.h"
+
+typedef struct extract_context {
+    const zelda64_extract_rom_params_t *params;
+    zelda64_manifest_t *manifest;
+    // One scratch region per worker, large enough for the largest compressed file.
+    zelda64_arena_t *arenas;
+    pthread_mutex_t lock;
+    zelda64_result_t result;
+} extract_context_t;
+
+static void fail(extract_context_t *context, zelda64_result_t result) {
+    pthread_mutex_lock(&context->lock);
+    context->result = result;
+    pthread_mutex_unlock(&context->lock);
+}
+
+static bool write_file(const char *directory, uint32_t index, const char *extension, const uint8_t *data,
+                       size_t size) {
+    char path[ZELDA64_MANIFEST_PATH_MAX];
+    if (!zelda64_manifest_file_path(path, directory, index, extension)) {
+        return false;
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(data, sizeof(uint8_t), size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+static void extract_job(size_t job, size_t worker, void *userdata) {
+    extract_context_t *context = (extract_context_t *) userdata;
+    const zelda64_extract_rom_params_t *params = context->params;
+    uint32_t index = (uint32_t) job;
+    zelda64_manifest_file_t *file = &context->manifest->files[index];
+    if (file->kind == ZELDA64_FILE_EMPTY) {
+        return;
+    }
+    const uint8_t *stored = nullptr;
+    size_t stored_size = 0;
+    if (zelda64_rom_get_file_data(params->rom, index, &stored, &stored_size) != ZELDA64_OK) {
+        fail(context, ZELDA64_ERROR_INVALID_DATA);
+        return;
+    }
+    size_t size = file->entry.v_end - file->entry.v_start;
+    const uint8_t *data = stored;
+    if (file->kind == ZELDA64_FILE_COMPRESSED) {
+        zelda64_arena_t *arena = &context->arenas[worker];
+        zelda64_arena_reset(arena);
+        uint8_t *buffer = zelda64_arena_push(arena, size);
+        if (buffer == nullptr || zelda64_rom_read_file(params->rom, index, buffer, size) != ZELDA64_OK) {
+            fail(context, ZELDA64_ERROR_INVALID_DATA);
+            return;
+        }
+        data = buffer;
+        // Packing reuses the blob as long as the file stays the same.
+        if (!write_file(params->directory, index, "yaz0", stored, stored_size)) {
+            fail(context, ZELDA64_ERROR_IO);
+            return;
+        }
+    } else if (stored_size != size) {
+        fail(context, ZELDA64_ERROR_INVALID_DATA);
+        return;
+    }
+    file->crc = zelda64_crc32_update(0, data, size);
+    if (!write_file(params->directory, index, "bin", data, size)) {
+        fail(context, ZELDA64_ERROR_IO);
+    }
+}
+
+zelda64_result_t zelda64_extract_rom(zelda64_extract_rom_params_t params, zelda64_allocator_t allocator) {
+    assert(params.rom != nullptr);
+    assert(params.directory != nullptr);
+    const zelda64_rom_t *rom = params.rom;
+    zelda64_manifest_t manifest;
+    zelda64_result_t result = zelda64_manifest_init(&manifest, rom->dma_info, allocator);
+    if (result != ZELDA64_OK) {
+        return result;
+    }
+    size_t largest_file = 0;
+    for (uint32_t i = 0; i < rom->dma_info.entries; ++i) {
+        zelda64_manifest_file_t *file = &manifest.files[i];
+        zelda64_rom_get_file_entry(rom, i, &file->entry);
+        // Entries without a virtual range hold no file, whatever their physical addresses say.
+        if (zelda64_is_empty_file(file->entry) || file->entry.v_start >= file->entry.v_end) {
+            file->kind = ZELDA64_FILE_EMPTY;
+        } else if (zelda64_is_compressed_file(file->entry)) {
+            file->kind = ZELDA64_FILE_COMPRESSED;
+            if (file->entry.v_end - file->entry.v_start > largest_file) {
+                largest_file = file->entry.v_end - file->entry.v_start;
+            }
+        } else {
+            file->kind = ZELDA64_FILE_UNCOMPRESSED;
+        }
+    }
+    worker_pool_t *pool = worker_pool_create(params.thread_count, allocator);
+    size_t arena_count = pool != nullptr ? worker_pool_size(pool) : 0;
+    zelda64_arena_t *arenas = allocator.alloc(arena_count, sizeof(zelda64_arena_t), allocator.userdata);
+    bool arenas_ready = arenas != nullptr;
+    for (size_t i = 0; arenas_ready && i < arena_count; ++i) {
+        arenas_ready = zelda64_arena_init(&arenas[i], largest_file, allocator) == ZELDA64_OK;
+    }
+    extract_context_t context = {
+            .params = &params,
+            .manifest = &manifest,
+            .arenas = arenas,
+            .result = ZELDA64_OK,
+    };
+    if (pool == nullptr || !arenas_ready) {
+        context.result = ZELDA64_ERROR_OUT_OF_MEMORY;
+    } else {
+        // Every file goes to its own path, so they can all be written independently.
+        pthread_mutex_init(&context.lock, nullptr);
+        worker_pool_run(pool, rom->dma_info.entries, extract_job, &context);
+        pthread_mutex_destroy(&context.lock);
+    }
+    // The manifest goes last, a directory without one was not extracted completely.
+    char path[ZELDA64_MANIFEST_PATH_MAX];
+    int length = snprintf(path, sizeof path, "%s/%s", params.directory, ZELDA64_MANIFEST_NAME);
+    if (context.result == ZELDA64_OK) {
+        FILE *stream = length > 0 && length < (int) sizeof path ? fopen(path, "w") : nullptr;
+        bool written = stream != nullptr && zelda64_manifest_write(&manifest, stream);
+        if (stream != nullptr) {
+            written = fclose(stream) == 0 && written;
+        }
+        context.result = written ? ZELDA64_OK : ZELDA64_ERROR_IO;
+    }
+    if (pool != nullptr) {
+        worker_pool_destroy(pool);
+    }
+    if (arenas != nullptr) {
+        for (size_t i = 0; i < arena_count; ++i) {
+            zelda64_arena_free(&arenas[i]);
+        }
+        allocator.free(arenas, allocator.userdata);
+    }
+    zelda64_manifest_free(&manifest);
+    return context.result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <zelda64/rom.h>
+#include <zelda64/zelda64.h>
+
+#include "manifest.h"
+
+typedef struct zelda64_extract_rom_params {
+    // The ROM to extract, compressed or decompressed.
+    const zelda64_rom_t *rom;
+    // The directory to write the files and the manifest to, which must exist.
+    const char *directory;
+    // The amount of worker threads to extract files on. When set to 0 all files are extracted on the calling thread.
+    size_t thread_count;
+} zelda64_extract_rom_params_t;
+
+/**
+ * Decompresses every file of a ROM into a directory, one file per DMA entry, and writes a manifest describing them.
+ * Compressed files also keep their Yaz0 blob, so that packing the directory again only compresses what was changed.
+ * @param params Struct with parameters to the function.
+ * @param allocator The allocator used for the worker pool and the scratch buffers.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if a file is missing from the ROM or does not decompress,
+ * ZELDA64_ERROR_IO if a file could not be written, or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_extract_rom(zelda64_extract_rom_params_t params, zelda64_allocator_t allocator);
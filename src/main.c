@@ -1,32 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zelda64/yaz0.h>
 
+#include "async_writer.h"
 #include "compress.h"
 #include "decompress.h"
+#include "extract.h"
+#include "mapped_io.h"
+#include "pack.h"
+#include "patch.h"
+#include "report.h"
+#include "stats.h"
+#include "verify.h"
 
 #define ZELDA64_DEFAULT_OUTFILE "out.z64"
+#define ZELDA64_DEFAULT_OUTDIR "."
+#define ZELDA64_DEFAULT_BATCH_ROMS 2
+#define ZELDA64_DEFAULT_MIN_GAIN 3
+// Files larger than 128 KB are compressed in parallel segments. Every mode uses the same size, so a file compresses
+// the same and shares its cache entry whichever mode compressed it.
+#define ZELDA64_SEGMENT_SIZE (1024 * 128)
+// More threads than this is certainly a typo.
+#define ZELDA64_MAX_THREADS 1024
+#define ZELDA64_MAX_BATCH_ROMS 1024
+
+// Files Ocarina of Time reads straight from the cartridge, so they must stay uncompressed whether they would shrink
+// or not: the boot files, the DMA table, the audio data and the like.
+static uint32_t oot_exclusion_list[] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
+        942, 944, 946, 948, 950, 952, 954, 956, 958, 960, 962, 964, 966, 968, 970, 972, 974, 976, 978, 980,
+        982, 984, 986, 988, 990, 992, 994, 996, 998, 1000, 1002, 1004,
+        1497, 1498, 1499, 1500, 1501, 1502, 1503, 1504, 1505, 1506, 1507, 1508, 1509, 1510, 1511, 1512, 1513,
+        1514, 1515, 1516, 1517, 1518, 1519, 1520, 1521, 1522, 1523, 1524, 1525,
+};
 
 typedef struct zelda64_file_read_writer {
     FILE *in_file;
+    // Output goes through the asynchronous writer where the platform supports it, and through out_file otherwise.
+    async_writer_t *writer;
     FILE *out_file;
 } zelda64_file_read_writer_t;
 
 zelda64_file_read_writer_t
 zelda64_file_read_writer_open(const char *restrict in_filename, const char *restrict out_filename) {
     FILE *in_file = fopen(in_filename, "rb");
-    FILE *out_file = fopen(out_filename, "wb");
+    // Leave the output alone when there is nothing to write to it.
+    async_writer_t *writer = in_file != nullptr ? async_writer_open(out_filename, zelda64_default_allocator()) : nullptr;
+    FILE *out_file = in_file != nullptr && writer == nullptr ? fopen(out_filename, "wb") : nullptr;
     return (zelda64_file_read_writer_t) {
             .in_file = in_file,
+            .writer = writer,
             .out_file = out_file,
     };
 }
 
 void zelda64_file_read_writer_close(zelda64_file_read_writer_t read_writer) {
-    fclose(read_writer.in_file);
-    fclose(read_writer.out_file);
+    if (read_writer.in_file != nullptr) {
+        fclose(read_writer.in_file);
+    }
+    if (read_writer.writer != nullptr) {
+        async_writer_close(read_writer.writer);
+    }
+    if (read_writer.out_file != nullptr) {
+        fclose(read_writer.out_file);
+    }
 }
 
 void *file_read_rom_data(size_t size, size_t offset, void *userdata) {
@@ -50,17 +99,61 @@ void file_close_rom_data(void *data, size_t size, void *userdata) {
 
 void file_reserve_space(size_t size, void *userdata) {
     zelda64_file_read_writer_t *read_writer = (zelda64_file_read_writer_t *) userdata;
+    if (read_writer->writer != nullptr) {
+        async_writer_reserve(read_writer->writer, size);
+        return;
+    }
     fseek(read_writer->out_file, 0, SEEK_SET);
-    char nothing = '\0';
-    fwrite(&nothing, sizeof(char), size, read_writer->out_file);
+    static const uint8_t nothing[1024 * 16] = {};
+    while (size > 0) {
+        size_t block = size < sizeof nothing ? size : sizeof nothing;
+        fwrite(nothing, sizeof(uint8_t), block, read_writer->out_file);
+        size -= block;
+    }
 }
 
 void file_write_out(void *data, size_t size, size_t offset, void *userdata) {
     zelda64_file_read_writer_t *read_writer = (zelda64_file_read_writer_t *) userdata;
+    if (read_writer->writer != nullptr) {
+        async_writer_write(read_writer->writer, data, size, offset);
+        return;
+    }
     fseek(read_writer->out_file, (long) offset, SEEK_SET);
     fwrite(data, sizeof(uint8_t), size, read_writer->out_file);
 }
 
+zelda64_result_t file_finish(void *userdata) {
+    zelda64_file_read_writer_t *read_writer = (zelda64_file_read_writer_t *) userdata;
+    bool flushed = read_writer->writer != nullptr
+                   ? async_writer_flush(read_writer->writer)
+                   : fflush(read_writer->out_file) == 0 && !ferror(read_writer->out_file);
+    return flushed ? ZELDA64_OK : ZELDA64_ERROR_IO;
+}
+
+size_t file_size(zelda64_file_read_writer_t *read_writer) {
+    fseek(read_writer->in_file, 0, SEEK_END);
+    long filesize = ftell(read_writer->in_file);
+    return filesize > 0 ? (size_t) filesize : 0;
+}
+
+uint8_t *read_whole_file(const char *filename, size_t *size) {
+    FILE *file = fopen(filename, "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    fseek(file, 0, SEEK_END);
+    long filesize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = filesize > 0 ? malloc(filesize) : nullptr;
+    if (data != nullptr && fread(data, sizeof(uint8_t), filesize, file) != (size_t) filesize) {
+        free(data);
+        data = nullptr;
+    }
+    fclose(file);
+    *size = filesize > 0 ? (size_t) filesize : 0;
+    return data;
+}
+
 zelda64_decompress_rom_params_t decompress_params_from_file_read_writer(zelda64_file_read_writer_t *read_writer) {
     fseek(read_writer->in_file, 0, SEEK_SET);
     fseek(read_writer->in_file, 0, SEEK_END);
@@ -70,6 +163,7 @@ zelda64_decompress_rom_params_t decompress_params_from_file_read_writer(zelda64_
             .close_rom_data = file_close_rom_data,
             .reserve = file_reserve_space,
             .write_data = file_write_out,
+            .finish = file_finish,
             .block_size = 1024 * 16,
             .rom_size = filesize,
             .userdata = read_writer,
@@ -84,31 +178,79 @@ zelda64_compress_rom_params_t compress_params_from_file_read_writer(zelda64_file
             .read_rom_data = file_read_rom_data,
             .close_rom_data = file_close_rom_data,
             .write_data = file_write_out,
+            .finish = file_finish,
             .block_size = 1024 * 16,
             .rom_size = filesize,
             .userdata = read_writer,
     };
 }
 
+zelda64_decompress_rom_params_t decompress_params_from_mapped_read_writer(zelda64_mapped_read_writer_t *read_writer) {
+    return (zelda64_decompress_rom_params_t) {
+            .read_rom_data = mapped_read_rom_data,
+            .close_rom_data = mapped_close_rom_data,
+            .reserve = mapped_reserve_space,
+            .write_data = mapped_write_out,
+            .block_size = 1024 * 16,
+            .rom_size = read_writer->in_size,
+            .userdata = read_writer,
+    };
+}
+
+zelda64_compress_rom_params_t compress_params_from_mapped_read_writer(zelda64_mapped_read_writer_t *read_writer) {
+    return (zelda64_compress_rom_params_t) {
+            .read_rom_data = mapped_read_rom_data,
+            .close_rom_data = mapped_close_rom_data,
+            .reserve = mapped_reserve_space,
+            .write_data = mapped_write_out,
+            .block_size = 1024 * 16,
+            .rom_size = read_writer->in_size,
+            .userdata = read_writer,
+    };
+}
+
 enum operation_mode {
     ZELDA64_MODE_NONE = 0,
     ZELDA64_MODE_COMPRESS = 1,
     ZELDA64_MODE_DECOMPRESS = 2,
     ZELDA64_MODE_PATCH = 4,
+    ZELDA64_MODE_EXTRACT = 8,
+    ZELDA64_MODE_PACK = 16,
 };
 
 typedef struct zelda64_options {
     const char *in_filename;
     const char *out_filename;
     const char *patch_filename;
+    const char *cache_directory;
+    // Files to store uncompressed: "oot", "none" or a list of DMA indices. Defaults to "oot".
+    const char *exclusion_list;
     enum operation_mode mode;
+    size_t thread_count;
+    // The amount of ROMs a batch works on at the same time.
+    size_t batch_roms;
+    int level;
+    // Files predicted to shrink by less than this many percent are stored uncompressed.
+    int min_gain;
+    // Treats the input as a directory or a list of ROMs, and the output as the directory to write them to.
+    bool batch;
     bool show_help;
     bool show_version;
+    // Writes statistics as JSON to stdout instead of progress lines.
+    bool report_json;
+    // Checks that the compressed ROM decompresses back to the decompressed one, after compressing or decompressing
+    // or on its own.
+    bool verify;
 } zelda64_options_t;
 
 void print_usage(FILE *stream) {
     assert(stream != NULL);
-    fprintf(stream, "Usage: zelda64 [-hvcx] [-p patch_file] file [out_file]\n");
+    fprintf(stream, "Usage: zelda64 [-hvcx] [-j threads] [-l level] [-e list] [-g percent] [-C cache_dir] [-p patch_file] [--report=json] [--verify] "
+                    "file [out_file]\n");
+    fprintf(stream, "       zelda64 --verify [-j threads] decompressed_file compressed_file\n");
+    fprintf(stream, "       zelda64 --extract [-j threads] file out_dir\n");
+    fprintf(stream, "       zelda64 --pack [-j threads] [-l level] [-C cache_dir] dir [out_file]\n");
+    fprintf(stream, "       zelda64 -b [-cx] [-j threads] [-m roms] [-l level] [-e list] [-g percent] [-C cache_dir] dir_or_list [out_dir]\n");
 }
 
 void print_version(void) {
@@ -123,11 +265,56 @@ void print_help() {
     printf("\t-v\n\t\tDisplay version information.\n");
     printf("\t-c\n\t\tCompresses Nintendo 64 Zelda ROM file.\n");
     printf("\t-x\n\t\tDecompresses Nintendo 64 Zelda ROM file.\n");
+    printf("\t-j <threads>\n\t\tAmount of worker threads to use, defaults to the amount of processors.\n");
+    printf("\t-l <level>\n\t\tCompression level from 0 to %d, defaults to %d. Levels 1-3 are fast, 4-8 are normal,\n"
+           "\t\t%d is lazy matching and %d is an optimal parse. Both search every position of a file and run\n"
+           "\t\tabout ten times slower than %d.\n",
+           ZELDA64_YAZ0_MAX_LEVEL, ZELDA64_YAZ0_GREEDY_LEVEL, ZELDA64_YAZ0_LAZY_LEVEL, ZELDA64_YAZ0_OPTIMAL_LEVEL,
+           ZELDA64_YAZ0_GREEDY_LEVEL);
+    printf("\t-e <list>\n\t\tFiles to store uncompressed: oot for the files Ocarina of Time reads without\n"
+           "\t\tdecompressing them, none, or DMA indices and ranges like 0-9,15,20-26. Defaults to oot.\n");
+    printf("\t-g <percent>\n\t\tFiles predicted to shrink by less than this are stored uncompressed, defaults to\n"
+           "\t\t%d. 0 compresses every file that is not excluded.\n", ZELDA64_DEFAULT_MIN_GAIN);
+    printf("\t-C <cache_dir>\n\t\tKeeps compressed files in a cache directory and reuses them when compressing\n"
+           "\t\tthe same file at the same level again.\n");
     printf("\t-p=<patch_file>\n\t\tPatches a Nintendo 64 Zelda ROM with a ZPF patch file.\n");
+    printf("\t-b\n\t\tBatch mode, compresses or decompresses every ROM in a directory or listed in a file, one\n"
+           "\t\tpath per line, into an output directory. All ROMs share the worker threads, and a ROM that\n"
+           "\t\tfails does not stop the others.\n");
+    printf("\t-m <roms>\n\t\tAmount of ROMs a batch works on at the same time, defaults to %d. Peak memory use grows\n"
+           "\t\twith it.\n", ZELDA64_DEFAULT_BATCH_ROMS);
+    printf("\t--report=json\n\t\tWrites per-file and total statistics of compression, decompression, patching or\n"
+           "\t\tpacking to stdout as JSON, progress is left out.\n");
+    printf("\t--verify\n\t\tChecks that every file of the compressed ROM decompresses to the same file in the\n"
+           "\t\tdecompressed ROM, after -c or -x or on its own. Nothing is written to disk.\n");
+    printf("\t--extract\n\t\tDecompresses every file of a ROM into a directory as NNNN.bin, named after its DMA\n"
+           "\t\tindex, and writes a manifest.txt describing them.\n");
+    printf("\t--pack\n\t\tBuilds a ROM from an extracted directory. Only files changed since they were extracted\n"
+           "\t\tare compressed again. Edit the kind of a file in the manifest to compress or store it.\n");
+}
+
+/**
+ * Parses a decimal number argument in full.
+ * @param text The argument.
+ * @param min The smallest value allowed.
+ * @param max The largest value allowed.
+ * @param value Output parameter holding the number.
+ * @return true on success, false if the argument is not a number or out of range.
+ */
+static bool parse_number(const char *text, long min, long max, long *value) {
+    char *end = nullptr;
+    errno = 0;
+    long number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || number < min || number > max) {
+        return false;
+    }
+    *value = number;
+    return true;
 }
 
 void parse_command_line_opts(zelda64_options_t *opts, int argc, const char *const *argv) {
     assert(opts != NULL);
+    long number = 0;
     for (int i = 1; i < argc; i++) {
         const char *arg = argv[i];
         if (strlen(arg) == 2 && arg[0] == '-') {
@@ -144,6 +331,57 @@ void parse_command_line_opts(zelda64_options_t *opts, int argc, const char *cons
                 case 'x':
                     opts->mode = ZELDA64_MODE_DECOMPRESS;
                     break;
+                case 'b':
+                    opts->batch = true;
+                    break;
+                case 'm':
+                    if (i + 1 < argc && parse_number(argv[++i], 1, ZELDA64_MAX_BATCH_ROMS, &number)) {
+                        opts->batch_roms = (size_t) number;
+                    } else {
+                        print_usage(stderr);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'j':
+                    if (i + 1 < argc && parse_number(argv[++i], 0, ZELDA64_MAX_THREADS, &number)) {
+                        opts->thread_count = (size_t) number;
+                    } else {
+                        print_usage(stderr);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'l':
+                    if (i + 1 < argc) {
+                        opts->level = (int) strtol(argv[++i], nullptr, 10);
+                    } else {
+                        print_usage(stderr);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'e':
+                    if (i + 1 < argc) {
+                        opts->exclusion_list = argv[++i];
+                    } else {
+                        print_usage(stderr);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'g':
+                    if (i + 1 < argc && parse_number(argv[++i], 0, 99, &number)) {
+                        opts->min_gain = (int) number;
+                    } else {
+                        print_usage(stderr);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'C':
+                    if (i + 1 < argc) {
+                        opts->cache_directory = argv[++i];
+                    } else {
+                        print_usage(stderr);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
                 case 'p':
                     opts->mode = ZELDA64_MODE_PATCH;
                     if (i + 1 < argc) {
@@ -157,6 +395,18 @@ void parse_command_line_opts(zelda64_options_t *opts, int argc, const char *cons
                     print_usage(stderr);
                     exit(EXIT_FAILURE);
             }
+        } else if (strncmp(arg, "--report=", strlen("--report=")) == 0) {
+            if (strcmp(arg + strlen("--report="), "json") != 0) {
+                print_usage(stderr);
+                exit(EXIT_FAILURE);
+            }
+            opts->report_json = true;
+        } else if (strcmp(arg, "--verify") == 0) {
+            opts->verify = true;
+        } else if (strcmp(arg, "--extract") == 0) {
+            opts->mode = ZELDA64_MODE_EXTRACT;
+        } else if (strcmp(arg, "--pack") == 0) {
+            opts->mode = ZELDA64_MODE_PACK;
         } else {
             if (opts->in_filename == NULL) {
                 opts->in_filename = arg;
@@ -168,16 +418,567 @@ void parse_command_line_opts(zelda64_options_t *opts, int argc, const char *cons
             }
         }
     }
+    // Extracting writes a file per DMA entry, which should not end up in the working directory by accident.
+    if (opts->mode == ZELDA64_MODE_EXTRACT && opts->out_filename == NULL) {
+        print_usage(stderr);
+        exit(EXIT_FAILURE);
+    }
     if (opts->out_filename == NULL) {
-        opts->out_filename = ZELDA64_DEFAULT_OUTFILE;
+        opts->out_filename = opts->batch ? ZELDA64_DEFAULT_OUTDIR : ZELDA64_DEFAULT_OUTFILE;
     }
-    if (opts->mode == ZELDA64_MODE_NONE) {
+    // On its own, verification compares the two files it is given.
+    if (opts->mode == ZELDA64_MODE_NONE && !opts->verify) {
         opts->mode = ZELDA64_MODE_DECOMPRESS;
     }
+    if ((opts->report_json && opts->mode == ZELDA64_MODE_EXTRACT) ||
+        (opts->verify && (opts->batch || opts->mode >= ZELDA64_MODE_PATCH))) {
+        print_usage(stderr);
+        exit(EXIT_FAILURE);
+    }
+    // Batches compress or decompress, and report per ROM instead of per file.
+    if (opts->batch && (opts->mode >= ZELDA64_MODE_PATCH || opts->report_json)) {
+        print_usage(stderr);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static size_t get_processor_count(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0) {
+        return (size_t) count;
+    }
+#endif
+    return 1;
+}
+
+// Parses a list of DMA indices and ranges of them, like "0-9,15,20-26".
+static uint32_t *parse_index_list(const char *text, size_t *count) {
+    uint32_t *list = nullptr;
+    size_t capacity = 0;
+    *count = 0;
+    const char *cursor = text;
+    while (*cursor != '\0') {
+        char *end = nullptr;
+        unsigned long first = strtoul(cursor, &end, 10);
+        unsigned long last = first;
+        if (end != cursor && *end == '-') {
+            cursor = end + 1;
+            last = strtoul(cursor, &end, 10);
+        }
+        // A DMA table can not have more entries than this.
+        if (end == cursor || last < first || last > 0xFFFF || (*end != ',' && *end != '\0')) {
+            free(list);
+            return nullptr;
+        }
+        for (unsigned long index = first; index <= last; ++index) {
+            if (*count == capacity) {
+                capacity = capacity > 0 ? capacity * 2 : 64;
+                uint32_t *new_list = realloc(list, capacity * sizeof(uint32_t));
+                if (new_list == nullptr) {
+                    free(list);
+                    return nullptr;
+                }
+                list = new_list;
+            }
+            list[(*count)++] = (uint32_t) index;
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    if (*count == 0) {
+        free(list);
+        return nullptr;
+    }
+    return list;
+}
+
+static void print_mismatch(const zelda64_verify_mismatch_t *mismatch, void *userdata) {
+    FILE *log = (FILE *) userdata;
+    switch (mismatch->failure) {
+        case ZELDA64_VERIFY_FAILURE_ENTRY:
+            fprintf(log, "file %u: DMA entry does not match\n", mismatch->index);
+            break;
+        case ZELDA64_VERIFY_FAILURE_CORRUPT:
+            fprintf(log, "file %u: could not be decompressed\n", mismatch->index);
+            break;
+        case ZELDA64_VERIFY_FAILURE_CONTENTS:
+            fprintf(log, "file %u: CRC-32 %08x of %zu bytes, expected %08x of %zu bytes\n", mismatch->index,
+                    mismatch->actual_crc, mismatch->actual_size, mismatch->expected_crc, mismatch->expected_size);
+            break;
+    }
+}
+
+/**
+ * Checks that every file of a compressed ROM decompresses to the same file in a decompressed ROM.
+ * @param source_filename The decompressed ROM.
+ * @param rom_filename The compressed ROM.
+ * @param thread_count The amount of worker threads to check files on.
+ * @param log Where to print mismatches and the result to.
+ * @return true if every file matches.
+ */
+static bool verify_files(const char *source_filename, const char *rom_filename, size_t thread_count, FILE *log) {
+    size_t source_size = 0;
+    size_t rom_size = 0;
+    uint8_t *source_data = read_whole_file(source_filename, &source_size);
+    uint8_t *rom_data = read_whole_file(rom_filename, &rom_size);
+    zelda64_rom_t source;
+    zelda64_rom_t rom;
+    bool success = false;
+    if (source_data == nullptr || zelda64_rom_open(&source, source_data, source_size) != ZELDA64_OK) {
+        fprintf(stderr, "could not read %s\n", source_filename);
+    } else if (rom_data == nullptr || zelda64_rom_open(&rom, rom_data, rom_size) != ZELDA64_OK) {
+        fprintf(stderr, "could not read %s\n", rom_filename);
+    } else {
+        zelda64_verify_rom_params_t params = {
+                .source = &source,
+                .rom = &rom,
+                .thread_count = thread_count,
+                .mismatch = print_mismatch,
+                .userdata = log,
+        };
+        double start = zelda64_stats_now();
+        zelda64_result_t result = zelda64_verify_rom(params, zelda64_default_allocator());
+        double time_spent = zelda64_stats_now() - start;
+        success = result == ZELDA64_OK;
+        if (success) {
+            fprintf(log, "Verified %u files in %.3f s\n", rom.dma_info.entries, time_spent);
+        } else if (source.dma_info.entries != rom.dma_info.entries) {
+            fprintf(stderr, "%s has %u files, but %s has %u\n", rom_filename, rom.dma_info.entries, source_filename,
+                    source.dma_info.entries);
+        } else {
+            fprintf(stderr, "verification of %s failed\n", rom_filename);
+        }
+    }
+    free(source_data);
+    free(rom_data);
+    return success;
+}
+
+/**
+ * Decompresses every file of a ROM into a directory, creating the directory if needed.
+ * @param in_filename The ROM to extract.
+ * @param directory The directory to extract to.
+ * @param thread_count The amount of worker threads to extract files on.
+ * @return true on success.
+ */
+static bool extract_file(const char *in_filename, const char *directory, size_t thread_count) {
+    size_t rom_size = 0;
+    uint8_t *rom_data = read_whole_file(in_filename, &rom_size);
+    zelda64_rom_t rom;
+    bool success = false;
+    if (rom_data == nullptr || zelda64_rom_open(&rom, rom_data, rom_size) != ZELDA64_OK) {
+        fprintf(stderr, "could not read %s\n", in_filename);
+    } else if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "could not create directory %s\n", directory);
+    } else {
+        zelda64_extract_rom_params_t params = {
+                .rom = &rom,
+                .directory = directory,
+                .thread_count = thread_count,
+        };
+        double start = zelda64_stats_now();
+        zelda64_result_t result = zelda64_extract_rom(params, zelda64_default_allocator());
+        success = result == ZELDA64_OK;
+        if (success) {
+            printf("Extracted %u files in %.3f s\n", rom.dma_info.entries, zelda64_stats_now() - start);
+        } else {
+            fprintf(stderr, "could not extract %s to %s\n", in_filename, directory);
+        }
+    }
+    free(rom_data);
+    return success;
+}
+
+/**
+ * Builds a ROM from an extracted directory.
+ * @param directory The extracted directory.
+ * @param out_filename The ROM to write.
+ * @param opts The options holding the threads and the compression level.
+ * @param cache Optional cache of compressed files.
+ * @return true on success.
+ */
+static bool pack_file(const char *directory, const char *out_filename, const zelda64_options_t *opts,
+                      const zelda64_compress_cache_t *cache) {
+    // There is no input file, only the output goes through the file read writer.
+    zelda64_file_read_writer_t read_writer = {
+            .writer = async_writer_open(out_filename, zelda64_default_allocator()),
+    };
+    if (read_writer.writer == nullptr) {
+        read_writer.out_file = fopen(out_filename, "wb");
+    }
+    if (read_writer.writer == nullptr && read_writer.out_file == nullptr) {
+        fprintf(stderr, "could not open %s\n", out_filename);
+        return false;
+    }
+    zelda64_report_t report;
+    zelda64_report_init(&report, zelda64_default_allocator());
+    zelda64_stats_sink_t sink = zelda64_report_sink(&report);
+    zelda64_pack_rom_params_t params = {
+            .directory = directory,
+            .reserve = file_reserve_space,
+            .write_data = file_write_out,
+            .finish = file_finish,
+            .fix_checksum = true,
+            .thread_count = opts->thread_count,
+            .level = opts->level,
+            .segment_size = ZELDA64_SEGMENT_SIZE,
+            .cache = cache,
+            .stats = opts->report_json ? &sink : nullptr,
+            .userdata = &read_writer,
+    };
+    double start = zelda64_stats_now();
+    zelda64_result_t result = zelda64_pack_rom(params, zelda64_default_allocator());
+    zelda64_file_read_writer_close(read_writer);
+    if (result != ZELDA64_OK) {
+        fprintf(stderr, "could not pack %s\n", directory);
+    } else {
+        // With a report on stdout, everything else goes to stderr.
+        fprintf(opts->report_json ? stderr : stdout, "Packing finished in %.1f s\n", zelda64_stats_now() - start);
+        if (opts->report_json) {
+            zelda64_report_write_json(&report, stdout, "pack", opts->level);
+        }
+    }
+    zelda64_report_free(&report);
+    return result == ZELDA64_OK;
+}
+
+// Gives a ROM whose run failed a reason to print.
+static const char *describe_result(zelda64_result_t result) {
+    switch (result) {
+        case ZELDA64_OK:
+            return "success";
+        case ZELDA64_ERROR_INVALID_DATA:
+            return "not a valid ROM";
+        case ZELDA64_ERROR_OUT_OF_MEMORY:
+            return "out of memory";
+        case ZELDA64_ERROR_BUFFER_TOO_SMALL:
+            return "buffer too small";
+        case ZELDA64_ERROR_IO:
+            return "could not write the output";
+    }
+    return "unknown error";
+}
+
+static char *join_path(const char *directory, const char *name) {
+    size_t size = strlen(directory) + strlen(name) + 2;
+    char *path = malloc(size);
+    if (path != nullptr) {
+        snprintf(path, size, "%s/%s", directory, name);
+    }
+    return path;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Adds a path to a growing array of paths, taking ownership of it.
+static bool append_path(char ***paths, size_t *count, size_t *capacity, char *path) {
+    if (path == nullptr) {
+        return false;
+    }
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+        char **new_paths = realloc(*paths, new_capacity * sizeof(char *));
+        if (new_paths == nullptr) {
+            free(path);
+            return false;
+        }
+        *paths = new_paths;
+        *capacity = new_capacity;
+    }
+    (*paths)[(*count)++] = path;
+    return true;
+}
+
+static void free_paths(char **paths, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+// Lists the ROMs of a batch: the regular files in a directory sorted by name, or the lines of a list file.
+static char **collect_batch_inputs(const char *path, size_t *count) {
+    *count = 0;
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return nullptr;
+    }
+    char **paths = nullptr;
+    size_t capacity = 0;
+    bool success = true;
+    if (S_ISDIR(st.st_mode)) {
+        DIR *directory = opendir(path);
+        if (directory == nullptr) {
+            return nullptr;
+        }
+        for (struct dirent *entry = readdir(directory); success && entry != nullptr; entry = readdir(directory)) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            char *file_path = join_path(path, entry->d_name);
+            struct stat file_st;
+            if (file_path != nullptr && stat(file_path, &file_st) == 0 && S_ISREG(file_st.st_mode)) {
+                success = append_path(&paths, count, &capacity, file_path);
+            } else {
+                free(file_path);
+            }
+        }
+        closedir(directory);
+        if (*count > 0) {
+            qsort(paths, *count, sizeof(char *), compare_paths);
+        }
+    } else {
+        FILE *list = fopen(path, "r");
+        if (list == nullptr) {
+            return nullptr;
+        }
+        char line[4096];
+        while (success && fgets(line, sizeof line, list) != nullptr) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] != '\0') {
+                success = append_path(&paths, count, &capacity, strdup(line));
+            }
+        }
+        fclose(list);
+    }
+    if (!success) {
+        free_paths(paths, *count);
+        *count = 0;
+        return nullptr;
+    }
+    return paths;
+}
+
+typedef struct batch_params {
+    const zelda64_options_t *opts;
+    uint32_t *exclusion_list;
+    size_t exclusion_list_size;
+    const zelda64_compress_cache_t *cache;
+} batch_params_t;
+
+typedef struct batch_rom {
+    const char *in_filename;
+    char *out_filename;
+    // Whether the output was there before the batch, such a file is never removed when the ROM fails.
+    bool out_existed;
+    zelda64_result_t result;
+    bool opened;
+    zelda64_rom_stats_t stats;
+} batch_rom_t;
+
+typedef struct batch_context {
+    const batch_params_t *params;
+    worker_pool_t *pool;
+    batch_rom_t *roms;
+    size_t rom_count;
+    // Index of the next ROM nobody has started on yet.
+    atomic_size_t next_rom;
+    pthread_mutex_t log_lock;
+} batch_context_t;
+
+static void batch_rom_stats(const zelda64_rom_stats_t *stats, void *userdata) {
+    batch_rom_t *rom = (batch_rom_t *) userdata;
+    rom->stats = *stats;
+}
+
+static void run_batch_rom(batch_context_t *context, batch_rom_t *rom) {
+    const batch_params_t *params = context->params;
+    zelda64_mapped_read_writer_t mapped_read_writer;
+    zelda64_file_read_writer_t read_writer = {};
+    bool mapped = zelda64_mapped_read_writer_open(&mapped_read_writer, rom->in_filename, rom->out_filename);
+    if (!mapped) {
+        read_writer = zelda64_file_read_writer_open(rom->in_filename, rom->out_filename);
+        if (read_writer.in_file == nullptr || (read_writer.writer == nullptr && read_writer.out_file == nullptr)) {
+            zelda64_file_read_writer_close(read_writer);
+            return;
+        }
+    }
+    rom->opened = true;
+    // A sink also keeps the progress lines of the ROMs from running through each other.
+    zelda64_stats_sink_t sink = {
+            .rom = batch_rom_stats,
+            .userdata = rom,
+    };
+    if (params->opts->mode & ZELDA64_MODE_COMPRESS) {
+        zelda64_compress_rom_params_t compress_params = mapped
+                                                        ? compress_params_from_mapped_read_writer(&mapped_read_writer)
+                                                        : compress_params_from_file_read_writer(&read_writer);
+        compress_params.exclusion_list = params->exclusion_list;
+        compress_params.exclusion_list_size = params->exclusion_list_size;
+        compress_params.min_gain = params->opts->min_gain;
+        compress_params.threshold = 1024 * 256;
+        compress_params.segment_size = ZELDA64_SEGMENT_SIZE;
+        compress_params.pool = context->pool;
+        compress_params.fix_checksum = true;
+        compress_params.level = params->opts->level;
+        compress_params.cache = params->cache;
+        compress_params.stats = &sink;
+        rom->result = zelda64_compress_rom(compress_params, zelda64_default_allocator());
+    } else {
+        zelda64_decompress_rom_params_t decompress_params = mapped
+                                                            ? decompress_params_from_mapped_read_writer(
+                                                                    &mapped_read_writer)
+                                                            : decompress_params_from_file_read_writer(&read_writer);
+        decompress_params.pool = context->pool;
+        decompress_params.fix_checksum = true;
+        decompress_params.stats = &sink;
+        rom->result = zelda64_decompress_rom(decompress_params, zelda64_default_allocator());
+    }
+    if (mapped) {
+        zelda64_mapped_read_writer_close(&mapped_read_writer);
+    } else {
+        zelda64_file_read_writer_close(read_writer);
+    }
+    // A failed ROM leaves no output behind, so every file the batch created is a finished ROM.
+    if (rom->result != ZELDA64_OK && !rom->out_existed) {
+        remove(rom->out_filename);
+    }
+}
+
+// Every job is a slot that works through ROMs one at a time until none are left, so the amount of ROMs in memory is
+// never more than the amount of slots. The files of each ROM are spread over the same pool.
+static void batch_job([[maybe_unused]] size_t slot, [[maybe_unused]] size_t worker, void *userdata) {
+    batch_context_t *context = (batch_context_t *) userdata;
+    for (size_t i = atomic_fetch_add(&context->next_rom, 1); i < context->rom_count;
+         i = atomic_fetch_add(&context->next_rom, 1)) {
+        batch_rom_t *rom = &context->roms[i];
+        run_batch_rom(context, rom);
+        pthread_mutex_lock(&context->log_lock);
+        if (!rom->opened) {
+            printf("failed %s: could not open it or %s\n", rom->in_filename, rom->out_filename);
+        } else if (rom->result != ZELDA64_OK) {
+            printf("failed %s: %s\n", rom->in_filename, describe_result(rom->result));
+        } else {
+            printf("done %s -> %s, %zu to %zu bytes in %.1f s\n", rom->in_filename, rom->out_filename,
+                   rom->stats.input_size, rom->stats.output_size, rom->stats.seconds);
+        }
+        fflush(stdout);
+        pthread_mutex_unlock(&context->log_lock);
+    }
+}
+
+static bool is_same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+/**
+ * Checks that a batch can not write over its own inputs, before anything is written.
+ * @param opts The options of the batch.
+ * @param roms The ROMs of the batch, whose out_existed is filled in.
+ * @param rom_count The amount of ROMs.
+ * @return true if every output is its own file and none of them is an input.
+ */
+static bool check_batch_outputs(const zelda64_options_t *opts, batch_rom_t *roms, size_t rom_count) {
+    struct stat in_st;
+    struct stat out_st;
+    if (stat(opts->in_filename, &in_st) == 0 && S_ISDIR(in_st.st_mode) && stat(opts->out_filename, &out_st) == 0 &&
+        is_same_file(&in_st, &out_st)) {
+        fprintf(stderr, "the output directory %s is the input directory\n", opts->out_filename);
+        return false;
+    }
+    struct stat *in_sts = calloc(rom_count > 0 ? rom_count : 1, sizeof(struct stat));
+    if (in_sts == nullptr) {
+        return false;
+    }
+    bool safe = true;
+    for (size_t i = 0; i < rom_count; ++i) {
+        // Inputs that do not exist fail on their own, they can not be overwritten either.
+        if (stat(roms[i].in_filename, &in_sts[i]) != 0) {
+            in_sts[i] = (struct stat) {};
+        }
+    }
+    for (size_t i = 0; safe && i < rom_count; ++i) {
+        for (size_t j = 0; safe && j < i; ++j) {
+            if (strcmp(roms[i].out_filename, roms[j].out_filename) == 0) {
+                fprintf(stderr, "%s and %s would both be written to %s\n", roms[j].in_filename, roms[i].in_filename,
+                        roms[i].out_filename);
+                safe = false;
+            }
+        }
+        roms[i].out_existed = stat(roms[i].out_filename, &out_st) == 0;
+        for (size_t j = 0; safe && roms[i].out_existed && j < rom_count; ++j) {
+            if (in_sts[j].st_ino != 0 && is_same_file(&in_sts[j], &out_st)) {
+                fprintf(stderr, "%s would be written over the input %s\n", roms[i].out_filename, roms[j].in_filename);
+                safe = false;
+            }
+        }
+    }
+    free(in_sts);
+    return safe;
+}
+
+/**
+ * Compresses or decompresses every ROM of a batch into the output directory, on one pool shared by all of them.
+ * @param params The options and compression settings of the batch.
+ * @return true if every ROM succeeded, false if any of them failed or the batch could not start.
+ */
+static bool run_batch(batch_params_t params) {
+    const zelda64_options_t *opts = params.opts;
+    size_t rom_count = 0;
+    char **in_filenames = collect_batch_inputs(opts->in_filename, &rom_count);
+    if (in_filenames == nullptr && rom_count == 0) {
+        fprintf(stderr, "found no ROMs in %s\n", opts->in_filename);
+        return false;
+    }
+    if (mkdir(opts->out_filename, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "could not create directory %s\n", opts->out_filename);
+        free_paths(in_filenames, rom_count);
+        return false;
+    }
+    batch_rom_t *roms = calloc(rom_count > 0 ? rom_count : 1, sizeof(batch_rom_t));
+    worker_pool_t *pool = worker_pool_create(opts->thread_count, zelda64_default_allocator());
+    bool success = roms != nullptr && pool != nullptr;
+    for (size_t i = 0; success && i < rom_count; ++i) {
+        const char *name = strrchr(in_filenames[i], '/');
+        roms[i].in_filename = in_filenames[i];
+        roms[i].out_filename = join_path(opts->out_filename, name != nullptr ? name + 1 : in_filenames[i]);
+        success = roms[i].out_filename != nullptr;
+    }
+    if (!success) {
+        fprintf(stderr, "could not start the batch\n");
+    } else if (!check_batch_outputs(opts, roms, rom_count)) {
+        success = false;
+    } else {
+        batch_context_t context = {
+                .params = &params,
+                .pool = pool,
+                .roms = roms,
+                .rom_count = rom_count,
+        };
+        pthread_mutex_init(&context.log_lock, nullptr);
+        double start = zelda64_stats_now();
+        size_t slots = opts->batch_roms < rom_count ? opts->batch_roms : rom_count;
+        worker_pool_run(pool, slots, batch_job, &context);
+        pthread_mutex_destroy(&context.log_lock);
+        size_t failed = 0;
+        for (size_t i = 0; i < rom_count; ++i) {
+            failed += !roms[i].opened || roms[i].result != ZELDA64_OK;
+        }
+        printf("Batch finished in %.1f s, %zu of %zu ROMs failed\n", zelda64_stats_now() - start, failed, rom_count);
+        success = failed == 0;
+    }
+    if (roms != nullptr) {
+        for (size_t i = 0; i < rom_count; ++i) {
+            free(roms[i].out_filename);
+        }
+        free(roms);
+    }
+    if (pool != nullptr) {
+        worker_pool_destroy(pool);
+    }
+    free_paths(in_filenames, rom_count);
+    return success;
 }
 
 int main(int argc, char *argv[]) {
-    zelda64_options_t opts = {};
+    zelda64_options_t opts = {
+            .thread_count = get_processor_count(),
+            .batch_roms = ZELDA64_DEFAULT_BATCH_ROMS,
+            .level = ZELDA64_YAZ0_GREEDY_LEVEL,
+            .min_gain = ZELDA64_DEFAULT_MIN_GAIN,
+    };
     parse_command_line_opts(&opts, argc, (const char *const *) argv);
     if (opts.show_help) {
         print_help();
@@ -191,33 +992,176 @@ int main(int argc, char *argv[]) {
         print_usage(stderr);
         return EXIT_FAILURE;
     }
+    int status = EXIT_SUCCESS;
+    uint32_t *exclusions = oot_exclusion_list;
+    size_t exclusion_count = sizeof oot_exclusion_list / sizeof(uint32_t);
+    uint32_t *custom_exclusions = nullptr;
+    if (opts.exclusion_list != nullptr && strcmp(opts.exclusion_list, "oot") != 0) {
+        if (strcmp(opts.exclusion_list, "none") == 0) {
+            exclusions = nullptr;
+            exclusion_count = 0;
+        } else {
+            custom_exclusions = parse_index_list(opts.exclusion_list, &exclusion_count);
+            if (custom_exclusions == nullptr) {
+                fprintf(stderr, "invalid exclusion list %s\n", opts.exclusion_list);
+                return EXIT_FAILURE;
+            }
+            exclusions = custom_exclusions;
+        }
+    }
+    zelda64_compress_cache_t cache;
+    const zelda64_compress_cache_t *cache_handle = nullptr;
+    if (opts.cache_directory != nullptr) {
+        if (zelda64_compress_cache_open(&cache, opts.cache_directory)) {
+            cache_handle = &cache;
+        } else {
+            fprintf(stderr, "could not open cache directory %s, compressing without a cache\n", opts.cache_directory);
+        }
+    }
+    if (opts.batch) {
+        batch_params_t params = {
+                .opts = &opts,
+                .exclusion_list = exclusions,
+                .exclusion_list_size = exclusion_count,
+                .cache = cache_handle,
+        };
+        status = run_batch(params) ? EXIT_SUCCESS : EXIT_FAILURE;
+        free(custom_exclusions);
+        return status;
+    }
+    if (opts.mode == ZELDA64_MODE_EXTRACT || opts.mode == ZELDA64_MODE_PACK) {
+        bool success = opts.mode == ZELDA64_MODE_EXTRACT
+                       ? extract_file(opts.in_filename, opts.out_filename, opts.thread_count)
+                       : pack_file(opts.in_filename, opts.out_filename, &opts, cache_handle);
+        free(custom_exclusions);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (opts.mode == ZELDA64_MODE_NONE) {
+        free(custom_exclusions);
+        return verify_files(opts.in_filename, opts.out_filename, opts.thread_count, stdout)
+               ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    // Memory mapped files are used when possible, with regular file I/O as the fallback.
+    zelda64_mapped_read_writer_t mapped_read_writer;
+    zelda64_file_read_writer_t read_writer = {};
+    bool mapped = zelda64_mapped_read_writer_open(&mapped_read_writer, opts.in_filename, opts.out_filename);
+    if (!mapped) {
+        read_writer = zelda64_file_read_writer_open(opts.in_filename, opts.out_filename);
+        if (read_writer.in_file == nullptr || (read_writer.writer == nullptr && read_writer.out_file == nullptr)) {
+            fprintf(stderr, "could not open %s or %s\n", opts.in_filename, opts.out_filename);
+            return EXIT_FAILURE;
+        }
+    }
+    // With a report on stdout, everything else goes to stderr.
+    FILE *log = opts.report_json ? stderr : stdout;
+    zelda64_report_t report;
+    zelda64_report_init(&report, zelda64_default_allocator());
+    zelda64_stats_sink_t sink = zelda64_report_sink(&report);
     if (opts.mode & ZELDA64_MODE_DECOMPRESS) {
-        zelda64_file_read_writer_t read_writer = zelda64_file_read_writer_open(opts.in_filename, opts.out_filename);
-        zelda64_decompress_rom_params_t params = decompress_params_from_file_read_writer(&read_writer);
-        zelda64_decompress_rom(params, zelda64_default_allocator());
-        // TODO: Recalculate ROM Checksum here.
-        zelda64_file_read_writer_close(read_writer);
+        zelda64_decompress_rom_params_t params = mapped
+                                                 ? decompress_params_from_mapped_read_writer(&mapped_read_writer)
+                                                 : decompress_params_from_file_read_writer(&read_writer);
+        params.thread_count = opts.thread_count;
+        params.fix_checksum = true;
+        params.stats = opts.report_json ? &sink : nullptr;
+        double start = zelda64_stats_now();
+        if (zelda64_decompress_rom(params, zelda64_default_allocator()) != ZELDA64_OK) {
+            fprintf(stderr, "could not decompress %s\n", opts.in_filename);
+            status = EXIT_FAILURE;
+        }
+        double time_spent = zelda64_stats_now() - start;
+        fprintf(log, "Decompression finished in %.3f s\n", time_spent);
+        if (opts.report_json) {
+            zelda64_report_write_json(&report, stdout, "decompress", -1);
+        }
     }
     if (opts.mode & ZELDA64_MODE_COMPRESS) {
-        zelda64_file_read_writer_t read_writer = zelda64_file_read_writer_open(opts.in_filename, opts.out_filename);
-        uint32_t exclusions[] = {
-                0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
-                15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
-                942, 944, 946, 948, 950, 952, 954, 956, 958, 960, 962, 964, 966, 968, 970, 972, 974, 976, 978, 980,
-                982, 984, 986, 988, 990, 992, 994, 996, 998, 1000, 1002, 1004,
-                1497, 1498, 1499, 1500, 1501, 1502, 1503, 1504, 1505, 1506, 1507, 1508, 1509, 1510, 1511, 1512, 1513,
-                1514, 1515, 1516, 1517, 1518, 1519, 1520, 1521, 1522, 1523, 1524, 1525
-        };
-        zelda64_compress_rom_params_t params = compress_params_from_file_read_writer(&read_writer);
+        zelda64_compress_rom_params_t params = mapped
+                                               ? compress_params_from_mapped_read_writer(&mapped_read_writer)
+                                               : compress_params_from_file_read_writer(&read_writer);
         params.exclusion_list = exclusions;
-        params.exclusion_list_size = sizeof exclusions / sizeof(uint32_t);
-        params.threshold = 1024 * 256; // Files larger than 32 KB should be handled on a thread.
-        clock_t start = clock();
-        zelda64_compress_rom(params, zelda64_default_allocator());
-        clock_t end = clock();
-        double time_spent = (double) (end - start) / CLOCKS_PER_SEC;
-        printf("Compression finished in %.1f s\n", time_spent);
+        params.exclusion_list_size = exclusion_count;
+        params.min_gain = opts.min_gain;
+        params.threshold = 1024 * 256; // Files larger than 256 KB are compressed first.
+        params.segment_size = ZELDA64_SEGMENT_SIZE;
+        params.thread_count = opts.thread_count;
+        params.fix_checksum = true;
+        params.level = opts.level;
+        params.cache = cache_handle;
+        params.stats = opts.report_json ? &sink : nullptr;
+        double start = zelda64_stats_now();
+        if (zelda64_compress_rom(params, zelda64_default_allocator()) != ZELDA64_OK) {
+            fprintf(stderr, "could not compress %s\n", opts.in_filename);
+            status = EXIT_FAILURE;
+        }
+        double time_spent = zelda64_stats_now() - start;
+        fprintf(log, "Compression finished in %.1f s\n", time_spent);
+        if (opts.report_json) {
+            zelda64_report_write_json(&report, stdout, "compress", opts.level);
+        }
+    }
+    if (opts.mode & ZELDA64_MODE_PATCH) {
+        size_t patch_size = 0;
+        uint8_t *patch = read_whole_file(opts.patch_filename, &patch_size);
+        size_t rom_size = mapped ? mapped_read_writer.in_size : file_size(&read_writer);
+        uint8_t *rom_data = mapped
+                            ? mapped_read_rom_data(rom_size, 0, &mapped_read_writer)
+                            : file_read_rom_data(rom_size, 0, &read_writer);
+        zelda64_rom_t rom;
+        if (patch == nullptr) {
+            fprintf(stderr, "could not read patch %s\n", opts.patch_filename);
+            status = EXIT_FAILURE;
+        } else if (rom_data == nullptr || zelda64_rom_open(&rom, rom_data, rom_size) != ZELDA64_OK) {
+            fprintf(stderr, "could not read %s\n", opts.in_filename);
+            status = EXIT_FAILURE;
+        } else {
+            zelda64_patch_rom_params_t params = {
+                    .rom = &rom,
+                    .patch = patch,
+                    .patch_size = patch_size,
+                    .reserve = mapped ? mapped_reserve_space : file_reserve_space,
+                    .write_data = mapped ? mapped_write_out : file_write_out,
+                    .finish = mapped ? nullptr : file_finish,
+                    .fix_checksum = true,
+                    .exclusion_list = exclusions,
+                    .exclusion_list_size = exclusion_count,
+                    .thread_count = opts.thread_count,
+                    .level = opts.level,
+                    .segment_size = ZELDA64_SEGMENT_SIZE,
+                    .cache = cache_handle,
+                    .stats = opts.report_json ? &sink : nullptr,
+                    .userdata = mapped ? (void *) &mapped_read_writer : (void *) &read_writer,
+            };
+            double start = zelda64_stats_now();
+            if (zelda64_patch_rom(params, zelda64_default_allocator()) != ZELDA64_OK) {
+                fprintf(stderr, "could not patch %s with %s\n", opts.in_filename, opts.patch_filename);
+                status = EXIT_FAILURE;
+            }
+            double time_spent = zelda64_stats_now() - start;
+            fprintf(log, "Patching finished in %.1f s\n", time_spent);
+            if (opts.report_json) {
+                zelda64_report_write_json(&report, stdout, "patch", opts.level);
+            }
+        }
+        if (rom_data != nullptr && !mapped) {
+            file_close_rom_data(rom_data, rom_size, &read_writer);
+        }
+        free(patch);
+    }
+    zelda64_report_free(&report);
+    free(custom_exclusions);
+    if (mapped) {
+        zelda64_mapped_read_writer_close(&mapped_read_writer);
+    } else {
         zelda64_file_read_writer_close(read_writer);
     }
-    return EXIT_SUCCESS;
+    // The output is complete once it is closed. The compressed side is the input when decompressing.
+    if (opts.verify && status == EXIT_SUCCESS) {
+        bool decompressed = opts.mode & ZELDA64_MODE_DECOMPRESS;
+        if (!verify_files(decompressed ? opts.out_filename : opts.in_filename,
+                          decompressed ? opts.in_filename : opts.out_filename, opts.thread_count, log)) {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
 }
@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <string.h>
+
+#include "manifest.h"
+
+// Bumped whenever the layout of the manifest changes.
+#define MANIFEST_FORMAT_VERSION 1
+#define MANIFEST_MAGIC "zelda64-manifest"
+
+static const char *const kind_names[] = {
+        [ZELDA64_FILE_EMPTY] = "empty",
+        [ZELDA64_FILE_UNCOMPRESSED] = "uncompressed",
+        [ZELDA64_FILE_COMPRESSED] = "compressed",
+};
+
+zelda64_result_t zelda64_manifest_init(zelda64_manifest_t *manifest, zelda64_dma_info_t dma_info,
+                                       zelda64_allocator_t allocator) {
+    assert(manifest != nullptr);
+    *manifest = (zelda64_manifest_t) {
+            .dma_info = dma_info,
+            .files = allocator.alloc(dma_info.entries > 0 ? dma_info.entries : 1, sizeof(zelda64_manifest_file_t),
+                                     allocator.userdata),
+            .allocator = allocator,
+    };
+    return manifest->files != nullptr ? ZELDA64_OK : ZELDA64_ERROR_OUT_OF_MEMORY;
+}
+
+void zelda64_manifest_free(zelda64_manifest_t *manifest) {
+    if (manifest->files != nullptr) {
+        manifest->allocator.free(manifest->files, manifest->allocator.userdata);
+        manifest->files = nullptr;
+    }
+}
+
+zelda64_result_t zelda64_manifest_read(zelda64_manifest_t *manifest, FILE *stream, zelda64_allocator_t allocator) {
+    assert(manifest != nullptr);
+    assert(stream != nullptr);
+    char magic[32];
+    int version = 0;
+    zelda64_dma_info_t dma_info = {};
+    if (fscanf(stream, "%31s %d dma %x %x %u", magic, &version, &dma_info.offset, &dma_info.size,
+               &dma_info.entries) != 5 || strcmp(magic, MANIFEST_MAGIC) != 0 || version != MANIFEST_FORMAT_VERSION ||
+        dma_info.size / 16 < dma_info.entries || dma_info.entries == 0) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    zelda64_result_t result = zelda64_manifest_init(manifest, dma_info, allocator);
+    if (result != ZELDA64_OK) {
+        return result;
+    }
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        zelda64_manifest_file_t *file = &manifest->files[i];
+        uint32_t index = 0;
+        char kind[16];
+        if (fscanf(stream, "%u %15s %x %x %x %x %x", &index, kind, &file->entry.v_start, &file->entry.v_end,
+                   &file->entry.p_start, &file->entry.p_end, &file->crc) != 7 || index != i) {
+            result = ZELDA64_ERROR_INVALID_DATA;
+            break;
+        }
+        size_t k = 0;
+        while (k < sizeof kind_names / sizeof kind_names[0] && strcmp(kind, kind_names[k]) != 0) {
+            ++k;
+        }
+        if (k == sizeof kind_names / sizeof kind_names[0] ||
+            (k != ZELDA64_FILE_EMPTY && file->entry.v_start >= file->entry.v_end)) {
+            result = ZELDA64_ERROR_INVALID_DATA;
+            break;
+        }
+        file->kind = (zelda64_file_kind_t) k;
+    }
+    if (result != ZELDA64_OK) {
+        zelda64_manifest_free(manifest);
+    }
+    return result;
+}
+
+bool zelda64_manifest_write(const zelda64_manifest_t *manifest, FILE *stream) {
+    assert(manifest != nullptr);
+    assert(stream != nullptr);
+    const zelda64_dma_info_t *dma_info = &manifest->dma_info;
+    fprintf(stream, "%s %d\n", MANIFEST_MAGIC, MANIFEST_FORMAT_VERSION);
+    fprintf(stream, "dma %08x %08x %u\n", dma_info->offset, dma_info->size, dma_info->entries);
+    for (uint32_t i = 0; i < dma_info->entries; ++i) {
+        const zelda64_manifest_file_t *file = &manifest->files[i];
+        fprintf(stream, "%u %s %08x %08x %08x %08x %08x\n", i, kind_names[file->kind], file->entry.v_start,
+                file->entry.v_end, file->entry.p_start, file->entry.p_end, file->crc);
+    }
+    return !ferror(stream);
+}
+
+bool zelda64_manifest_file_path(char path[ZELDA64_MANIFEST_PATH_MAX], const char *directory, uint32_t index,
+                                const char *extension) {
+    int length = snprintf(path, ZELDA64_MANIFEST_PATH_MAX, "%s/%04u.%s", directory, index, extension);
+    return length > 0 && length < ZELDA64_MANIFEST_PATH_MAX;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <zelda64/dma.h>
+#include <zelda64/zelda64.h>
+
+#define ZELDA64_MANIFEST_NAME "manifest.txt"
+#define ZELDA64_MANIFEST_PATH_MAX 4096
+
+// Lists the files of a ROM extracted to a directory. Every file is kept as NNNN.bin, named after its DMA index, and
+// compressed files also keep the Yaz0 blob they were stored as in NNNN.yaz0.
+typedef struct zelda64_manifest_file {
+    // The DMA entry as it was in the extracted ROM. The physical addresses are only used again for empty entries.
+    zelda64_dma_entry_t entry;
+    // How the file is stored when the directory is packed. Can be edited to compress or store a file from then on.
+    zelda64_file_kind_t kind;
+    // CRC-32 of NNNN.bin when it was extracted, which tells whether a file was changed since.
+    uint32_t crc;
+} zelda64_manifest_file_t;
+
+typedef struct zelda64_manifest {
+    // Virtual address and size of the DMA table.
+    zelda64_dma_info_t dma_info;
+    zelda64_manifest_file_t *files;
+    zelda64_allocator_t allocator;
+} zelda64_manifest_t;
+
+/**
+ * Allocates the files of a manifest, one for every entry of a DMA table.
+ * @param manifest The manifest to initialize.
+ * @param dma_info Location and size of the DMA table.
+ * @param allocator The allocator used for the files.
+ * @return ZELDA64_OK on success or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_manifest_init(zelda64_manifest_t *manifest, zelda64_dma_info_t dma_info,
+                                       zelda64_allocator_t allocator);
+
+/**
+ * Frees the files of a manifest.
+ * @param manifest The manifest to free.
+ */
+void zelda64_manifest_free(zelda64_manifest_t *manifest);
+
+/**
+ * Reads a manifest from a text stream.
+ * @param manifest The manifest to initialize.
+ * @param stream The stream to read from.
+ * @param allocator The allocator used for the files.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if the manifest is malformed, or
+ * ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_manifest_read(zelda64_manifest_t *manifest, FILE *stream, zelda64_allocator_t allocator);
+
+/**
+ * Writes a manifest to a text stream, one line per file.
+ * @param manifest The manifest to write.
+ * @param stream The stream to write to.
+ * @return true on success, false if writing failed.
+ */
+bool zelda64_manifest_write(const zelda64_manifest_t *manifest, FILE *stream);
+
+/**
+ * Builds the path of a file in an extracted directory.
+ * @param path Buffer of ZELDA64_MANIFEST_PATH_MAX bytes to write the path to.
+ * @param directory The extracted directory.
+ * @param index Index of the file in the DMA table.
+ * @param extension The extension of the file, "bin" or "yaz0".
+ * @return true on success, false if the path does not fit.
+ */
+bool zelda64_manifest_file_path(char path[ZELDA64_MANIFEST_PATH_MAX], const char *directory, uint32_t index,
+                                const char *extension);
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <string.h>
+
+#include "mapped_io.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool zelda64_mapped_read_writer_open(zelda64_mapped_read_writer_t *read_writer,
+                                     const char *restrict in_filename, const char *restrict out_filename) {
+    assert(read_writer != nullptr);
+    *read_writer = (zelda64_mapped_read_writer_t) {
+            .in_fd = -1,
+            .out_fd = -1,
+    };
+    int in_fd = open(in_filename, O_RDONLY);
+    if (in_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(in_fd);
+        return false;
+    }
+    void *in_data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (in_data == MAP_FAILED) {
+        close(in_fd);
+        return false;
+    }
+    // The ROM is read front to back when locating the DMA table, and file by file after that.
+    posix_madvise(in_data, st.st_size, POSIX_MADV_WILLNEED);
+    int out_fd = open(out_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        munmap(in_data, st.st_size);
+        close(in_fd);
+        return false;
+    }
+    read_writer->in_fd = in_fd;
+    read_writer->out_fd = out_fd;
+    read_writer->in_data = in_data;
+    read_writer->in_size = st.st_size;
+    return true;
+}
+
+void zelda64_mapped_read_writer_close(zelda64_mapped_read_writer_t *read_writer) {
+    assert(read_writer != nullptr);
+    if (read_writer->out_data != nullptr) {
+        munmap(read_writer->out_data, read_writer->out_size);
+    }
+    if (read_writer->in_data != nullptr) {
+        munmap((void *) read_writer->in_data, read_writer->in_size);
+    }
+    if (read_writer->out_fd >= 0) {
+        close(read_writer->out_fd);
+    }
+    if (read_writer->in_fd >= 0) {
+        close(read_writer->in_fd);
+    }
+    *read_writer = (zelda64_mapped_read_writer_t) {
+            .in_fd = -1,
+            .out_fd = -1,
+    };
+}
+
+void mapped_reserve_space(size_t size, void *userdata) {
+    zelda64_mapped_read_writer_t *read_writer = (zelda64_mapped_read_writer_t *) userdata;
+    if (read_writer->out_data != nullptr || size == 0) {
+        return;
+    }
+    if (ftruncate(read_writer->out_fd, (off_t) size) != 0) {
+        return;
+    }
+    void *out_data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, read_writer->out_fd, 0);
+    if (out_data == MAP_FAILED) {
+        return;
+    }
+    read_writer->out_data = out_data;
+    read_writer->out_size = size;
+}
+
+void mapped_write_out(void *data, size_t size, size_t offset, void *userdata) {
+    zelda64_mapped_read_writer_t *read_writer = (zelda64_mapped_read_writer_t *) userdata;
+    if (read_writer->out_data != nullptr && offset <= read_writer->out_size &&
+        size <= read_writer->out_size - offset) {
+        memcpy(read_writer->out_data + offset, data, size);
+        return;
+    }
+    // Nothing was reserved for this range, write it to the file instead. The mapping and the file share the page
+    // cache, so both stay consistent.
+    const uint8_t *cursor = data;
+    while (size > 0) {
+        ssize_t written = pwrite(read_writer->out_fd, cursor, size, (off_t) offset);
+        if (written <= 0) {
+            return;
+        }
+        cursor += written;
+        offset += written;
+        size -= written;
+    }
+}
+
+#else
+
+bool zelda64_mapped_read_writer_open([[maybe_unused]] zelda64_mapped_read_writer_t *read_writer,
+                                     [[maybe_unused]] const char *restrict in_filename,
+                                     [[maybe_unused]] const char *restrict out_filename) {
+    return false;
+}
+
+void zelda64_mapped_read_writer_close([[maybe_unused]] zelda64_mapped_read_writer_t *read_writer) {
+}
+
+void mapped_reserve_space([[maybe_unused]] size_t size, [[maybe_unused]] void *userdata) {
+}
+
+void mapped_write_out([[maybe_unused]] void *data, [[maybe_unused]] size_t size, [[maybe_unused]] size_t offset,
+                      [[maybe_unused]] void *userdata) {
+}
+
+#endif
+
+void *mapped_read_rom_data(size_t size, size_t offset, void *userdata) {
+    zelda64_mapped_read_writer_t *read_writer = (zelda64_mapped_read_writer_t *) userdata;
+    if (offset > read_writer->in_size || size > read_writer->in_size - offset) {
+        return nullptr;
+    }
+    return (void *) (read_writer->in_data + offset);
+}
+
+void mapped_close_rom_data([[maybe_unused]] void *data, [[maybe_unused]] size_t size,
+                           [[maybe_unused]] void *userdata) {
+}
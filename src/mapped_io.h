@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reads a ROM straight out of a memory mapping of the input file, and writes to a memory mapping of the output file.
+typedef struct zelda64_mapped_read_writer {
+    int in_fd;
+    int out_fd;
+    const uint8_t *in_data;
+    size_t in_size;
+    uint8_t *out_data;
+    size_t out_size;
+} zelda64_mapped_read_writer_t;
+
+/**
+ * Maps the input file and opens the output file.
+ * @param read_writer The read writer to open.
+ * @param in_filename The file to read the ROM from.
+ * @param out_filename The file to write to.
+ * @return true on success, false if the files could not be opened or mapped, for example when the platform has no
+ * memory mapped files or the input is a pipe.
+ */
+bool zelda64_mapped_read_writer_open(zelda64_mapped_read_writer_t *read_writer,
+                                     const char *restrict in_filename, const char *restrict out_filename);
+
+/**
+ * Unmaps and closes both files. The output file is truncated to the end of the furthest write.
+ * @param read_writer The read writer to close.
+ */
+void zelda64_mapped_read_writer_close(zelda64_mapped_read_writer_t *read_writer);
+
+/**
+ * Returns a pointer into the mapped input, no data is copied.
+ */
+void *mapped_read_rom_data(size_t size, size_t offset, void *userdata);
+
+/**
+ * Does nothing, the data returned by mapped_read_rom_data() belongs to the mapping.
+ */
+void mapped_close_rom_data(void *data, size_t size, void *userdata);
+
+/**
+ * Sizes the output file and maps it.
+ */
+void mapped_reserve_space(size_t size, void *userdata);
+
+/**
+ * Copies data into the mapped output. Writes past the reserved size go to the file directly.
+ */
+void mapped_write_out(void *data, size_t size, size_t offset, void *userdata);
@@ -0,0 +1,350 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <zelda64/crc32.h>
+#include <zelda64/dma.h>
+#include <zelda64/yaz0.h>
+
+#include "checksum.h"
+#include "compress.h"
+#include "pack.h"
+#include "pool.h"
+
+typedef enum pack_action {
+    PACK_ACTION_SKIP = 0,
+    PACK_ACTION_KEEP = 1,
+    PACK_ACTION_STORE = 2,
+    PACK_ACTION_COMPRESS = 3,
+} pack_action_t;
+
+typedef struct pack_job {
+    pack_action_t action;
+    // What ends up in the output: the extracted Yaz0 blob for PACK_ACTION_KEEP, the file or its compressed form
+    // otherwise.
+    uint8_t *data;
+    size_t size;
+    // The amount of bytes the file takes up in the ROM, including padding.
+    size_t stored_size;
+    bool cached;
+    double seconds;
+} pack_job_t;
+
+typedef struct pack_context {
+    const zelda64_pack_rom_params_t *params;
+    zelda64_allocator_t allocator;
+    const zelda64_manifest_t *manifest;
+    pack_job_t *jobs;
+    zelda64_yaz0_compressor_t *compressors;
+    worker_pool_t *pool;
+    pthread_mutex_t lock;
+    zelda64_result_t result;
+} pack_context_t;
+
+static void fail(pack_context_t *context, zelda64_result_t result) {
+    pthread_mutex_lock(&context->lock);
+    context->result = result;
+    pthread_mutex_unlock(&context->lock);
+}
+
+// Workers print under the lock so their lines never run into each other.
+static void print_progress(pack_context_t *context, uint32_t index) {
+    if (context->params->stats != nullptr) {
+        return;
+    }
+    pthread_mutex_lock(&context->lock);
+    printf("compressing changed file %u/%u\n", index + 1, context->manifest->dma_info.entries);
+    pthread_mutex_unlock(&context->lock);
+}
+
+// Reads a file of the extracted directory. The size is checked against the expected size when one is given.
+static zelda64_result_t read_file(const pack_context_t *context, uint32_t index, const char *extension,
+                                  size_t expected_size, uint8_t **data, size_t *size) {
+    char path[ZELDA64_MANIFEST_PATH_MAX];
+    if (!zelda64_manifest_file_path(path, context->params->directory, index, extension)) {
+        return ZELDA64_ERROR_IO;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return ZELDA64_ERROR_IO;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size <= 0 || (expected_size > 0 && (size_t) file_size != expected_size)) {
+        fclose(file);
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    zelda64_allocator_t allocator = context->allocator;
+    uint8_t *buffer = allocator.alloc(file_size, sizeof(uint8_t), allocator.userdata);
+    if (buffer == nullptr) {
+        fclose(file);
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    bool read = fread(buffer, sizeof(uint8_t), file_size, file) == (size_t) file_size;
+    fclose(file);
+    if (!read) {
+        allocator.free(buffer, allocator.userdata);
+        return ZELDA64_ERROR_IO;
+    }
+    *data = buffer;
+    *size = (size_t) file_size;
+    return ZELDA64_OK;
+}
+
+// Loads the Yaz0 blob a file was extracted with, which is only used when it is a blob of a file of this size.
+static bool load_blob(pack_context_t *context, uint32_t index, size_t size, pack_job_t *pack_job) {
+    uint8_t *blob = nullptr;
+    size_t blob_size = 0;
+    if (read_file(context, index, "yaz0", 0, &blob, &blob_size) != ZELDA64_OK) {
+        return false;
+    }
+    // A blob too small to hold a header was cut short, the file is compressed again instead.
+    if (blob_size < 16) {
+        context->allocator.free(blob, context->allocator.userdata);
+        return false;
+    }
+    zelda64_yaz0_header_t header = zelda64_get_yaz0_header(blob, blob_size);
+    if (!zelda64_is_valid_yaz0_header(header) || header.uncompressed_size != size) {
+        context->allocator.free(blob, context->allocator.userdata);
+        return false;
+    }
+    pack_job->data = blob;
+    pack_job->size = blob_size;
+    // The blob was extracted with the padding it had in the ROM, so it only needs aligning if it was edited.
+    pack_job->stored_size = (blob_size + 15) & -16;
+    return true;
+}
+
+static void build_job(size_t job, size_t worker, void *userdata) {
+    pack_context_t *context = (pack_context_t *) userdata;
+    const zelda64_pack_rom_params_t *params = context->params;
+    uint32_t index = (uint32_t) job;
+    const zelda64_manifest_file_t *file = &context->manifest->files[index];
+    pack_job_t *pack_job = &context->jobs[index];
+    if (pack_job->action == PACK_ACTION_SKIP) {
+        return;
+    }
+    double start = zelda64_stats_now();
+    size_t size = file->entry.v_end - file->entry.v_start;
+    uint8_t *data = nullptr;
+    zelda64_result_t result = read_file(context, index, "bin", size, &data, &size);
+    if (result != ZELDA64_OK) {
+        fail(context, result);
+        return;
+    }
+    if (pack_job->action == PACK_ACTION_STORE) {
+        pack_job->data = data;
+        pack_job->size = size;
+        pack_job->stored_size = size;
+        pack_job->seconds = zelda64_stats_now() - start;
+        return;
+    }
+    if (zelda64_crc32_update(0, data, size) == file->crc && load_blob(context, index, size, pack_job)) {
+        context->allocator.free(data, context->allocator.userdata);
+        pack_job->action = PACK_ACTION_KEEP;
+        pack_job->seconds = zelda64_stats_now() - start;
+        return;
+    }
+    print_progress(context, index);
+    size_t capacity = zelda64_yaz0_compress_bound(size);
+    uint8_t *compressed = context->allocator.alloc(capacity, sizeof(uint8_t), context->allocator.userdata);
+    if (compressed == nullptr) {
+        context->allocator.free(data, context->allocator.userdata);
+        fail(context, ZELDA64_ERROR_OUT_OF_MEMORY);
+        return;
+    }
+    size_t compressed_size = 0;
+    zelda64_compress_cache_key_t key;
+    bool cached = false;
+    if (params->cache != nullptr) {
+        key = zelda64_compress_cache_key(data, size, params->level, params->segment_size);
+        cached = zelda64_compress_cache_lookup(params->cache, key, data, size, compressed, &compressed_size,
+                                               context->allocator);
+    }
+    if (!cached) {
+        result = zelda64_compress_file(&context->compressors[worker], context->pool, params->segment_size, data, size,
+                                       compressed, &compressed_size, nullptr, context->allocator);
+        if (result == ZELDA64_OK && params->cache != nullptr) {
+            zelda64_compress_cache_store(params->cache, key, compressed, compressed_size);
+        }
+    }
+    context->allocator.free(data, context->allocator.userdata);
+    if (result != ZELDA64_OK) {
+        context->allocator.free(compressed, context->allocator.userdata);
+        fail(context, result);
+        return;
+    }
+    pack_job->data = compressed;
+    pack_job->size = compressed_size;
+    // File sizes must be aligned.
+    pack_job->stored_size = (compressed_size + 31) & -16;
+    pack_job->cached = cached;
+    pack_job->seconds = zelda64_stats_now() - start;
+}
+
+static void report_file(const zelda64_pack_rom_params_t *params, uint32_t index, const pack_job_t *job,
+                        size_t input_size) {
+    if (params->stats == nullptr || params->stats->file == nullptr) {
+        return;
+    }
+    zelda64_file_stats_t stats = {
+            .index = index,
+            .action = ZELDA64_FILE_ACTION_SKIPPED,
+            .output_size = job->stored_size,
+            .seconds = job->seconds,
+    };
+    if (job->action != PACK_ACTION_SKIP) {
+        stats.input_size = input_size;
+        if (job->action == PACK_ACTION_STORE) {
+            stats.action = ZELDA64_FILE_ACTION_COPIED;
+        } else if (job->action == PACK_ACTION_KEEP || job->cached) {
+            stats.action = ZELDA64_FILE_ACTION_CACHED;
+        } else {
+            stats.action = ZELDA64_FILE_ACTION_COMPRESSED;
+        }
+    }
+    params->stats->file(&stats, params->stats->userdata);
+}
+
+zelda64_result_t zelda64_pack_rom(zelda64_pack_rom_params_t params, zelda64_allocator_t allocator) {
+    double start = zelda64_stats_now();
+    assert(params.directory != nullptr);
+    assert(params.write_data != nullptr);
+    char path[ZELDA64_MANIFEST_PATH_MAX];
+    int length = snprintf(path, sizeof path, "%s/%s", params.directory, ZELDA64_MANIFEST_NAME);
+    FILE *stream = length > 0 && length < (int) sizeof path ? fopen(path, "r") : nullptr;
+    if (stream == nullptr) {
+        return ZELDA64_ERROR_IO;
+    }
+    zelda64_manifest_t manifest;
+    zelda64_result_t result = zelda64_manifest_read(&manifest, stream, allocator);
+    fclose(stream);
+    if (result != ZELDA64_OK) {
+        return result;
+    }
+    const zelda64_dma_info_t dma_info = manifest.dma_info;
+    pack_context_t context = {
+            .params = &params,
+            .allocator = allocator,
+            .manifest = &manifest,
+            .jobs = allocator.alloc(dma_info.entries, sizeof(pack_job_t), allocator.userdata),
+            .result = ZELDA64_OK,
+    };
+    uint8_t *dma_out = allocator.alloc(dma_info.size, sizeof(uint8_t), allocator.userdata);
+    zelda64_checksum_fixup_t checksum = {};
+    worker_pool_t *pool = worker_pool_create(params.thread_count, allocator);
+    context.pool = pool;
+    size_t compressor_count = pool != nullptr ? worker_pool_size(pool) : 0;
+    context.compressors = allocator.alloc(compressor_count, sizeof(zelda64_yaz0_compressor_t), allocator.userdata);
+    for (size_t i = 0; context.compressors != nullptr && i < compressor_count; ++i) {
+        zelda64_yaz0_compressor_init(&context.compressors[i], params.level, allocator);
+    }
+    pthread_mutex_init(&context.lock, nullptr);
+    if (context.jobs == nullptr || context.compressors == nullptr || dma_out == nullptr || pool == nullptr ||
+        (params.fix_checksum && zelda64_checksum_fixup_init(&checksum, allocator) != ZELDA64_OK)) {
+        result = ZELDA64_ERROR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+    // Files up to the DMA table are read before anything can be decompressed, so they are always stored.
+    uint32_t compressed_count = 0;
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        const zelda64_manifest_file_t *file = &manifest.files[i];
+        if (file->kind == ZELDA64_FILE_EMPTY) {
+            context.jobs[i].action = PACK_ACTION_SKIP;
+        } else if (file->kind == ZELDA64_FILE_COMPRESSED &&
+                   file->entry.v_start >= (uint64_t) dma_info.offset + dma_info.size) {
+            context.jobs[i].action = PACK_ACTION_COMPRESS;
+            compressed_count++;
+        } else {
+            context.jobs[i].action = PACK_ACTION_STORE;
+        }
+    }
+    worker_pool_run(pool, dma_info.entries, build_job, &context);
+    result = context.result;
+    if (result != ZELDA64_OK) {
+        goto cleanup;
+    }
+    // Lay the files out back to back in table order, like the compressor does.
+    size_t output_size = dma_info.offset + dma_info.size;
+    size_t cursor = 0;
+    uint32_t kept_count = 0;
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        cursor += context.jobs[i].stored_size;
+        kept_count += context.jobs[i].action == PACK_ACTION_KEEP;
+    }
+    if (params.reserve != nullptr) {
+        params.reserve(cursor > output_size ? cursor : output_size, params.userdata);
+    }
+    cursor = 0;
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        pack_job_t *job = &context.jobs[i];
+        zelda64_dma_entry_t entry = manifest.files[i].entry;
+        if (job->action != PACK_ACTION_SKIP) {
+            params.write_data(job->data, job->size, cursor, params.userdata);
+            zelda64_checksum_fixup_update(&checksum, job->data, job->size, cursor);
+            entry.p_start = cursor;
+            entry.p_end = job->action == PACK_ACTION_STORE ? 0 : cursor + job->stored_size;
+            cursor += job->stored_size;
+        }
+        zelda64_set_dma_table_entry(dma_out, dma_info.size, i, entry);
+    }
+    params.write_data(dma_out, dma_info.size, dma_info.offset, params.userdata);
+    zelda64_checksum_fixup_update(&checksum, dma_out, dma_info.size, dma_info.offset);
+    zelda64_checksum_fixup_write(&checksum, params.write_data, params.userdata);
+    if (params.finish != nullptr) {
+        result = params.finish(params.userdata);
+        if (result != ZELDA64_OK) {
+            goto cleanup;
+        }
+    }
+    if (params.stats == nullptr) {
+        printf("compressed %u changed files, kept %u compressed files as they were\n", compressed_count - kept_count,
+               kept_count);
+    } else {
+        size_t input_size = 0;
+        double file_seconds = 0;
+        for (uint32_t i = 0; i < dma_info.entries; ++i) {
+            const zelda64_dma_entry_t entry = manifest.files[i].entry;
+            size_t size = context.jobs[i].action != PACK_ACTION_SKIP ? entry.v_end - entry.v_start : 0;
+            report_file(&params, i, &context.jobs[i], size);
+            input_size += size;
+            file_seconds += context.jobs[i].seconds;
+        }
+        if (params.stats->rom != nullptr) {
+            zelda64_rom_stats_t stats = {
+                    .files = dma_info.entries,
+                    .input_size = input_size,
+                    .output_size = cursor > output_size ? cursor : output_size,
+                    .seconds = zelda64_stats_now() - start,
+                    .file_seconds = file_seconds,
+            };
+            params.stats->rom(&stats, params.stats->userdata);
+        }
+    }
+cleanup:
+    pthread_mutex_destroy(&context.lock);
+    if (context.jobs != nullptr) {
+        for (uint32_t i = 0; i < dma_info.entries; ++i) {
+            if (context.jobs[i].data != nullptr) {
+                allocator.free(context.jobs[i].data, allocator.userdata);
+            }
+        }
+        allocator.free(context.jobs, allocator.userdata);
+    }
+    if (context.compressors != nullptr) {
+        for (size_t i = 0; i < compressor_count; ++i) {
+            zelda64_yaz0_compressor_free(&context.compressors[i]);
+        }
+        allocator.free(context.compressors, allocator.userdata);
+    }
+    if (pool != nullptr) {
+        worker_pool_destroy(pool);
+    }
+    if (dma_out != nullptr) {
+        allocator.free(dma_out, allocator.userdata);
+    }
+    zelda64_checksum_fixup_free(&checksum);
+    zelda64_manifest_free(&manifest);
+    return result;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <zelda64/zelda64.h>
+
+#include "cache.h"
+#include "manifest.h"
+#include "stats.h"
+
+typedef struct zelda64_pack_rom_params {
+    // A directory written by zelda64_extract_rom(), possibly with some of its files changed since.
+    const char *directory;
+    // Optional callback to reserve space for the output, called once with the final size before anything is written.
+    void (*reserve)(size_t size, void *userdata);
+    zelda64_write_data_func_t *write_data;
+    // Optional callback called once after the last write of a successful run, for example to flush buffered writes.
+    // A result other than ZELDA64_OK fails the run.
+    zelda64_finish_func_t *finish;
+    // Recalculates CRC1 and CRC2 in the header of the output from a copy of the checksummed range taken as it is
+    // written, right before finish is called.
+    bool fix_checksum;
+    // The amount of worker threads to load and compress files on. When set to 0 everything runs on the calling thread.
+    size_t thread_count;
+    // The Yaz0 compression level for changed files, from 0 (store only) to ZELDA64_YAZ0_MAX_LEVEL.
+    int level;
+    // Files larger than this are compressed in segments, see zelda64_compress_rom_params_t.
+    size_t segment_size;
+    // Optional cache of compressed files, see zelda64_compress_rom_params_t.
+    const zelda64_compress_cache_t *cache;
+    // Optional receiver of per-file and ROM statistics. When set, the progress lines on stdout are left out.
+    const zelda64_stats_sink_t *stats;
+    void *userdata;
+} zelda64_pack_rom_params_t;
+
+/**
+ * Builds a ROM from an extracted directory. Files are stored the way the manifest says. Compressed files that still
+ * match the CRC-32 in the manifest reuse the Yaz0 blob they were extracted with, only changed files are compressed.
+ * @param params Struct with parameters to the function.
+ * @param allocator The allocator used for the worker pool and the files.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if the manifest is malformed or a file does not have the
+ * size of its DMA entry, ZELDA64_ERROR_IO if a file could not be read, ZELDA64_ERROR_OUT_OF_MEMORY, or the result of the
+ * finish callback.
+ */
+zelda64_result_t zelda64_pack_rom(zelda64_pack_rom_params_t params, zelda64_allocator_t allocator);
@@ -0,0 +1,690 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <zelda64/dma.h>
+#include <zelda64/yaz0.h>
+
+#include "checksum.h"
+#include "compress.h"
+#include "patch.h"
+#include "pool.h"
+#include "../lib/util.h"
+
+// ZPF is the patch format of the Ocarina of Time randomizer. After inflating, the file holds a header, a list of DMA
+// records that move, add or clear files, and a list of blocks of bytes XOR'd against the original decompressed ROM.
+#define ZPF_MAGIC "ZPFv1"
+#define ZPF_HEADER_SIZE 0x15
+#define ZPF_RECORD_SIZE 13
+#define ZPF_END_OF_RECORDS 0xFFFF
+#define ZPF_END_OF_BLOCKS 0xFFFFFFFF
+#define ZPF_NO_SOURCE 0xFFFFFFFF
+
+typedef enum patch_write_kind {
+    PATCH_WRITE_DATA = 0,
+    PATCH_WRITE_COPY = 1,
+    PATCH_WRITE_ZERO = 2,
+} patch_write_kind_t;
+
+// A write to the decompressed ROM. Writes are kept in patch order and replayed over every range that is rebuilt.
+typedef struct patch_write {
+    uint32_t address;
+    uint32_t size;
+    patch_write_kind_t kind;
+    // The bytes to write for PATCH_WRITE_DATA.
+    const uint8_t *data;
+    // Address in the original decompressed ROM to copy from for PATCH_WRITE_COPY.
+    uint32_t source;
+} patch_write_t;
+
+typedef enum patch_action {
+    PATCH_ACTION_SKIP = 0,
+    PATCH_ACTION_KEEP = 1,
+    PATCH_ACTION_STORE = 2,
+    PATCH_ACTION_COMPRESS = 3,
+} patch_action_t;
+
+typedef struct patch_job {
+    // The entry in the patched ROM, in decompressed form.
+    zelda64_dma_entry_t entry;
+    patch_action_t action;
+    // What ends up in the output: the stored file for PATCH_ACTION_KEEP, the rebuilt file otherwise.
+    const uint8_t *data;
+    size_t size;
+    // The amount of bytes the file takes up in the ROM, including padding.
+    size_t stored_size;
+    bool compressed;
+    bool cached;
+    double seconds;
+    uint8_t *buffer;
+} patch_job_t;
+
+typedef struct patch_context {
+    const zelda64_patch_rom_params_t *params;
+    zelda64_allocator_t allocator;
+    const zelda64_rom_t *rom;
+    // Decompressed contents of the original files, loaded when first needed.
+    const uint8_t **files;
+    bool *owned;
+    bool *needed;
+    zelda64_dma_table_t original;
+    // The original DMA table as it reads in a decompressed ROM.
+    uint8_t *table;
+    // The DMA entries written by the records, which writes point into.
+    uint8_t *records;
+    patch_write_t *writes;
+    size_t write_count;
+    patch_job_t *jobs;
+    // Indices into jobs of the files that need rebuilding.
+    uint32_t *queue;
+    // Indices into files of the files that need decompressing.
+    uint32_t *loads;
+    zelda64_yaz0_compressor_t *compressors;
+    worker_pool_t *pool;
+    pthread_mutex_t lock;
+    zelda64_result_t result;
+} patch_context_t;
+
+static void fail(patch_context_t *context, zelda64_result_t result) {
+    pthread_mutex_lock(&context->lock);
+    context->result = result;
+    pthread_mutex_unlock(&context->lock);
+}
+
+// Workers print under the lock so their lines never run into each other.
+static void print_progress(patch_context_t *context, const char *action, uint32_t index) {
+    if (context->params->stats != nullptr) {
+        return;
+    }
+    pthread_mutex_lock(&context->lock);
+    printf("%s file %u/%u\n", action, index + 1, context->rom->dma_info.entries);
+    pthread_mutex_unlock(&context->lock);
+}
+
+static zelda64_result_t inflate_patch(const uint8_t *src, size_t src_size, zelda64_allocator_t allocator,
+                                      uint8_t **out, size_t *out_size) {
+    z_stream stream = {};
+    if (src_size > UINT32_MAX || inflateInit(&stream) != Z_OK) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    size_t capacity = src_size * 4 + 0x1000;
+    uint8_t *buffer = allocator.alloc(capacity, sizeof(uint8_t), allocator.userdata);
+    zelda64_result_t result = buffer != nullptr ? ZELDA64_OK : ZELDA64_ERROR_OUT_OF_MEMORY;
+    stream.next_in = (Bytef *) src;
+    stream.avail_in = (uInt) src_size;
+    while (result == ZELDA64_OK) {
+        if (stream.total_out == capacity) {
+            uint8_t *grown = allocator.resize(buffer, capacity * 2, sizeof(uint8_t), allocator.userdata);
+            if (grown == nullptr) {
+                result = ZELDA64_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        size_t available = capacity - stream.total_out;
+        stream.next_out = buffer + stream.total_out;
+        stream.avail_out = available > UINT32_MAX ? UINT32_MAX : (uInt) available;
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            break;
+        }
+        // Running out of input before the end of the stream means the patch is truncated.
+        if ((status != Z_OK && status != Z_BUF_ERROR) || (stream.avail_in == 0 && stream.avail_out > 0)) {
+            result = ZELDA64_ERROR_INVALID_DATA;
+        }
+    }
+    *out_size = stream.total_out;
+    inflateEnd(&stream);
+    if (result != ZELDA64_OK && buffer != nullptr) {
+        allocator.free(buffer, allocator.userdata);
+        buffer = nullptr;
+    }
+    *out = buffer;
+    return result;
+}
+
+static inline zelda64_dma_entry_t original_entry(const patch_context_t *context, uint32_t index) {
+    return zelda64_dma_table_entry(&context->original, index);
+}
+
+static void mark_needed(patch_context_t *context, uint64_t address, uint64_t size) {
+    uint64_t end = address + size;
+    const zelda64_dma_table_t *original = &context->original;
+    for (uint32_t k = zelda64_dma_table_lower_bound_virtual(original, address > UINT32_MAX ? UINT32_MAX : address);
+         k < original->virtual_count; ++k) {
+        uint32_t index = original->by_virtual[k];
+        if (original->v_start[index] >= end) {
+            break;
+        }
+        context->needed[index] = true;
+    }
+}
+
+static void load_job(size_t job, [[maybe_unused]] size_t worker, void *userdata) {
+    patch_context_t *context = (patch_context_t *) userdata;
+    uint32_t index = context->loads[job];
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    zelda64_dma_entry_t entry = original_entry(context, index);
+    size_t file_size = entry.v_end - entry.v_start;
+    if (zelda64_rom_get_file_data(context->rom, index, &data, &size) != ZELDA64_OK || size < 16) {
+        fail(context, ZELDA64_ERROR_INVALID_DATA);
+        return;
+    }
+    uint8_t *file = context->allocator.alloc(file_size, sizeof(uint8_t), context->allocator.userdata);
+    if (file == nullptr) {
+        fail(context, ZELDA64_ERROR_OUT_OF_MEMORY);
+        return;
+    }
+    zelda64_yaz0_header_t header = zelda64_get_yaz0_header(data, size);
+    if (!zelda64_is_valid_yaz0_header(header) || header.uncompressed_size > file_size ||
+        zelda64_yaz0_decompress_checked(file, header.uncompressed_size, data, size) != ZELDA64_OK) {
+        context->allocator.free(file, context->allocator.userdata);
+        fail(context, ZELDA64_ERROR_INVALID_DATA);
+        return;
+    }
+    context->files[index] = file;
+    context->owned[index] = true;
+}
+
+// Makes every original file marked as needed available, decompressing the compressed ones on the pool.
+static zelda64_result_t load_needed(patch_context_t *context, worker_pool_t *pool) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < context->rom->dma_info.entries; ++i) {
+        if (!context->needed[i] || context->files[i] != nullptr) {
+            continue;
+        }
+        zelda64_dma_entry_t entry = original_entry(context, i);
+        if (zelda64_is_uncompressed_file(entry)) {
+            const uint8_t *data = nullptr;
+            size_t size = 0;
+            if (zelda64_rom_get_file_data(context->rom, i, &data, &size) != ZELDA64_OK) {
+                return ZELDA64_ERROR_INVALID_DATA;
+            }
+            context->files[i] = data;
+        } else {
+            context->loads[count++] = i;
+        }
+    }
+    worker_pool_run(pool, count, load_job, context);
+    return context->result;
+}
+
+// Reads a range of the original ROM as it would be after decompression.
+static void read_original(const patch_context_t *context, uint32_t address, uint32_t size, uint8_t *dest) {
+    memset(dest, 0, size);
+    uint64_t end = (uint64_t) address + size;
+    const zelda64_dma_table_t *original = &context->original;
+    for (uint32_t k = zelda64_dma_table_lower_bound_virtual(original, address); k < original->virtual_count; ++k) {
+        uint32_t index = original->by_virtual[k];
+        zelda64_dma_entry_t entry = original_entry(context, index);
+        if (entry.v_start >= end) {
+            break;
+        }
+        const uint8_t *file = context->files[index];
+        assert(file != nullptr);
+        uint32_t from = entry.v_start > address ? entry.v_start : address;
+        uint64_t to = entry.v_end < end ? entry.v_end : end;
+        memcpy(dest + (from - address), file + (from - entry.v_start), to - from);
+    }
+    // Decompressing rewrites the DMA table, the patch was made against that version of it.
+    const zelda64_dma_info_t *dma_info = &context->rom->dma_info;
+    uint64_t table_end = (uint64_t) dma_info->offset + dma_info->size;
+    if (address < table_end && end > dma_info->offset) {
+        uint32_t from = dma_info->offset > address ? dma_info->offset : address;
+        uint64_t to = table_end < end ? table_end : end;
+        memcpy(dest + (from - address), context->table + (from - dma_info->offset), to - from);
+    }
+}
+
+static bool overlaps(const patch_write_t *write, uint32_t address, uint32_t size) {
+    return write->address < (uint64_t) address + size && (uint64_t) write->address + write->size > address;
+}
+
+// Reads a range of the patched ROM, replaying every write that lands in it.
+static void read_patched(const patch_context_t *context, uint32_t address, uint32_t size, uint8_t *dest) {
+    read_original(context, address, size, dest);
+    for (size_t i = 0; i < context->write_count; ++i) {
+        const patch_write_t *write = &context->writes[i];
+        if (!overlaps(write, address, size)) {
+            continue;
+        }
+        uint32_t from = write->address > address ? write->address : address;
+        uint64_t write_end = (uint64_t) write->address + write->size;
+        uint64_t to = write_end < (uint64_t) address + size ? write_end : (uint64_t) address + size;
+        uint32_t offset = from - write->address;
+        uint8_t *out = dest + (from - address);
+        switch (write->kind) {
+            case PATCH_WRITE_DATA:
+                memcpy(out, write->data + offset, to - from);
+                break;
+            case PATCH_WRITE_COPY:
+                read_original(context, write->source + offset, (uint32_t) (to - from), out);
+                break;
+            case PATCH_WRITE_ZERO:
+                memset(out, 0, to - from);
+                break;
+        }
+    }
+}
+
+static bool touched_by_writes(const patch_context_t *context, uint32_t address, uint32_t size) {
+    for (size_t i = 0; i < context->write_count; ++i) {
+        if (overlaps(&context->writes[i], address, size)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_excluded(const zelda64_patch_rom_params_t *params, uint32_t index) {
+    for (size_t i = 0; i < params->exclusion_list_size; ++i) {
+        if (params->exclusion_list[i] == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void rebuild_job(size_t job, size_t worker, void *userdata) {
+    patch_context_t *context = (patch_context_t *) userdata;
+    const zelda64_patch_rom_params_t *params = context->params;
+    uint32_t index = context->queue[job];
+    patch_job_t *patch_job = &context->jobs[index];
+    double start = zelda64_stats_now();
+    uint32_t size = patch_job->entry.v_end - patch_job->entry.v_start;
+    uint8_t *file = context->allocator.alloc(size, sizeof(uint8_t), context->allocator.userdata);
+    if (file == nullptr) {
+        fail(context, ZELDA64_ERROR_OUT_OF_MEMORY);
+        return;
+    }
+    read_patched(context, patch_job->entry.v_start, size, file);
+    if (patch_job->action == PATCH_ACTION_STORE) {
+        print_progress(context, "patching", index);
+        patch_job->buffer = file;
+        patch_job->data = file;
+        patch_job->size = size;
+        patch_job->stored_size = size;
+        patch_job->seconds = zelda64_stats_now() - start;
+        return;
+    }
+    print_progress(context, "patching and compressing", index);
+    size_t capacity = zelda64_yaz0_compress_bound(size);
+    uint8_t *compressed = context->allocator.alloc(capacity, sizeof(uint8_t), context->allocator.userdata);
+    if (compressed == nullptr) {
+        context->allocator.free(file, context->allocator.userdata);
+        fail(context, ZELDA64_ERROR_OUT_OF_MEMORY);
+        return;
+    }
+    size_t compressed_size = 0;
+    zelda64_compress_cache_key_t key;
+    bool cached = false;
+    if (params->cache != nullptr) {
+        key = zelda64_compress_cache_key(file, size, params->level, params->segment_size);
+        cached = zelda64_compress_cache_lookup(params->cache, key, file, size, compressed, &compressed_size,
+                                               context->allocator);
+    }
+    zelda64_result_t result = ZELDA64_OK;
+    if (!cached) {
+        result = zelda64_compress_file(&context->compressors[worker], context->pool, params->segment_size, file, size,
+                                       compressed, &compressed_size, nullptr, context->allocator);
+        if (result == ZELDA64_OK && params->cache != nullptr) {
+            zelda64_compress_cache_store(params->cache, key, compressed, compressed_size);
+        }
+    }
+    context->allocator.free(file, context->allocator.userdata);
+    if (result != ZELDA64_OK) {
+        context->allocator.free(compressed, context->allocator.userdata);
+        fail(context, result);
+        return;
+    }
+    patch_job->buffer = compressed;
+    patch_job->data = compressed;
+    patch_job->size = compressed_size;
+    // File sizes must be aligned.
+    patch_job->stored_size = (compressed_size + 31) & -16;
+    patch_job->cached = cached;
+    patch_job->seconds = zelda64_stats_now() - start;
+}
+
+static void report_file(const zelda64_patch_rom_params_t *params, uint32_t index, const patch_job_t *job) {
+    if (params->stats == nullptr || params->stats->file == nullptr) {
+        return;
+    }
+    zelda64_file_stats_t stats = {
+            .index = index,
+            .action = ZELDA64_FILE_ACTION_SKIPPED,
+            .output_size = job->stored_size,
+            .seconds = job->seconds,
+    };
+    if (job->action != PATCH_ACTION_SKIP) {
+        stats.input_size = job->entry.v_end - job->entry.v_start;
+        if (job->action != PATCH_ACTION_COMPRESS) {
+            stats.action = ZELDA64_FILE_ACTION_COPIED;
+        } else {
+            stats.action = job->cached ? ZELDA64_FILE_ACTION_CACHED : ZELDA64_FILE_ACTION_COMPRESSED;
+        }
+    }
+    params->stats->file(&stats, params->stats->userdata);
+}
+
+// Reads the DMA records and XOR blocks of an inflated patch into writes. The XOR blocks are decoded in place.
+static zelda64_result_t read_patch(patch_context_t *context, worker_pool_t *pool, uint8_t *patch, size_t patch_size) {
+    const zelda64_allocator_t allocator = context->allocator;
+    if (patch_size < ZPF_HEADER_SIZE || memcmp(patch, ZPF_MAGIC, strlen(ZPF_MAGIC)) != 0) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    uint32_t dma_start = u32_from_buf(patch + 0x05);
+    uint32_t xor_start = u32_from_buf(patch + 0x09);
+    uint32_t xor_end = u32_from_buf(patch + 0x0D);
+    uint32_t key_address = u32_from_buf(patch + 0x11);
+    if (xor_end < xor_start || key_address + 1ull < xor_start || key_address > xor_end) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    // Count everything first so the writes can be allocated at once.
+    size_t records = 0;
+    size_t blocks = 0;
+    size_t position = ZPF_HEADER_SIZE;
+    for (;; ++records) {
+        if (patch_size - position < 2) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        if (u16_from_buf(patch + position) == ZPF_END_OF_RECORDS) {
+            position += 2;
+            break;
+        }
+        if (patch_size - position < ZPF_RECORD_SIZE) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        position += ZPF_RECORD_SIZE;
+    }
+    size_t blocks_start = position;
+    for (;; ++blocks) {
+        if (patch_size - position < 4) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        if (u32_from_buf(patch + position) == ZPF_END_OF_BLOCKS) {
+            break;
+        }
+        if (patch_size - position < 6 || patch_size - position - 6 < u16_from_buf(patch + position + 4)) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        position += 6 + u16_from_buf(patch + position + 4);
+    }
+    // Every record rewrites its DMA entry and then fills the file, the blocks follow after all records.
+    uint8_t *entries = allocator.alloc(records > 0 ? records * 16 : 1, sizeof(uint8_t), allocator.userdata);
+    context->records = entries;
+    context->writes = allocator.alloc(records * 2 + blocks + 1, sizeof(patch_write_t), allocator.userdata);
+    if (entries == nullptr || context->writes == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    position = ZPF_HEADER_SIZE;
+    for (size_t i = 0; i < records; ++i, position += ZPF_RECORD_SIZE) {
+        const uint8_t *record = patch + position;
+        uint16_t index = u16_from_buf(record);
+        uint32_t source = u32_from_buf(record + 2);
+        uint32_t start = u32_from_buf(record + 6);
+        uint32_t size = u24_from_buf(record + 10);
+        zelda64_dma_entry_t entry = {start, start + size, start, 0};
+        zelda64_set_dma_table_entry(entries, records * 16, i, entry);
+        context->writes[context->write_count++] = (patch_write_t) {
+                .address = dma_start + index * 16,
+                .size = 16,
+                .kind = PATCH_WRITE_DATA,
+                .data = entries + i * 16,
+        };
+        context->writes[context->write_count++] = (patch_write_t) {
+                .address = start,
+                .size = size,
+                .kind = source != ZPF_NO_SOURCE ? PATCH_WRITE_COPY : PATCH_WRITE_ZERO,
+                .source = source,
+        };
+        if (source != ZPF_NO_SOURCE) {
+            mark_needed(context, source, size);
+        }
+    }
+    // The XOR key is read from the original ROM, skipping zero bytes and wrapping around within the key range.
+    size_t key_range = (size_t) xor_end - xor_start + 1;
+    uint8_t *keys = allocator.alloc(key_range, sizeof(uint8_t), allocator.userdata);
+    if (keys == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    mark_needed(context, xor_start, key_range);
+    mark_needed(context, context->rom->dma_info.offset, context->rom->dma_info.size);
+    zelda64_result_t result = load_needed(context, pool);
+    if (result == ZELDA64_OK) {
+        read_original(context, xor_start, (uint32_t) key_range, keys);
+        bool has_key = false;
+        for (size_t i = 0; i < key_range && !has_key; ++i) {
+            has_key = keys[i] != 0;
+        }
+        if (blocks > 0 && !has_key) {
+            // A key range of nothing but zeros would never yield a key.
+            result = ZELDA64_ERROR_INVALID_DATA;
+        }
+    }
+    position = blocks_start;
+    for (size_t i = 0; i < blocks && result == ZELDA64_OK; ++i) {
+        uint32_t block_start = u32_from_buf(patch + position);
+        uint16_t block_size = u16_from_buf(patch + position + 4);
+        uint8_t *data = patch + position + 6;
+        for (uint16_t j = 0; j < block_size; ++j) {
+            uint8_t key = 0;
+            while (key == 0) {
+                key_address = key_address >= xor_end ? xor_start : key_address + 1;
+                key = keys[key_address - xor_start];
+            }
+            data[j] ^= key;
+        }
+        context->writes[context->write_count++] = (patch_write_t) {
+                .address = block_start,
+                .size = block_size,
+                .kind = PATCH_WRITE_DATA,
+                .data = data,
+        };
+        position += 6 + block_size;
+    }
+    allocator.free(keys, allocator.userdata);
+    return result;
+}
+
+// Decides per file of the patched ROM whether it can be copied over as is or needs rebuilding.
+static uint32_t plan_jobs(patch_context_t *context, const uint8_t *patched_table) {
+    const zelda64_rom_t *rom = context->rom;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < rom->dma_info.entries; ++i) {
+        patch_job_t *job = &context->jobs[i];
+        zelda64_dma_entry_t entry = zelda64_get_dma_table_entry(patched_table, rom->dma_info.size, i);
+        zelda64_dma_entry_t original = original_entry(context, i);
+        job->entry = entry;
+        if (entry.v_start >= entry.v_end || zelda64_is_empty_file(entry)) {
+            job->action = PATCH_ACTION_SKIP;
+            continue;
+        }
+        bool existed = !zelda64_is_empty_file(original) && original.v_start < original.v_end;
+        bool moved = !existed || original.v_start != entry.v_start || original.v_end != entry.v_end;
+        if (!moved && !touched_by_writes(context, entry.v_start, entry.v_end - entry.v_start)) {
+            const uint8_t *data = nullptr;
+            size_t size = 0;
+            if (zelda64_rom_get_file_data(rom, i, &data, &size) != ZELDA64_OK) {
+                context->result = ZELDA64_ERROR_INVALID_DATA;
+                return 0;
+            }
+            job->action = PATCH_ACTION_KEEP;
+            job->data = data;
+            job->size = size;
+            job->stored_size = zelda64_get_file_size(original);
+            job->compressed = zelda64_is_compressed_file(original);
+            continue;
+        }
+        job->compressed = existed ? zelda64_is_compressed_file(original) : !is_excluded(context->params, i);
+        job->action = job->compressed ? PATCH_ACTION_COMPRESS : PATCH_ACTION_STORE;
+        context->queue[count++] = i;
+        mark_needed(context, entry.v_start, entry.v_end - entry.v_start);
+    }
+    return count;
+}
+
+zelda64_result_t zelda64_patch_rom(zelda64_patch_rom_params_t params, zelda64_allocator_t allocator) {
+    double start = zelda64_stats_now();
+    assert(params.rom != nullptr);
+    assert(params.patch != nullptr);
+    const zelda64_rom_t *rom = params.rom;
+    const zelda64_dma_info_t dma_info = rom->dma_info;
+    uint8_t *patch = nullptr;
+    size_t patch_size = 0;
+    zelda64_result_t result = inflate_patch(params.patch, params.patch_size, allocator, &patch, &patch_size);
+    if (result != ZELDA64_OK) {
+        return result;
+    }
+    patch_context_t context = {
+            .params = &params,
+            .allocator = allocator,
+            .rom = rom,
+            .files = allocator.alloc(dma_info.entries, sizeof(const uint8_t *), allocator.userdata),
+            .owned = allocator.alloc(dma_info.entries, sizeof(bool), allocator.userdata),
+            .needed = allocator.alloc(dma_info.entries, sizeof(bool), allocator.userdata),
+            .table = allocator.alloc(dma_info.size, sizeof(uint8_t), allocator.userdata),
+            .jobs = allocator.alloc(dma_info.entries, sizeof(patch_job_t), allocator.userdata),
+            .queue = allocator.alloc(dma_info.entries, sizeof(uint32_t), allocator.userdata),
+            .loads = allocator.alloc(dma_info.entries, sizeof(uint32_t), allocator.userdata),
+            .result = ZELDA64_OK,
+    };
+    uint8_t *dma_out = allocator.alloc(dma_info.size, sizeof(uint8_t), allocator.userdata);
+    zelda64_checksum_fixup_t checksum = {};
+    worker_pool_t *pool = worker_pool_create(params.thread_count, allocator);
+    context.pool = pool;
+    size_t compressor_count = pool != nullptr ? worker_pool_size(pool) : 0;
+    context.compressors = allocator.alloc(compressor_count, sizeof(zelda64_yaz0_compressor_t), allocator.userdata);
+    for (size_t i = 0; context.compressors != nullptr && i < compressor_count; ++i) {
+        zelda64_yaz0_compressor_init(&context.compressors[i], params.level, allocator);
+    }
+    pthread_mutex_init(&context.lock, nullptr);
+    if (context.files == nullptr || context.owned == nullptr || context.needed == nullptr ||
+        context.table == nullptr || context.jobs == nullptr || context.queue == nullptr || context.loads == nullptr ||
+        context.compressors == nullptr || dma_out == nullptr || pool == nullptr ||
+        (params.fix_checksum && zelda64_checksum_fixup_init(&checksum, allocator) != ZELDA64_OK) ||
+        zelda64_dma_table_decode(&context.original, rom->dma_table, dma_info.size, allocator) != ZELDA64_OK) {
+        result = ZELDA64_ERROR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+    // The table as the decompressor would have written it.
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        zelda64_dma_entry_t entry = original_entry(&context, i);
+        if (!zelda64_is_empty_file(entry)) {
+            entry.p_start = entry.v_start;
+            entry.p_end = 0;
+        }
+        zelda64_set_dma_table_entry(context.table, dma_info.size, i, entry);
+    }
+    result = read_patch(&context, pool, patch, patch_size);
+    if (result != ZELDA64_OK) {
+        goto cleanup;
+    }
+    // Replaying the writes over the table gives the layout of the patched ROM.
+    read_patched(&context, dma_info.offset, dma_info.size, dma_out);
+    uint32_t rebuilds = plan_jobs(&context, dma_out);
+    if (context.result == ZELDA64_OK) {
+        context.result = load_needed(&context, pool);
+    }
+    if (context.result == ZELDA64_OK) {
+        worker_pool_run(pool, rebuilds, rebuild_job, &context);
+    }
+    result = context.result;
+    if (result != ZELDA64_OK) {
+        goto cleanup;
+    }
+    // Lay the files out back to back in table order, like the compressor does.
+    size_t output_size = dma_info.offset + dma_info.size;
+    size_t cursor = 0;
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        cursor += context.jobs[i].stored_size;
+    }
+    if (params.reserve != nullptr) {
+        params.reserve(cursor > output_size ? cursor : output_size, params.userdata);
+    }
+    cursor = 0;
+    for (uint32_t i = 0; i < dma_info.entries; ++i) {
+        patch_job_t *job = &context.jobs[i];
+        zelda64_dma_entry_t entry = job->entry;
+        if (job->action != PATCH_ACTION_SKIP) {
+            params.write_data((void *) job->data, job->size, cursor, params.userdata);
+            zelda64_checksum_fixup_update(&checksum, job->data, job->size, cursor);
+            entry.p_start = cursor;
+            entry.p_end = job->compressed ? cursor + job->stored_size : 0;
+            cursor += job->stored_size;
+        }
+        zelda64_set_dma_table_entry(dma_out, dma_info.size, i, entry);
+    }
+    params.write_data(dma_out, dma_info.size, dma_info.offset, params.userdata);
+    zelda64_checksum_fixup_update(&checksum, dma_out, dma_info.size, dma_info.offset);
+    zelda64_checksum_fixup_write(&checksum, params.write_data, params.userdata);
+    if (params.finish != nullptr) {
+        result = params.finish(params.userdata);
+        if (result != ZELDA64_OK) {
+            goto cleanup;
+        }
+    }
+    if (params.stats == nullptr) {
+        printf("patched %u files, kept %u files as they were\n", rebuilds, dma_info.entries - rebuilds);
+    } else {
+        size_t input_size = 0;
+        double file_seconds = 0;
+        for (uint32_t i = 0; i < dma_info.entries; ++i) {
+            report_file(&params, i, &context.jobs[i]);
+            input_size += context.jobs[i].action != PATCH_ACTION_SKIP
+                          ? context.jobs[i].entry.v_end - context.jobs[i].entry.v_start
+                          : 0;
+            file_seconds += context.jobs[i].seconds;
+        }
+        if (params.stats->rom != nullptr) {
+            zelda64_rom_stats_t stats = {
+                    .files = dma_info.entries,
+                    .input_size = input_size,
+                    .output_size = cursor > output_size ? cursor : output_size,
+                    .seconds = zelda64_stats_now() - start,
+                    .file_seconds = file_seconds,
+            };
+            params.stats->rom(&stats, params.stats->userdata);
+        }
+    }
+cleanup:
+    pthread_mutex_destroy(&context.lock);
+    if (context.jobs != nullptr) {
+        for (uint32_t i = 0; i < dma_info.entries; ++i) {
+            if (context.jobs[i].buffer != nullptr) {
+                allocator.free(context.jobs[i].buffer, allocator.userdata);
+            }
+        }
+    }
+    if (context.files != nullptr && context.owned != nullptr) {
+        for (uint32_t i = 0; i < dma_info.entries; ++i) {
+            if (context.owned[i]) {
+                allocator.free((void *) context.files[i], allocator.userdata);
+            }
+        }
+    }
+    if (context.compressors != nullptr) {
+        for (size_t i = 0; i < compressor_count; ++i) {
+            zelda64_yaz0_compressor_free(&context.compressors[i]);
+        }
+    }
+    if (pool != nullptr) {
+        worker_pool_destroy(pool);
+    }
+    zelda64_dma_table_free(&context.original);
+    zelda64_checksum_fixup_free(&checksum);
+    void *buffers[] = {
+            context.files, context.owned, context.needed, context.table, context.jobs, context.queue, context.loads,
+            context.records, context.writes, context.compressors, dma_out, patch,
+    };
+    for (size_t i = 0; i < sizeof buffers / sizeof buffers[0]; ++i) {
+        if (buffers[i] != nullptr) {
+            allocator.free(buffers[i], allocator.userdata);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zelda64/rom.h>
+#include <zelda64/zelda64.h>
+
+#include "cache.h"
+#include "stats.h"
+
+typedef struct zelda64_patch_rom_params {
+    // The ROM to patch. Patches address the decompressed ROM, but the ROM itself is usually compressed.
+    const zelda64_rom_t *rom;
+    // The ZPF patch file as it is stored on disk, that is, still zlib compressed.
+    const uint8_t *patch;
+    size_t patch_size;
+    // Optional callback to reserve space for the output, called once with the final size before anything is written.
+    void (*reserve)(size_t size, void *userdata);
+    zelda64_write_data_func_t *write_data;
+    // Optional callback called once after the last write of a successful run, for example to flush buffered writes.
+    // A result other than ZELDA64_OK fails the run.
+    zelda64_finish_func_t *finish;
+    // Recalculates CRC1 and CRC2 in the header of the output from a copy of the checksummed range taken as it is
+    // written, right before finish is called.
+    bool fix_checksum;
+    // Files added by the patch are compressed unless they are on this list. Files that already exist keep the form
+    // they are stored in.
+    uint32_t *exclusion_list;
+    size_t exclusion_list_size;
+    // The amount of worker threads to rebuild patched files on. When set to 0 everything runs on the calling thread.
+    size_t thread_count;
+    // The Yaz0 compression level for patched files, from 0 (store only) to ZELDA64_YAZ0_MAX_LEVEL.
+    int level;
+    // Files larger than this are compressed in segments, see zelda64_compress_rom_params_t.
+    size_t segment_size;
+    // Optional cache of compressed files, see zelda64_compress_rom_params_t.
+    const zelda64_compress_cache_t *cache;
+    // Optional receiver of per-file and ROM statistics. When set, the progress lines on stdout are left out.
+    const zelda64_stats_sink_t *stats;
+    void *userdata;
+} zelda64_patch_rom_params_t;
+
+/**
+ * Applies a ZPF patch to a ROM and writes the patched ROM. Only the files the patch touches are decompressed, patched
+ * and compressed again, all other files are copied over exactly as they are stored.
+ * @param params Struct with parameters to the function.
+ * @param allocator The allocator used for the patch and the rebuilt files.
+ * @return ZELDA64_OK on success, ZELDA64_ERROR_INVALID_DATA if the patch or the ROM is malformed,
+ * ZELDA64_ERROR_OUT_OF_MEMORY, or the result of the finish callback.
+ */
+zelda64_result_t zelda64_patch_rom(zelda64_patch_rom_params_t params, zelda64_allocator_t allocator);
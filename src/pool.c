@@ -0,0 +1,244 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "pool.h"
+
+// Each participant in a batch owns a deque of jobs, and steals half of another participant's remaining jobs when its
+// own run out. Jobs are dealt out round-robin, so the deque of a participant holds the jobs with the index
+// `local * stride + owner` for every local index from begin up to end. Stolen work keeps the owner it was dealt to.
+typedef struct worker_pool_deque {
+    pthread_mutex_t lock;
+    size_t owner;
+    size_t begin;
+    size_t end;
+} worker_pool_deque_t;
+
+typedef struct worker_pool_batch {
+    struct worker_pool_batch *next;
+    worker_pool_job_func_t *func;
+    void *userdata;
+    worker_pool_deque_t *deques;
+    size_t deque_count;
+    size_t job_count;
+    atomic_size_t jobs_claimed;
+    atomic_size_t jobs_finished;
+    // Amount of pool threads currently working on the batch, guarded by the pool lock.
+    size_t active_threads;
+} worker_pool_batch_t;
+
+typedef struct worker_pool_thread {
+    worker_pool_t *pool;
+    pthread_t thread;
+    size_t index;
+} worker_pool_thread_t;
+
+struct worker_pool {
+    zelda64_allocator_t allocator;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t work_finished;
+    worker_pool_batch_t *batches;
+    worker_pool_thread_t *threads;
+    size_t thread_count;
+    bool shutdown;
+};
+
+// Finds a batch that still has jobs nobody has picked up yet. Must be called with the pool lock held.
+static worker_pool_batch_t *find_pending_batch(worker_pool_t *pool) {
+    for (worker_pool_batch_t *batch = pool->batches; batch != nullptr; batch = batch->next) {
+        if (atomic_load(&batch->jobs_claimed) < batch->job_count) {
+            return batch;
+        }
+    }
+    return nullptr;
+}
+
+// Takes the next job from the front of a participant's own deque.
+static bool pop_job(worker_pool_batch_t *batch, size_t worker, size_t *job) {
+    worker_pool_deque_t *deque = &batch->deques[worker];
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->begin < deque->end) {
+        *job = deque->begin++ * batch->deque_count + deque->owner;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Moves the back half of another participant's deque into the (empty) deque of the thief.
+static bool steal_jobs(worker_pool_batch_t *batch, size_t thief) {
+    for (size_t i = 1; i < batch->deque_count; ++i) {
+        worker_pool_deque_t *victim = &batch->deques[(thief + i) % batch->deque_count];
+        pthread_mutex_lock(&victim->lock);
+        size_t remaining = victim->end - victim->begin;
+        if (remaining == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t owner = victim->owner;
+        size_t end = victim->end;
+        victim->end -= (remaining + 1) / 2;
+        size_t begin = victim->end;
+        pthread_mutex_unlock(&victim->lock);
+        worker_pool_deque_t *deque = &batch->deques[thief];
+        pthread_mutex_lock(&deque->lock);
+        deque->owner = owner;
+        deque->begin = begin;
+        deque->end = end;
+        pthread_mutex_unlock(&deque->lock);
+        return true;
+    }
+    return false;
+}
+
+// Runs jobs from the batch until none are left to claim.
+static void run_jobs(worker_pool_t *pool, worker_pool_batch_t *batch, size_t worker) {
+    size_t job = 0;
+    while (atomic_load(&batch->jobs_claimed) < batch->job_count) {
+        if (!pop_job(batch, worker, &job)) {
+            if (!steal_jobs(batch, worker)) {
+                break;
+            }
+            continue;
+        }
+        atomic_fetch_add(&batch->jobs_claimed, 1);
+        batch->func(job, worker, batch->userdata);
+        if (atomic_fetch_add(&batch->jobs_finished, 1) + 1 == batch->job_count) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->work_finished);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+static void *worker_thread(void *userdata) {
+    worker_pool_thread_t *thread = (worker_pool_thread_t *) userdata;
+    worker_pool_t *pool = thread->pool;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown) {
+        worker_pool_batch_t *batch = find_pending_batch(pool);
+        if (batch == nullptr) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+            continue;
+        }
+        batch->active_threads++;
+        pthread_mutex_unlock(&pool->lock);
+        run_jobs(pool, batch, thread->index);
+        pthread_mutex_lock(&pool->lock);
+        if (--batch->active_threads == 0) {
+            pthread_cond_broadcast(&pool->work_finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return nullptr;
+}
+
+worker_pool_t *worker_pool_create(size_t thread_count, zelda64_allocator_t allocator) {
+    worker_pool_t *pool = allocator.alloc(1, sizeof(worker_pool_t), allocator.userdata);
+    if (pool == nullptr) {
+        return nullptr;
+    }
+    pool->allocator = allocator;
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->work_available, nullptr);
+    pthread_cond_init(&pool->work_finished, nullptr);
+    if (thread_count > 0) {
+        pool->threads = allocator.alloc(thread_count, sizeof(worker_pool_thread_t), allocator.userdata);
+        if (pool->threads == nullptr) {
+            worker_pool_destroy(pool);
+            return nullptr;
+        }
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        worker_pool_thread_t *thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->index = i;
+        if (pthread_create(&thread->thread, nullptr, worker_thread, thread) != 0) {
+            worker_pool_destroy(pool);
+            return nullptr;
+        }
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+void worker_pool_destroy(worker_pool_t *pool) {
+    assert(pool != nullptr);
+    assert(pool->batches == nullptr);
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->thread_count; ++i) {
+        pthread_join(pool->threads[i].thread, nullptr);
+    }
+    pthread_cond_destroy(&pool->work_finished);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+    zelda64_allocator_t allocator = pool->allocator;
+    if (pool->threads != nullptr) {
+        allocator.free(pool->threads, allocator.userdata);
+    }
+    allocator.free(pool, allocator.userdata);
+}
+
+size_t worker_pool_size(const worker_pool_t *pool) {
+    assert(pool != nullptr);
+    return pool->thread_count + 1;
+}
+
+void worker_pool_run(worker_pool_t *pool, size_t job_count, worker_pool_job_func_t *func, void *userdata) {
+    assert(pool != nullptr);
+    assert(func != nullptr);
+    if (job_count == 0) {
+        return;
+    }
+    size_t deque_count = worker_pool_size(pool);
+    // The calling thread always gets the last worker index, threads in the pool never use it.
+    size_t caller = deque_count - 1;
+    worker_pool_deque_t *deques = pool->allocator.alloc(deque_count, sizeof(worker_pool_deque_t),
+                                                        pool->allocator.userdata);
+    if (deques == nullptr) {
+        // Without deques there is nothing to steal from, run the batch on the calling thread instead.
+        for (size_t i = 0; i < job_count; ++i) {
+            func(i, caller, userdata);
+        }
+        return;
+    }
+    for (size_t i = 0; i < deque_count; ++i) {
+        pthread_mutex_init(&deques[i].lock, nullptr);
+        deques[i].owner = i;
+        deques[i].end = i < job_count ? (job_count - i + deque_count - 1) / deque_count : 0;
+    }
+    worker_pool_batch_t batch = {
+            .func = func,
+            .userdata = userdata,
+            .deques = deques,
+            .deque_count = deque_count,
+            .job_count = job_count,
+    };
+    pthread_mutex_lock(&pool->lock);
+    batch.next = pool->batches;
+    pool->batches = &batch;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    run_jobs(pool, &batch, caller);
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&batch.jobs_finished) < batch.job_count || batch.active_threads > 0) {
+        pthread_cond_wait(&pool->work_finished, &pool->lock);
+    }
+    // Unlink the batch before it goes out of scope.
+    worker_pool_batch_t **link = &pool->batches;
+    while (*link != &batch) {
+        link = &(*link)->next;
+    }
+    *link = batch.next;
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < deque_count; ++i) {
+        pthread_mutex_destroy(&deques[i].lock);
+    }
+    pool->allocator.free(deques, pool->allocator.userdata);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <zelda64/zelda64.h>
+
+typedef struct worker_pool worker_pool_t;
+
+/**
+ * Function executed for every job in a batch.
+ * @param job Index of the job within the batch.
+ * @param worker Index of the thread running the job, unique within the batch and less than worker_pool_size().
+ * @param userdata Pointer passed in to worker_pool_run().
+ */
+typedef void (worker_pool_job_func_t)(size_t job, size_t worker, void *userdata);
+
+/**
+ * Creates a pool of worker threads.
+ * @param thread_count The amount of threads to spawn. With 0 threads every batch runs on the calling thread.
+ * @param allocator The allocator used for the pool itself.
+ * @return The new pool, or nullptr on failure.
+ */
+worker_pool_t *worker_pool_create(size_t thread_count, zelda64_allocator_t allocator);
+
+/**
+ * Stops all threads in the pool and frees it.
+ * @param pool The pool to destroy. No batches may be running.
+ */
+void worker_pool_destroy(worker_pool_t *pool);
+
+/**
+ * Returns the amount of distinct worker indices a job function may be called with.
+ * @param pool The pool to query.
+ * @return The amount of threads in the pool plus one for the calling thread.
+ */
+size_t worker_pool_size(const worker_pool_t *pool);
+
+/**
+ * Runs a batch of jobs on the pool and blocks until all of them have finished. The calling thread takes part in
+ * running its own batch, so batches may be started from within a job and from several threads at the same time.
+ * @param pool The pool to run the jobs on.
+ * @param job_count The amount of jobs in the batch.
+ * @param func The function to call for each job.
+ * @param userdata Pointer passed in to each call of func.
+ */
+void worker_pool_run(worker_pool_t *pool, size_t job_count, worker_pool_job_func_t *func, void *userdata);
@@ -0,0 +1,107 @@
+#include <assert.h>
+
+#include "report.h"
+
+static const char *const action_names[] = {
+        [ZELDA64_FILE_ACTION_SKIPPED] = "skipped",
+        [ZELDA64_FILE_ACTION_COPIED] = "copied",
+        [ZELDA64_FILE_ACTION_COMPRESSED] = "compressed",
+        [ZELDA64_FILE_ACTION_CACHED] = "cached",
+        [ZELDA64_FILE_ACTION_DECOMPRESSED] = "decompressed",
+};
+
+static void collect_file(const zelda64_file_stats_t *stats, void *userdata) {
+    zelda64_report_t *report = (zelda64_report_t *) userdata;
+    if (report->file_count == report->file_capacity) {
+        uint32_t capacity = report->file_capacity > 0 ? report->file_capacity * 2 : 1024;
+        zelda64_file_stats_t *files = report->files == nullptr
+                                      ? report->allocator.alloc(capacity, sizeof(zelda64_file_stats_t),
+                                                                report->allocator.userdata)
+                                      : report->allocator.resize(report->files, capacity,
+                                                                 sizeof(zelda64_file_stats_t),
+                                                                 report->allocator.userdata);
+        // A report missing files is still useful, so running out of memory only drops entries.
+        if (files == nullptr) {
+            return;
+        }
+        report->files = files;
+        report->file_capacity = capacity;
+    }
+    report->files[report->file_count++] = *stats;
+}
+
+static void collect_rom(const zelda64_rom_stats_t *stats, void *userdata) {
+    zelda64_report_t *report = (zelda64_report_t *) userdata;
+    report->rom = *stats;
+    report->finished = true;
+}
+
+void zelda64_report_init(zelda64_report_t *report, zelda64_allocator_t allocator) {
+    assert(report != nullptr);
+    *report = (zelda64_report_t) {
+            .allocator = allocator,
+    };
+}
+
+void zelda64_report_free(zelda64_report_t *report) {
+    assert(report != nullptr);
+    if (report->files != nullptr) {
+        report->allocator.free(report->files, report->allocator.userdata);
+    }
+    report->files = nullptr;
+    report->file_count = 0;
+    report->file_capacity = 0;
+}
+
+zelda64_stats_sink_t zelda64_report_sink(zelda64_report_t *report) {
+    return (zelda64_stats_sink_t) {
+            .file = collect_file,
+            .rom = collect_rom,
+            .userdata = report,
+    };
+}
+
+// Writes the ratio of output to input size, which is undefined for files without input.
+static void write_ratio(FILE *file, size_t input_size, size_t output_size) {
+    if (input_size > 0) {
+        fprintf(file, "%.4f", (double) output_size / (double) input_size);
+    } else {
+        fprintf(file, "null");
+    }
+}
+
+void zelda64_report_write_json(zelda64_report_t *report, FILE *file, const char *operation, int level) {
+    assert(report != nullptr);
+    assert(file != nullptr);
+    // Files arrive in the order workers finish them, the report lists them in table order.
+    for (uint32_t i = 1; i < report->file_count; ++i) {
+        zelda64_file_stats_t stats = report->files[i];
+        uint32_t j = i;
+        for (; j > 0 && report->files[j - 1].index > stats.index; --j) {
+            report->files[j] = report->files[j - 1];
+        }
+        report->files[j] = stats;
+    }
+    fprintf(file, "{\n  \"operation\": \"%s\",\n", operation);
+    if (level >= 0) {
+        fprintf(file, "  \"level\": %d,\n", level);
+    }
+    fprintf(file, "  \"files\": [\n");
+    for (uint32_t i = 0; i < report->file_count; ++i) {
+        const zelda64_file_stats_t *stats = &report->files[i];
+        fprintf(file, "    {\"index\": %u, \"action\": \"%s\", \"input_size\": %zu, \"output_size\": %zu, "
+                      "\"ratio\": ", stats->index, action_names[stats->action], stats->input_size, stats->output_size);
+        write_ratio(file, stats->input_size, stats->output_size);
+        fprintf(file, ", \"seconds\": %.6f}%s\n", stats->seconds, i + 1 < report->file_count ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+    const zelda64_rom_stats_t *rom = &report->rom;
+    // Throughput is measured in uncompressed bytes, which is the input of compression and the output of
+    // decompression.
+    size_t uncompressed_size = rom->input_size > rom->output_size ? rom->input_size : rom->output_size;
+    fprintf(file, "  \"totals\": {\"finished\": %s, \"files\": %u, \"input_size\": %zu, \"output_size\": %zu, "
+                  "\"ratio\": ", report->finished ? "true" : "false", rom->files, rom->input_size, rom->output_size);
+    write_ratio(file, rom->input_size, rom->output_size);
+    fprintf(file, ", \"seconds\": %.6f, \"file_seconds\": %.6f, \"mb_per_s\": %.3f}\n}\n", rom->seconds,
+            rom->file_seconds, rom->seconds > 0 ? (double) uncompressed_size / rom->seconds / 1e6 : 0.0);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <zelda64/zelda64.h>
+
+#include "stats.h"
+
+// Collects the statistics of one run, to write them out as a report afterwards.
+typedef struct zelda64_report {
+    zelda64_file_stats_t *files;
+    uint32_t file_count;
+    uint32_t file_capacity;
+    zelda64_rom_stats_t rom;
+    bool finished;
+    zelda64_allocator_t allocator;
+} zelda64_report_t;
+
+/**
+ * Initializes an empty report.
+ * @param report The report to initialize.
+ * @param allocator The allocator used for the per-file statistics.
+ */
+void zelda64_report_init(zelda64_report_t *report, zelda64_allocator_t allocator);
+
+/**
+ * Frees a report.
+ * @param report The report to free.
+ */
+void zelda64_report_free(zelda64_report_t *report);
+
+/**
+ * Returns a statistics sink that adds everything it receives to a report.
+ * @param report The report to collect into, which must outlive the sink.
+ * @return The sink.
+ */
+zelda64_stats_sink_t zelda64_report_sink(zelda64_report_t *report);
+
+/**
+ * Writes a report as JSON, with files in DMA table order.
+ * @param report The report to write, its files are sorted in place.
+ * @param file The file to write to.
+ * @param operation Name of the operation the report is about.
+ * @param level The compression level, or a negative number if the operation does not compress.
+ */
+void zelda64_report_write_json(zelda64_report_t *report, FILE *file, const char *operation, int level);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+/**
+ * Calculates the SHA-256 digest of a buffer.
+ * @param data The buffer holding the data.
+ * @param size The size of the buffer in bytes.
+ * @param digest Output buffer for the 32 byte digest.
+ */
+void sha256(const uint8_t *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
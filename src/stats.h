@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum zelda64_file_action {
+    // Dead and empty files, which take up no space.
+    ZELDA64_FILE_ACTION_SKIPPED = 0,
+    // Files stored as they are, like those on the exclusion list.
+    ZELDA64_FILE_ACTION_COPIED = 1,
+    ZELDA64_FILE_ACTION_COMPRESSED = 2,
+    // Files whose compressed version was taken from the cache, or when packing, from the extracted directory.
+    ZELDA64_FILE_ACTION_CACHED = 3,
+    ZELDA64_FILE_ACTION_DECOMPRESSED = 4,
+} zelda64_file_action_t;
+
+typedef struct zelda64_file_stats {
+    uint32_t index;
+    zelda64_file_action_t action;
+    // Bytes read from the input and bytes taken up in the output, including padding.
+    size_t input_size;
+    size_t output_size;
+    // Time spent encoding or decoding the file, on whichever thread it ran.
+    double seconds;
+} zelda64_file_stats_t;
+
+typedef struct zelda64_rom_stats {
+    uint32_t files;
+    size_t input_size;
+    size_t output_size;
+    // Wall-clock time of the whole run.
+    double seconds;
+    // Sum of the time spent on all files, which exceeds seconds when files were processed in parallel.
+    double file_seconds;
+} zelda64_rom_stats_t;
+
+// Receives statistics from a run. Either callback may be nullptr. Callbacks are never called concurrently.
+typedef struct zelda64_stats_sink {
+    // Called once per DMA entry, in no particular order.
+    void (*file)(const zelda64_file_stats_t *stats, void *userdata);
+    // Called once at the end of a successful run.
+    void (*rom)(const zelda64_rom_stats_t *stats, void *userdata);
+    void *userdata;
+} zelda64_stats_sink_t;
+
+/**
+ * Returns the current wall-clock time, for measuring durations.
+ * @return The time in seconds.
+ */
+static inline double zelda64_stats_now(void) {
+    struct timespec ts = {};
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <pthread.h>
+
+#include <zelda64/crc32.h>
+#include <zelda64/dma.h>
+#include <zelda64/yaz0.h>
+
+#include "verify.h"
+
+// Decompressed data is checksummed in blocks of this size, so a file never has to be decompressed in one piece.
+#define VERIFY_BLOCK_SIZE (1024 * 16)
+// CRC1 and CRC2 in the header, which cover how the ROM is stored rather than what it decompresses to.
+#define VERIFY_HEADER_CHECKSUM_START 0x10
+#define VERIFY_HEADER_CHECKSUM_END 0x18
+
+typedef struct verify_context {
+    const zelda64_verify_rom_params_t *params;
+    pthread_mutex_t lock;
+    zelda64_result_t result;
+} verify_context_t;
+
+// Calculates the CRC-32 of a file as it is after decompression.
+static zelda64_result_t file_checksum(const zelda64_rom_t *rom, uint32_t index, uint32_t *crc, size_t *size) {
+    zelda64_dma_entry_t entry;
+    const uint8_t *data = nullptr;
+    size_t stored_size = 0;
+    if (zelda64_rom_get_file_entry(rom, index, &entry) != ZELDA64_OK ||
+        zelda64_rom_get_file_data(rom, index, &data, &stored_size) != ZELDA64_OK) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    if (!zelda64_is_compressed_file(entry)) {
+        // The header checksum differs between a ROM and its compressed form, so it is left out of the file holding it.
+        if (entry.v_start == 0 && stored_size >= VERIFY_HEADER_CHECKSUM_END) {
+            *crc = zelda64_crc32_update(0, data, VERIFY_HEADER_CHECKSUM_START);
+            *crc = zelda64_crc32_update(*crc, data + VERIFY_HEADER_CHECKSUM_END,
+                                        stored_size - VERIFY_HEADER_CHECKSUM_END);
+        } else {
+            *crc = stored_size > 0 ? zelda64_crc32_update(0, data, stored_size) : 0;
+        }
+        *size = stored_size;
+        return ZELDA64_OK;
+    }
+    zelda64_yaz0_stream_t stream;
+    zelda64_yaz0_stream_init(&stream);
+    uint8_t block[VERIFY_BLOCK_SIZE];
+    uint32_t checksum = 0;
+    size_t total = 0;
+    while (!zelda64_yaz0_stream_finished(&stream)) {
+        size_t read = 0;
+        size_t written = 0;
+        zelda64_result_t result = zelda64_yaz0_stream_decompress(&stream, data, stored_size, &read, block,
+                                                                 sizeof block, &written);
+        if (result != ZELDA64_OK) {
+            return result;
+        }
+        // The stream stopped making progress before it was finished, so the file is cut short.
+        if (read == 0 && written == 0) {
+            return ZELDA64_ERROR_INVALID_DATA;
+        }
+        data += read;
+        stored_size -= read;
+        checksum = zelda64_crc32_update(checksum, block, written);
+        total += written;
+    }
+    *crc = checksum;
+    *size = total;
+    return ZELDA64_OK;
+}
+
+static void report_mismatch(verify_context_t *context, zelda64_verify_mismatch_t mismatch) {
+    const zelda64_verify_rom_params_t *params = context->params;
+    pthread_mutex_lock(&context->lock);
+    context->result = ZELDA64_ERROR_INVALID_DATA;
+    if (params->mismatch != nullptr) {
+        params->mismatch(&mismatch, params->userdata);
+    }
+    pthread_mutex_unlock(&context->lock);
+}
+
+static void verify_job(size_t job, [[maybe_unused]] size_t worker, void *userdata) {
+    verify_context_t *context = (verify_context_t *) userdata;
+    const zelda64_verify_rom_params_t *params = context->params;
+    uint32_t index = (uint32_t) job;
+    zelda64_dma_entry_t expected;
+    zelda64_dma_entry_t actual;
+    zelda64_rom_get_file_entry(params->source, index, &expected);
+    zelda64_rom_get_file_entry(params->rom, index, &actual);
+    zelda64_verify_mismatch_t mismatch = {
+            .index = index,
+            .failure = ZELDA64_VERIFY_FAILURE_ENTRY,
+    };
+    // Deleted files are written differently by the compressor and the decompressor, any entry without a virtual range
+    // or without physical data holds no file.
+    bool expected_file = !zelda64_is_empty_file(expected) && expected.v_start < expected.v_end;
+    bool actual_file = !zelda64_is_empty_file(actual) && actual.v_start < actual.v_end;
+    if (expected_file != actual_file ||
+        (expected_file && (expected.v_start != actual.v_start || expected.v_end != actual.v_end))) {
+        report_mismatch(context, mismatch);
+        return;
+    }
+    // The DMA table holds different physical addresses by design, its entries are compared one by one instead.
+    if (!expected_file || expected.v_start == params->source->dma_info.offset) {
+        return;
+    }
+    if (file_checksum(params->source, index, &mismatch.expected_crc, &mismatch.expected_size) != ZELDA64_OK ||
+        file_checksum(params->rom, index, &mismatch.actual_crc, &mismatch.actual_size) != ZELDA64_OK) {
+        mismatch.failure = ZELDA64_VERIFY_FAILURE_CORRUPT;
+        report_mismatch(context, mismatch);
+        return;
+    }
+    if (mismatch.expected_crc != mismatch.actual_crc || mismatch.expected_size != mismatch.actual_size) {
+        mismatch.failure = ZELDA64_VERIFY_FAILURE_CONTENTS;
+        report_mismatch(context, mismatch);
+    }
+}
+
+zelda64_result_t zelda64_verify_rom(zelda64_verify_rom_params_t params, zelda64_allocator_t allocator) {
+    assert(params.source != nullptr);
+    assert(params.rom != nullptr);
+    if (params.source->dma_info.entries != params.rom->dma_info.entries) {
+        return ZELDA64_ERROR_INVALID_DATA;
+    }
+    worker_pool_t *pool = params.pool != nullptr ? params.pool : worker_pool_create(params.thread_count, allocator);
+    if (pool == nullptr) {
+        return ZELDA64_ERROR_OUT_OF_MEMORY;
+    }
+    verify_context_t context = {
+            .params = &params,
+            .result = ZELDA64_OK,
+    };
+    pthread_mutex_init(&context.lock, nullptr);
+    // Entries are independent of each other, and the files are read straight out of both ROMs.
+    worker_pool_run(pool, params.rom->dma_info.entries, verify_job, &context);
+    pthread_mutex_destroy(&context.lock);
+    if (pool != params.pool) {
+        worker_pool_destroy(pool);
+    }
+    return context.result;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zelda64/rom.h>
+#include <zelda64/zelda64.h>
+
+#include "pool.h"
+
+typedef enum zelda64_verify_failure {
+    // The entry is missing, or covers a different range of the decompressed ROM than the source entry.
+    ZELDA64_VERIFY_FAILURE_ENTRY = 1,
+    // The file lies outside the ROM or does not decompress.
+    ZELDA64_VERIFY_FAILURE_CORRUPT = 2,
+    // The file decompresses, but not to the contents of the source file.
+    ZELDA64_VERIFY_FAILURE_CONTENTS = 3,
+} zelda64_verify_failure_t;
+
+typedef struct zelda64_verify_mismatch {
+    uint32_t index;
+    zelda64_verify_failure_t failure;
+    // CRC-32 and size of the decompressed file in the source and in the ROM, set for ZELDA64_VERIFY_FAILURE_CONTENTS.
+    uint32_t expected_crc;
+    uint32_t actual_crc;
+    size_t expected_size;
+    size_t actual_size;
+} zelda64_verify_mismatch_t;
+
+typedef struct zelda64_verify_rom_params {
+    // The ROM the files should decompress to, usually the input of zelda64_compress_rom().
+    const zelda64_rom_t *source;
+    // The ROM to check, usually the output of zelda64_compress_rom().
+    const zelda64_rom_t *rom;
+    // The amount of worker threads to check files on. When set to 0 all files are checked on the calling thread.
+    size_t thread_count;
+    // Optional pool to run on instead of one made for this run. When set, thread_count is ignored.
+    worker_pool_t *pool;
+    // Optional callback called for every entry that does not match, in no particular order. Never called concurrently.
+    void (*mismatch)(const zelda64_verify_mismatch_t *mismatch, void *userdata);
+    void *userdata;
+} zelda64_verify_rom_params_t;
+
+/**
+ * Checks that every file of a ROM decompresses to the same file in a source ROM, by comparing the CRC-32 of both.
+ * Files are decompressed a block at a time and never written anywhere, so checking takes next to no memory.
+ * @param params Struct with parameters to the function.
+ * @param allocator The allocator used for the worker pool.
+ * @return ZELDA64_OK if every file matches, ZELDA64_ERROR_INVALID_DATA if any file does not or the DMA tables differ in
+ * size, or ZELDA64_ERROR_OUT_OF_MEMORY.
+ */
+zelda64_result_t zelda64_verify_rom(zelda64_verify_rom_params_t params, zelda64_allocator_t allocator);